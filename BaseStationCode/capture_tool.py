@@ -0,0 +1,49 @@
+"""Assembles and prints packet captures downloaded from the base station.
+
+Each `captureRead` RPC reply is a JSON object with base64 records in "data".
+Save the replies one per line, then:
+
+    python capture_tool.py assemble replies.jsonl capture.bin
+    python capture_tool.py print capture.bin
+
+The records are the CaptureRecord struct in lib/Capture/capturerecord.h. An
+assembled capture can be replayed through the decoder on a computer with:
+
+    CAPTURE_FILE=capture.bin CAPTURE_SPEED=0 pio test -e native -f test_replay
+"""
+import base64
+import json
+import struct
+import sys
+
+RECORD = struct.Struct("<IBBhbB54s")
+
+def assemble(replies_path: str, out_path: str) -> None:
+    """Joins the records from each reply in order of their offset."""
+    chunks = {}
+    with open(replies_path) as file:
+        for line in file:
+            if line.strip():
+                reply = json.loads(line)
+                chunks[reply["offset"]] = base64.b64decode(reply["data"])
+
+    with open(out_path, "wb") as file:
+        for offset in sorted(chunks):
+            file.write(chunks[offset])
+
+def print_records(path: str) -> None:
+    """Prints each record, one per line."""
+    with open(path, "rb") as file:
+        data = file.read()
+
+    for i in range(len(data) // RECORD.size):
+        time, tx, rx, rssi, snr, length, payload = RECORD.unpack_from(data, i * RECORD.size)
+        print(f"{time:10d}ms {tx:3d} -> {rx:3d} RSSI {rssi:4d} SNR {snr / 4:6.2f} {list(payload[:length])}")
+
+if __name__ == "__main__":
+    if len(sys.argv) == 4 and sys.argv[1] == "assemble":
+        assemble(sys.argv[2], sys.argv[3])
+    elif len(sys.argv) == 3 and sys.argv[1] == "print":
+        print_records(sys.argv[2])
+    else:
+        print(__doc__)
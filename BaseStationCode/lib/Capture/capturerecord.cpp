@@ -0,0 +1,34 @@
+/**
+ * @file capturerecord.cpp
+ * @brief Format of recorded packets and the timing used when replaying them.
+ *
+ * @author Jotham Gates
+ * @date May 2025
+ */
+#include "capturerecord.h"
+
+uint32_t captureSlot(const CaptureHeader &header, uint32_t index)
+{
+    // The oldest record is at the start until the ring wraps around.
+    uint32_t oldest = header.count < header.slots ? 0 : header.next;
+    return (oldest + index) % header.slots;
+}
+
+void CaptureReplayClock::start(uint32_t now, float speed)
+{
+    m_speed = speed;
+    m_due = now;
+    m_first = true;
+}
+
+uint32_t CaptureReplayClock::next(uint32_t recordTime)
+{
+    if (!m_first && m_speed != 0 && recordTime > m_lastRecordTime)
+    {
+        // Scale just the gap, as a float can't hold every ms of a long uptime.
+        m_due += (uint32_t)((recordTime - m_lastRecordTime) / m_speed);
+    }
+    m_first = false;
+    m_lastRecordTime = recordTime;
+    return m_due;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file capturerecord.h
+ * @brief Format of recorded packets and the timing used when replaying them.
+ *
+ * A capture is a CaptureHeader followed by a ring of fixed size
+ * CaptureRecords (all little endian). Records are numbered from 0 (the oldest)
+ * when reading and replaying.
+ *
+ * This has no Arduino dependencies so that captures can be replayed on a
+ * computer as well as the ESP32 (see test/test_replay).
+ *
+ * @author Jotham Gates
+ * @date May 2025
+ */
+#pragma once
+#include <stdint.h>
+
+#define CAPTURE_MAGIC 0x31504143 // "CAP1"
+#define CAPTURE_PAYLOAD_SIZE 54 // Longer payloads are truncated. Makes each record 64 bytes.
+
+/**
+ * @brief Start of the capture file.
+ *
+ */
+struct __attribute__((packed)) CaptureHeader
+{
+    uint32_t magic;
+    uint16_t recordSize;
+    uint16_t slots;
+    uint32_t next; // Slot the next record will be written to.
+    uint32_t count; // Number of slots used.
+    uint8_t enabled;
+    uint8_t reserved[3];
+};
+
+/**
+ * @brief A single received packet.
+ *
+ */
+struct __attribute__((packed)) CaptureRecord
+{
+    uint32_t time; // ms since boot.
+    uint8_t tx;
+    uint8_t rx;
+    int16_t rssi;
+    int8_t snr; // In quarters of a dB.
+    uint8_t length; // Bytes of payload used (longer payloads are truncated).
+    uint8_t payload[CAPTURE_PAYLOAD_SIZE];
+};
+
+static_assert(sizeof(CaptureRecord) == 64, "Captures downloaded by capture_tool.py expect 64 byte records.");
+
+/**
+ * @brief Finds where a record is in the ring.
+ *
+ * @param header the header of the capture.
+ * @param index the record (0 is the oldest).
+ * @return uint32_t the slot the record is in.
+ */
+uint32_t captureSlot(const CaptureHeader &header, uint32_t index);
+
+/**
+ * @brief Works out when each record of a replay is due so that the original
+ * gaps between packets are kept, scaled by a speed multiplier.
+ *
+ */
+class CaptureReplayClock
+{
+public:
+    /**
+     * @brief Starts timing a replay.
+     *
+     * @param now the current time in ms.
+     * @param speed the speed multiplier, or 0 to replay as fast as possible.
+     */
+    void start(uint32_t now, float speed);
+
+    /**
+     * @brief Works out when the next record should be replayed. Must be called
+     * once for each record, in order. Records from before a restart can go
+     * back in time, so these are due straight after the previous record.
+     *
+     * @param recordTime the time the record was received.
+     * @return uint32_t when to replay it in ms.
+     */
+    uint32_t next(uint32_t recordTime);
+
+private:
+    float m_speed;
+    uint32_t m_due;
+    uint32_t m_lastRecordTime;
+    bool m_first;
+};
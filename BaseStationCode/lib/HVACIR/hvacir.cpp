@@ -7,18 +7,31 @@
  */
 #include "hvacir.h"
 
-void HVAC::begin()
+bool HVAC::begin()
 {
-    pinMode(m_pinIR, OUTPUT);
+    // The carrier is generated by the RMT peripheral, so marks only need to
+    // turn it on and off.
+    m_ready = rmtInit(m_pinIR, RMT_TX_MODE, RMT_MEM_NUM_BLOCKS_1, HVAC_IR_RESOLUTION) &&
+              rmtSetCarrier(m_pinIR, true, true, m_khz * 1000, HVAC_IR_DUTY);
+    if (!m_ready)
+    {
+        log_e("Could not set up RMT for IR on pin %d", m_pinIR);
+    }
+    return m_ready;
 }
 
-void HVAC::sendHvacToshiba(HvacMode mode, int temperature, HvacFanMode fanMode, int turnOff)
+/**
+ * @brief Builds the frame for a Toshiba air conditioner.
+ *
+ * @param settings the settings to send.
+ * @param frame the frame to add to.
+ * @return true if the frame fitted.
+ */
+static bool encodeToshiba(const HvacSettings &settings, IrFrame &frame)
 {
-
 #define HVAC_TOSHIBA_DATALEN 9
     // #define HVAC_TOSHIBA_DEBUG ; // Un comment to access DEBUG information through Serial Interface
 
-    uint8_t mask = 1; // our bitmask
     // ﻿F20D03FC0150000051
     uint8_t data[HVAC_TOSHIBA_DATALEN] = {0xF2, 0x0D, 0x03, 0xFC, 0x01, 0x00, 0x00, 0x00, 0x00};
     // data array is a valid trame, only byte to be chnaged will be updated.
@@ -37,7 +50,7 @@ void HVAC::sendHvacToshiba(HvacMode mode, int temperature, HvacFanMode fanMode,
 
     data[6] = 0x00;
     // Byte 7 - Mode
-    switch (mode)
+    switch (settings.mode)
     {
     case HVAC_HOT:
         data[6] = (uint8_t)0b00000011;
@@ -56,7 +69,7 @@ void HVAC::sendHvacToshiba(HvacMode mode, int temperature, HvacFanMode fanMode,
     }
 
     // Byte 7 - On / Off
-    if (turnOff)
+    if (settings.turnOff)
     {
         data[6] = (uint8_t)0x07; // Turn OFF HVAC
     }
@@ -68,22 +81,22 @@ void HVAC::sendHvacToshiba(HvacMode mode, int temperature, HvacFanMode fanMode,
     // Byte 6 - Temperature
     // Check Min Max For Hot Mode
     uint8_t Temp;
-    if (temperature > 30)
+    if (settings.temperature > 30)
     {
         Temp = 30;
     }
-    else if (temperature < 17)
+    else if (settings.temperature < 17)
     {
         Temp = 17;
     }
     else
     {
-        Temp = temperature;
+        Temp = settings.temperature;
     };
     data[5] = (uint8_t)Temp - 17 << 4;
 
     // Byte 10 - FAN / VANNE
-    switch (fanMode)
+    switch (settings.fanMode)
     {
     case FAN_SPEED_1:
         data[6] = data[6] | (uint8_t)0b01000000;
@@ -133,68 +146,485 @@ void HVAC::sendHvacToshiba(HvacMode mode, int temperature, HvacFanMode fanMode,
     Serial.println(".");
 #endif
 
-    m_space(0);
-    for (int j = 0; j < 2; j++)
-    { // For Mitsubishi IR protocol we have to send two time the packet data
-        // Header for the Packet
-        m_mark(HVAC_TOSHIBA_HDR_MARK);
-        m_space(HVAC_TOSHIBA_HDR_SPACE);
-        for (i = 0; i < HVAC_TOSHIBA_DATALEN; i++)
+    // For Toshiba IR protocol we have to send two time the packet data
+    return frame.bytes(toshibaTimings, data, HVAC_TOSHIBA_DATALEN) &&
+           frame.bytes(toshibaTimings, data, HVAC_TOSHIBA_DATALEN);
+}
+
+/**
+ * @brief Builds the frame for a Mitsubishi air conditioner.
+ *
+ * @param settings the settings to send.
+ * @param frame the frame to add to.
+ * @return true if the frame fitted.
+ */
+static bool encodeMitsubishi(const HvacSettings &settings, IrFrame &frame)
+{
+#define HVAC_MITSUBISHI_DATALEN 18
+    uint8_t data[HVAC_MITSUBISHI_DATALEN] = {0x23, 0xCB, 0x26, 0x01, 0x00, 0x20, 0x08, 0x06, 0x30, 0x45, 0x67, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F};
+
+    // Byte 6 - On / Off
+    data[5] = settings.turnOff ? 0x00 : 0x20;
+
+    // Byte 7 - Mode
+    switch (settings.mode)
+    {
+    case HVAC_HOT:
+        data[6] = (uint8_t)0b00001000;
+        break;
+    case HVAC_COLD:
+        data[6] = (uint8_t)0b00011000;
+        break;
+    case HVAC_DRY:
+        data[6] = (uint8_t)0b00010000;
+        break;
+    case HVAC_AUTO:
+        data[6] = (uint8_t)0b00100000;
+        break;
+    default:
+        break;
+    }
+
+    // Byte 8 - Temperature
+    uint8_t Temp;
+    if (settings.temperature > 31)
+    {
+        Temp = 31;
+    }
+    else if (settings.temperature < 16)
+    {
+        Temp = 16;
+    }
+    else
+    {
+        Temp = settings.temperature;
+    };
+    data[7] = (uint8_t)Temp - 16;
+
+    // Byte 10 - FAN / VANNE
+    switch (settings.fanMode)
+    {
+    case FAN_SPEED_1:
+        data[9] = (uint8_t)0b00000001;
+        break;
+    case FAN_SPEED_2:
+        data[9] = (uint8_t)0b00000010;
+        break;
+    case FAN_SPEED_3:
+        data[9] = (uint8_t)0b00000011;
+        break;
+    case FAN_SPEED_4:
+    case FAN_SPEED_5:
+        data[9] = (uint8_t)0b00000100; // No speed 5 for Mitsubishi, so use the fastest.
+        break;
+    case FAN_SPEED_AUTO:
+        data[9] = (uint8_t)0b10000000;
+        break;
+    case FAN_SPEED_SILENT:
+        data[9] = (uint8_t)0b00000101;
+        break;
+    default:
+        break;
+    }
+
+    switch (settings.vanne)
+    {
+    case VANNE_AUTO:
+        data[9] = data[9] | (uint8_t)0b01000000;
+        break;
+    case VANNE_H1:
+        data[9] = data[9] | (uint8_t)0b01001000;
+        break;
+    case VANNE_H2:
+        data[9] = data[9] | (uint8_t)0b01010000;
+        break;
+    case VANNE_H3:
+        data[9] = data[9] | (uint8_t)0b01011000;
+        break;
+    case VANNE_H4:
+        data[9] = data[9] | (uint8_t)0b01100000;
+        break;
+    case VANNE_H5:
+        data[9] = data[9] | (uint8_t)0b01101000;
+        break;
+    case VANNE_AUTO_MOVE:
+        data[9] = data[9] | (uint8_t)0b01111000;
+        break;
+    default:
+        break;
+    }
+
+    // Byte 18 - CRC
+    data[17] = 0;
+    for (uint8_t i = 0; i < HVAC_MITSUBISHI_DATALEN - 1; i++)
+    {
+        data[17] = (uint8_t)data[i] + data[17]; // CRC is a simple bits addition
+    }
+
+    // For Mitsubishi IR protocol we have to send two time the packet data
+    return frame.bytes(mitsubishiTimings, data, HVAC_MITSUBISHI_DATALEN) &&
+           frame.bytes(mitsubishiTimings, data, HVAC_MITSUBISHI_DATALEN);
+}
+
+/**
+ * @brief Builds the frame for a Panasonic air conditioner.
+ *
+ * @param settings the settings to send.
+ * @param frame the frame to add to.
+ * @return true if the frame fitted.
+ */
+static bool encodePanasonic(const HvacSettings &settings, IrFrame &frame)
+{
+#define HVAC_PANASONIC_HEADERLEN 8
+#define HVAC_PANASONIC_DATALEN 19
+    // The first part is always the same.
+    static const uint8_t header[HVAC_PANASONIC_HEADERLEN] = {0x02, 0x20, 0xE0, 0x04, 0x00, 0x00, 0x00, 0x06};
+    uint8_t data[HVAC_PANASONIC_DATALEN] = {0x02, 0x20, 0xE0, 0x04, 0x00, 0x48, 0x3C, 0x80, 0xAF, 0x0D, 0x00, 0x0E, 0xE0, 0x10, 0x00, 0x01, 0x00, 0x06, 0x00};
+
+    // Byte 6 - Mode and On / Off
+    switch (settings.mode)
+    {
+    case HVAC_HOT:
+        data[5] = (uint8_t)0b01000000;
+        break;
+    case HVAC_COLD:
+        data[5] = (uint8_t)0b00110000;
+        break;
+    case HVAC_DRY:
+        data[5] = (uint8_t)0b00100000;
+        break;
+    case HVAC_FAN:
+        data[5] = (uint8_t)0b01100000;
+        break;
+    case HVAC_AUTO:
+        data[5] = (uint8_t)0b00000000;
+        break;
+    default:
+        break;
+    }
+    data[5] = data[5] | (uint8_t)0b00001000 | (settings.turnOff ? 0 : (uint8_t)0b00000001);
+
+    // Byte 7 - Temperature
+    uint8_t Temp;
+    if (settings.temperature > 30)
+    {
+        Temp = 30;
+    }
+    else if (settings.temperature < 16)
+    {
+        Temp = 16;
+    }
+    else
+    {
+        Temp = settings.temperature;
+    };
+    data[6] = (uint8_t)Temp << 1;
+
+    // Byte 9 - FAN / VANNE
+    switch (settings.fanMode)
+    {
+    case FAN_SPEED_1:
+        data[8] = (uint8_t)0b00110000;
+        break;
+    case FAN_SPEED_2:
+        data[8] = (uint8_t)0b01000000;
+        break;
+    case FAN_SPEED_3:
+        data[8] = (uint8_t)0b01010000;
+        break;
+    case FAN_SPEED_4:
+        data[8] = (uint8_t)0b01100000;
+        break;
+    case FAN_SPEED_5:
+        data[8] = (uint8_t)0b01110000;
+        break;
+    case FAN_SPEED_AUTO:
+    case FAN_SPEED_SILENT:
+        data[8] = (uint8_t)0b10100000; // Silent is set with the profile instead.
+        break;
+    default:
+        break;
+    }
+
+    switch (settings.vanne)
+    {
+    case VANNE_AUTO:
+    case VANNE_AUTO_MOVE:
+        data[8] = data[8] | (uint8_t)0b00001111;
+        break;
+    case VANNE_H1:
+        data[8] = data[8] | (uint8_t)0b00000001;
+        break;
+    case VANNE_H2:
+        data[8] = data[8] | (uint8_t)0b00000010;
+        break;
+    case VANNE_H3:
+        data[8] = data[8] | (uint8_t)0b00000011;
+        break;
+    case VANNE_H4:
+        data[8] = data[8] | (uint8_t)0b00000100;
+        break;
+    case VANNE_H5:
+        data[8] = data[8] | (uint8_t)0b00000101;
+        break;
+    default:
+        break;
+    }
+
+    // Byte 10 - WIDE VANNE
+    switch (settings.wideVanne)
+    {
+    case WIDE_LEFT_END:
+        data[9] = (uint8_t)0b00001001;
+        break;
+    case WIDE_LEFT:
+        data[9] = (uint8_t)0b00001010;
+        break;
+    case WIDE_MIDDLE:
+        data[9] = (uint8_t)0b00000110;
+        break;
+    case WIDE_RIGHT:
+        data[9] = (uint8_t)0b00001011;
+        break;
+    case WIDE_RIGHT_END:
+        data[9] = (uint8_t)0b00001100;
+        break;
+    default:
+        break;
+    }
+
+    // Byte 14 - Profile
+    switch (settings.profile)
+    {
+    case NORMAL:
+        data[13] = (uint8_t)0b00010000;
+        break;
+    case QUIET:
+        data[13] = (uint8_t)0b00110000;
+        break;
+    case BOOST:
+        data[13] = (uint8_t)0b00010001;
+        break;
+    default:
+        break;
+    }
+    if (settings.fanMode == FAN_SPEED_SILENT)
+    {
+        data[13] = (uint8_t)0b00110000;
+    }
+
+    // Byte 19 - CRC
+    data[18] = 0;
+    for (uint8_t i = 0; i < HVAC_PANASONIC_DATALEN - 1; i++)
+    {
+        data[18] = (uint8_t)data[i] + data[18]; // CRC is a simple bits addition
+    }
+
+    return frame.bytes(panasonicTimings, header, HVAC_PANASONIC_HEADERLEN) &&
+           frame.bytes(panasonicTimings, data, HVAC_PANASONIC_DATALEN);
+}
+
+/**
+ * @brief Everything needed to send each protocol, in the same order as
+ * HvacProtocol.
+ *
+ */
+static const struct
+{
+    const char *name;
+    uint8_t khz;
+    bool (*encode)(const HvacSettings &settings, IrFrame &frame);
+} hvacProtocols[HVAC_PROTOCOL_COUNT] = {
+    {"toshiba", HVAC_TOSHIBA_KHZ, encodeToshiba},
+    {"mitsubishi", HVAC_MITSUBISHI_KHZ, encodeMitsubishi},
+    {"panasonic", HVAC_PANASONIC_KHZ, encodePanasonic}};
+
+bool HvacSettings::operator==(const HvacSettings &other) const
+{
+    return protocol == other.protocol &&
+           mode == other.mode &&
+           temperature == other.temperature &&
+           fanMode == other.fanMode &&
+           turnOff == other.turnOff &&
+           vanne == other.vanne &&
+           wideVanne == other.wideVanne &&
+           profile == other.profile;
+}
+
+bool HVAC::send(const HvacSettings &settings)
+{
+    if (!m_ready || settings.protocol >= HVAC_PROTOCOL_COUNT)
+    {
+        return false;
+    }
+
+    // Can't change anything the RMT peripheral might still be reading.
+    m_waitForIdle();
+
+    HvacCacheEntry *entry = m_cacheFind(settings);
+    if (entry)
+    {
+        cacheHits++;
+    }
+    else
+    {
+        // Encode into the least recently used entry.
+        cacheMisses++;
+        entry = m_cacheOldest();
+        entry->valid = false;
+        m_frame.clear();
+        if (!hvacProtocols[settings.protocol].encode(settings, m_frame))
         {
-            // Send all Bits from Byte Data in Reverse Order
-            for (mask = 0b10000000; mask > 0; mask >>= 1)
-            { // iterate through bit mask
-                if (data[i] & mask)
-                { // Bit ONE
-                    m_mark(HVAC_TOSHIBA_BIT_MARK);
-                    m_space(HVAC_TOSHIBA_ONE_SPACE);
-                }
-                else
-                { // Bit ZERO
-                    m_mark(HVAC_TOSHIBA_BIT_MARK);
-                    m_space(HVAC_MISTUBISHI_ZERO_SPACE);
-                }
-                // Next bits
-            }
+            log_e("IR frame too long");
+            return false;
+        }
+        entry->symbolCount = m_packFrame(m_frame.durations, m_frame.length, entry->symbols, HVAC_IR_CACHE_SYMBOLS);
+        if (!entry->symbolCount)
+        {
+            return false;
         }
-        // End of Packet and retransmission of the Packet
-        m_mark(HVAC_TOSHIBA_RPT_MARK);
-        m_space(HVAC_TOSHIBA_RPT_SPACE);
-        m_space(0); // Just to be sure
+        entry->settings = settings;
+        entry->valid = true;
     }
+    entry->lastUsed = ++m_useCount;
+
+    // Sent in the background, the cache entry is left alone until it finishes.
+    return m_setCarrier(hvacProtocols[settings.protocol].khz) &&
+           rmtWriteAsync(m_pinIR, entry->symbols, entry->symbolCount);
 }
 
-void HVAC::m_mark(int time)
+bool HVAC::sendRaw(const uint16_t *durations, uint16_t length, uint8_t khz)
 {
-    long beginning = micros();
-    while (micros() - beginning < time)
+    if (!m_ready)
     {
-        digitalWrite(m_pinIR, HIGH);
-        delayMicroseconds(HVAC_TOSHIBA_HALF_PERIODIC_TIME);
-        digitalWrite(m_pinIR, LOW);
-        delayMicroseconds(HVAC_TOSHIBA_HALF_PERIODIC_TIME); // 38 kHz -> T = 26.31 microsec (periodic time), half of it is 13
+        return false;
     }
+    m_waitForIdle();
+
+    // Borrow the least recently used cache entry to hold the symbols.
+    HvacCacheEntry *entry = m_cacheOldest();
+    entry->valid = false;
+    entry->symbolCount = m_packFrame(durations, length, entry->symbols, HVAC_IR_CACHE_SYMBOLS);
+    return entry->symbolCount &&
+           m_setCarrier(khz) &&
+           rmtWriteAsync(m_pinIR, entry->symbols, entry->symbolCount);
 }
 
-void HVAC::m_space(int time)
+bool HVAC::sendHvacToshiba(HvacMode mode, int temperature, HvacFanMode fanMode, int turnOff)
 {
-    digitalWrite(m_pinIR, LOW);
-    if (time > 0)
-        delayMicroseconds(time);
+    HvacSettings settings;
+    settings.protocol = HVAC_TOSHIBA;
+    settings.mode = mode;
+    settings.temperature = temperature;
+    settings.fanMode = fanMode;
+    settings.turnOff = turnOff;
+    return send(settings);
 }
 
-void HVAC::m_sendRaw(unsigned int buf[], int len)
+const char *HVAC::protocolName(HvacProtocol protocol)
 {
-    for (int i = 0; i < len; i++)
+    return protocol < HVAC_PROTOCOL_COUNT ? hvacProtocols[protocol].name : "unknown";
+}
+
+bool HVAC::protocolFromName(const char *name, HvacProtocol &protocol)
+{
+    for (uint8_t i = 0; i < HVAC_PROTOCOL_COUNT; i++)
     {
-        if (i & 1)
+        if (strcmp(name, hvacProtocols[i].name) == 0)
         {
-            m_space(buf[i]);
+            protocol = (HvacProtocol)i;
+            return true;
         }
-        else
+    }
+    return false;
+}
+
+HvacCacheEntry *HVAC::m_cacheFind(const HvacSettings &settings)
+{
+    for (HvacCacheEntry &entry : m_cache)
+    {
+        if (entry.valid && entry.settings == settings)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+HvacCacheEntry *HVAC::m_cacheOldest()
+{
+    HvacCacheEntry *oldest = &m_cache[0];
+    for (HvacCacheEntry &entry : m_cache)
+    {
+        if (!entry.valid)
+        {
+            return &entry;
+        }
+        if (entry.lastUsed < oldest->lastUsed)
+        {
+            oldest = &entry;
+        }
+    }
+    return oldest;
+}
+
+size_t HVAC::m_packFrame(const uint16_t *durations, uint16_t length, rmt_data_t *symbols, size_t maxSymbols)
+{
+    // Pack the marks and spaces into RMT symbols, two per symbol. Durations
+    // too long for a symbol are split over several halves of the same level.
+    size_t half = 0;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        uint32_t remaining = durations[i];
+        bool level = !(i & 1);
+        while (remaining)
+        {
+            if (half / 2 == maxSymbols)
+            {
+                log_e("IR frame too long for the symbol buffer");
+                return 0;
+            }
+            uint16_t duration = remaining > HVAC_IR_MAX_DURATION ? HVAC_IR_MAX_DURATION : remaining;
+            remaining -= duration;
+            rmt_data_t &symbol = symbols[half / 2];
+            if (half & 1)
+            {
+                symbol.duration1 = duration;
+                symbol.level1 = level;
+            }
+            else
+            {
+                symbol.duration0 = duration;
+                symbol.level0 = level;
+                symbol.duration1 = 0; // Ends the frame if nothing follows.
+                symbol.level1 = 0;
+            }
+            half++;
+        }
+    }
+    return (half + 1) / 2;
+}
+
+bool HVAC::m_setCarrier(uint8_t khz)
+{
+    if (khz != m_khz)
+    {
+        if (!rmtSetCarrier(m_pinIR, true, true, khz * 1000, HVAC_IR_DUTY))
+        {
+            return false;
+        }
+        m_khz = khz;
+    }
+    return true;
+}
+
+void HVAC::m_waitForIdle()
+{
+    if (m_ready)
+    {
+        while (!rmtTransmitCompleted(m_pinIR))
         {
-            m_mark(buf[i]);
+            delay(1);
         }
     }
-    m_space(0); // Just to be sure
 }
@@ -7,6 +7,7 @@
  */
 #pragma once
 #include <Arduino.h>
+#include "irframe.h"
 
 enum HvacMode
 {
@@ -63,16 +64,54 @@ enum HvacProfileMode
     BOOST
 }; // HVAC PANASONIC OPTION MODE
 
-// HVAC TOSHIBA_
-#define HVAC_TOSHIBA_KHZ 38
-#define HVAC_TOSHIBA_HALF_PERIODIC_TIME (500 / HVAC_TOSHIBA_KHZ)
-#define HVAC_TOSHIBA_HDR_MARK 4400
-#define HVAC_TOSHIBA_HDR_SPACE 4300
-#define HVAC_TOSHIBA_BIT_MARK 543
-#define HVAC_TOSHIBA_ONE_SPACE 1623
-#define HVAC_MISTUBISHI_ZERO_SPACE 472
-#define HVAC_TOSHIBA_RPT_MARK 440
-#define HVAC_TOSHIBA_RPT_SPACE 7048 // Above original iremote limit
+enum HvacProtocol
+{
+    HVAC_TOSHIBA,
+    HVAC_MITSUBISHI,
+    HVAC_PANASONIC,
+    HVAC_PROTOCOL_COUNT
+}; // HVAC PROTOCOL
+
+#define HVAC_IR_RESOLUTION 1000000 // RMT tick rate. 1MHz so that durations are in us.
+#define HVAC_IR_DUTY 0.33 // Fraction of each carrier period the LED is on for.
+#define HVAC_IR_MAX_DURATION 32767 // Longest time an RMT symbol half can hold.
+#ifndef HVAC_IR_CACHE_SIZE
+#define HVAC_IR_CACHE_SIZE 3 // Number of encoded frames remembered so that repeated settings can be sent straight away.
+#endif
+#ifndef HVAC_IR_CACHE_SYMBOLS
+#define HVAC_IR_CACHE_SYMBOLS ((IR_FRAME_MAX + 1) / 2) // RMT symbols in each cached frame. Holds a full IrFrame for sendRaw. The longest protocol (Mitsubishi) needs 292.
+#endif
+
+/**
+ * @brief Everything that is sent to an air conditioner in a frame.
+ *
+ */
+struct HvacSettings
+{
+    HvacProtocol protocol = HVAC_TOSHIBA;
+    HvacMode mode = HVAC_AUTO;
+    int temperature = 22;
+    HvacFanMode fanMode = FAN_SPEED_AUTO;
+    bool turnOff = false;
+    HvacVanneMode vanne = VANNE_AUTO;
+    HvacWideVanneMode wideVanne = WIDE_MIDDLE;
+    HvacProfileMode profile = NORMAL;
+
+    bool operator==(const HvacSettings &other) const;
+};
+
+/**
+ * @brief A frame that has already been encoded and is ready to send.
+ *
+ */
+struct HvacCacheEntry
+{
+    HvacSettings settings;
+    uint32_t lastUsed;
+    size_t symbolCount;
+    bool valid = false;
+    rmt_data_t symbols[HVAC_IR_CACHE_SYMBOLS];
+};
 
 /**
  * @brief Class for remotely controlling air conditioners over IR.
@@ -90,10 +129,34 @@ public:
     HVAC(const uint8_t pinIR) : m_pinIR(pinIR) {}
 
     /**
-     * @brief Sets the IR pin as an output.
-     * 
+     * @brief Sets up the RMT peripheral to generate the carrier on the IR pin.
+     *
+     * @return true if successful.
+     */
+    bool begin();
+
+    /**
+     * @brief Sends settings to an air conditioner using IR. Frames for recently
+     * used settings are kept already encoded, so that repeated presets don't
+     * need to be encoded again. Returns without waiting for the frame to
+     * finish.
+     *
+     * @param settings the protocol and settings to send.
+     * @return true if the frame was started.
+     */
+    bool send(const HvacSettings &settings);
+
+    /**
+     * @brief Sends raw marks and spaces, for example a code learnt from a
+     * remote. Returns without waiting for the frame to finish.
+     *
+     * @param durations alternating mark and space times in us, starting with a
+     * mark.
+     * @param length the number of marks and spaces.
+     * @param khz the carrier frequency.
+     * @return true if the frame was started.
      */
-    void begin();
+    bool sendRaw(const uint16_t *durations, uint16_t length, uint8_t khz);
 
     /**
      * @brief Sends a command to a Toshiba air conditioner using IR.
@@ -102,33 +165,75 @@ public:
      * @param temperature set temperature. For example, 21 = 21 degrees C.
      * @param fanMode fan mode. For example, FAN_SPEED_AUTO.
      * @param turnOff whether to turn off the air conditioner. true is turn off, false is turn on.
+     * @return true if the frame was started.
      */
-    void sendHvacToshiba(HvacMode mode, int temperature, HvacFanMode fanMode, int turnOff);
+    bool sendHvacToshiba(HvacMode mode, int temperature, HvacFanMode fanMode, int turnOff);
+
+    /**
+     * @brief Returns the name of a protocol, for example "toshiba".
+     *
+     */
+    static const char *protocolName(HvacProtocol protocol);
+
+    /**
+     * @brief Finds a protocol from its name.
+     *
+     * @param name the name, for example "toshiba".
+     * @param protocol set to the protocol if found.
+     * @return true if the name was found.
+     */
+    static bool protocolFromName(const char *name, HvacProtocol &protocol);
+
+    uint32_t cacheHits = 0;
+    uint32_t cacheMisses = 0;
 
 private:
     /**
-     * @brief Sends an IR mark for the specified number of microseconds.
-     * The mark output is modulated at the PWM frequency.
+     * @brief Returns the cache entry for some settings, or nullptr if they
+     * aren't cached.
      *
-     * @param time the time in us.
      */
-    void m_mark(int time);
+    HvacCacheEntry *m_cacheFind(const HvacSettings &settings);
 
     /**
-     * @brief Sends an IR space for the specified number of microseconds.
-     * A space is no output, so the PWM output is disabled.
-     * 
-     * @param time the time in us.
+     * @brief Returns an unused cache entry if there is one, otherwise the least
+     * recently used entry.
+     *
      */
-    void m_space(int time);
-    
+    HvacCacheEntry *m_cacheOldest();
+
     /**
-     * @brief Sends raw data over IR.
-     * 
-     * @param buf 
-     * @param len 
+     * @brief Converts marks and spaces into RMT symbols.
+     *
+     * @param durations alternating mark and space times in us.
+     * @param length the number of marks and spaces.
+     * @param symbols where to write the symbols.
+     * @param maxSymbols the size of symbols.
+     * @return the number of symbols used, or 0 if they didn't fit.
+     */
+    size_t m_packFrame(const uint16_t *durations, uint16_t length, rmt_data_t *symbols, size_t maxSymbols);
+
+    /**
+     * @brief Changes the carrier frequency if needed.
+     *
+     * @param khz the new frequency.
+     * @return true if successful.
      */
-    void m_sendRaw(unsigned int buf[], int len);
+    bool m_setCarrier(uint8_t khz);
+
+    /**
+     * @brief Waits for any frame that is still being sent to finish, so the
+     * buffers can be reused.
+     *
+     */
+    void m_waitForIdle();
 
     const uint8_t m_pinIR;
+    bool m_ready = false;
+    uint8_t m_khz = HVAC_TOSHIBA_KHZ;
+    uint32_t m_useCount = 0;
+    IrFrame m_frame;
+
+    // Entries must stay valid until the RMT peripheral has finished with them.
+    HvacCacheEntry m_cache[HVAC_IR_CACHE_SIZE];
 };
\ No newline at end of file
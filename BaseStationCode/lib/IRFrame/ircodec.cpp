@@ -0,0 +1,130 @@
+/**
+ * @file ircodec.cpp
+ * @brief Compact format for storing raw IR codes learnt from a remote.
+ *
+ * @author Jotham Gates
+ * @date Apr 2025
+ */
+#include "ircodec.h"
+#include <string.h>
+
+/**
+ * @brief Returns true if a time is close enough to a group's average to be
+ * part of it.
+ *
+ */
+static bool irCodeMatches(uint32_t average, uint32_t time)
+{
+    uint32_t tolerance = average * IR_CODE_TOLERANCE_PERCENT / 100;
+    if (tolerance < IR_CODE_MIN_TOLERANCE)
+    {
+        tolerance = IR_CODE_MIN_TOLERANCE;
+    }
+    uint32_t difference = average > time ? average - time : time - average;
+    return difference <= tolerance;
+}
+
+size_t irCodeEncode(const IrFrame &frame, uint8_t khz, uint8_t *code, size_t maxSize)
+{
+    // Group similar times.
+    uint32_t sums[IR_CODE_MAX_TIMES];
+    uint16_t counts[IR_CODE_MAX_TIMES];
+    uint16_t times[IR_CODE_MAX_TIMES];
+    uint8_t timeCount = 0;
+    for (uint16_t i = 0; i < frame.length; i++)
+    {
+        uint8_t group = 0;
+        while (group < timeCount && !irCodeMatches(sums[group] / counts[group], frame.durations[i]))
+        {
+            group++;
+        }
+        if (group == timeCount)
+        {
+            if (timeCount == IR_CODE_MAX_TIMES)
+            {
+                return 0; // Too many different times.
+            }
+            sums[group] = 0;
+            counts[group] = 0;
+            timeCount++;
+        }
+        sums[group] += frame.durations[i];
+        counts[group]++;
+    }
+    for (uint8_t i = 0; i < timeCount; i++)
+    {
+        times[i] = sums[i] / counts[i];
+    }
+
+    // Check it will fit.
+    size_t tableSize = timeCount * sizeof(uint16_t);
+    size_t size = sizeof(IrCodeHeader) + tableSize + (frame.length + 1) / 2;
+    if (size > maxSize)
+    {
+        return 0;
+    }
+
+    // Header and table of times.
+    IrCodeHeader header = {IR_CODE_MAGIC, khz, timeCount, frame.length};
+    memcpy(code, &header, sizeof(header));
+    memcpy(code + sizeof(header), times, tableSize);
+
+    // Replace each time with the closest average.
+    uint8_t *indices = code + sizeof(header) + tableSize;
+    memset(indices, 0, (frame.length + 1) / 2);
+    for (uint16_t i = 0; i < frame.length; i++)
+    {
+        uint8_t closest = 0;
+        uint32_t closestDifference = UINT32_MAX;
+        for (uint8_t j = 0; j < timeCount; j++)
+        {
+            uint32_t difference = times[j] > frame.durations[i] ? times[j] - frame.durations[i] : frame.durations[i] - times[j];
+            if (difference < closestDifference)
+            {
+                closest = j;
+                closestDifference = difference;
+            }
+        }
+        indices[i / 2] |= i & 1 ? closest << 4 : closest;
+    }
+    return size;
+}
+
+bool irCodeDecode(const uint8_t *code, size_t size, IrFrame &frame, uint8_t &khz)
+{
+    // Check the header.
+    IrCodeHeader header;
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, code, sizeof(header));
+    size_t tableSize = header.timeCount * sizeof(uint16_t);
+    if (header.magic != IR_CODE_MAGIC ||
+        header.timeCount > IR_CODE_MAX_TIMES ||
+        header.length > IR_FRAME_MAX ||
+        size < sizeof(header) + tableSize + (header.length + 1) / 2)
+    {
+        return false;
+    }
+
+    // Look up each time.
+    uint16_t times[IR_CODE_MAX_TIMES];
+    memcpy(times, code + sizeof(header), tableSize);
+    const uint8_t *indices = code + sizeof(header) + tableSize;
+    frame.clear();
+    for (uint16_t i = 0; i < header.length; i++)
+    {
+        uint8_t index = i & 1 ? indices[i / 2] >> 4 : indices[i / 2] & 0x0f;
+        if (index >= header.timeCount)
+        {
+            return false;
+        }
+
+        // Written directly so that a mark or space isn't merged into the one before.
+        frame.durations[i] = times[index];
+    }
+    frame.length = header.length;
+    khz = header.khz;
+    return true;
+}
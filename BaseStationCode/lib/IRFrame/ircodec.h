@@ -0,0 +1,63 @@
+/**
+ * @file ircodec.h
+ * @brief Compact format for storing raw IR codes learnt from a remote.
+ *
+ * Remotes only use a handful of different mark and space lengths, but the
+ * measured times vary by tens of us. Similar times are grouped together and
+ * replaced by their average, so that each mark or space can be stored as a 4
+ * bit index into a table of up to 16 times. A typical air conditioner code of
+ * several hundred marks and spaces fits in a few hundred bytes.
+ *
+ * The format is a IrCodeHeader, then the table of times (uint16_t each), then
+ * the indices packed two per byte (first in the low nibble).
+ *
+ * This has no Arduino dependencies so that it can be checked on a computer.
+ *
+ * @author Jotham Gates
+ * @date Apr 2025
+ */
+#pragma once
+#include <stddef.h>
+#include "irframe.h"
+
+#define IR_CODE_MAGIC 0x31435249 // "IRC1"
+#define IR_CODE_MAX_TIMES 16 // Number of different times that can be stored.
+#define IR_CODE_TOLERANCE_PERCENT 20 // Times within this much of a group's average join the group.
+#define IR_CODE_MIN_TOLERANCE 100 // Tolerance in us for short times, as measurements are a bit jittery.
+
+/**
+ * @brief Start of a stored code.
+ *
+ */
+struct __attribute__((packed)) IrCodeHeader
+{
+    uint32_t magic;
+    uint8_t khz; // Carrier frequency.
+    uint8_t timeCount; // Number of entries in the table of times.
+    uint16_t length; // Number of marks and spaces.
+};
+
+#define IR_CODE_MAX_SIZE (sizeof(IrCodeHeader) + IR_CODE_MAX_TIMES * sizeof(uint16_t) + (IR_FRAME_MAX + 1) / 2)
+
+/**
+ * @brief Compresses a frame.
+ *
+ * @param frame the marks and spaces.
+ * @param khz the carrier frequency.
+ * @param code where to write the code. Should be IR_CODE_MAX_SIZE long.
+ * @param maxSize the size of code.
+ * @return the number of bytes used, or 0 if there are too many different times
+ * or the code doesn't fit.
+ */
+size_t irCodeEncode(const IrFrame &frame, uint8_t khz, uint8_t *code, size_t maxSize);
+
+/**
+ * @brief Expands a code back into a frame.
+ *
+ * @param code the code.
+ * @param size the number of bytes in code.
+ * @param frame the frame to fill.
+ * @param khz set to the carrier frequency.
+ * @return true if the code was valid.
+ */
+bool irCodeDecode(const uint8_t *code, size_t size, IrFrame &frame, uint8_t &khz);
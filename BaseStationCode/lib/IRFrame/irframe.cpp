@@ -0,0 +1,64 @@
+/**
+ * @file irframe.cpp
+ * @brief Buffer of IR mark and space timings, built before sending.
+ *
+ * @author Jotham Gates
+ * @date Apr 2025
+ */
+#include "irframe.h"
+
+const IrTimings toshibaTimings = {HVAC_TOSHIBA_HDR_MARK, HVAC_TOSHIBA_HDR_SPACE, HVAC_TOSHIBA_BIT_MARK, HVAC_TOSHIBA_ONE_SPACE, HVAC_TOSHIBA_ZERO_SPACE, HVAC_TOSHIBA_RPT_MARK, HVAC_TOSHIBA_RPT_SPACE, false};
+const IrTimings mitsubishiTimings = {HVAC_MITSUBISHI_HDR_MARK, HVAC_MITSUBISHI_HDR_SPACE, HVAC_MITSUBISHI_BIT_MARK, HVAC_MITSUBISHI_ONE_SPACE, HVAC_MITSUBISHI_ZERO_SPACE, HVAC_MITSUBISHI_RPT_MARK, HVAC_MITSUBISHI_RPT_SPACE, true};
+const IrTimings panasonicTimings = {HVAC_PANASONIC_HDR_MARK, HVAC_PANASONIC_HDR_SPACE, HVAC_PANASONIC_BIT_MARK, HVAC_PANASONIC_ONE_SPACE, HVAC_PANASONIC_ZERO_SPACE, HVAC_PANASONIC_RPT_MARK, HVAC_PANASONIC_RPT_SPACE, true};
+
+bool IrFrame::add(uint32_t time, bool isMark)
+{
+    if (time == 0)
+    {
+        return true;
+    }
+
+    // Marks are at even indices, spaces at odd.
+    bool lastIsMark = length & 1;
+    if (length != 0 && lastIsMark == isMark)
+    {
+        time += durations[length - 1];
+        durations[length - 1] = time > IR_FRAME_MAX_DURATION ? IR_FRAME_MAX_DURATION : time;
+        return true;
+    }
+    if (length == 0 && !isMark)
+    {
+        // Nothing to do before the first mark.
+        return true;
+    }
+    if (length == IR_FRAME_MAX)
+    {
+        return false;
+    }
+    durations[length++] = time > IR_FRAME_MAX_DURATION ? IR_FRAME_MAX_DURATION : time;
+    return true;
+}
+
+uint32_t IrFrame::duration() const
+{
+    uint32_t total = 0;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        total += durations[i];
+    }
+    return total;
+}
+
+bool IrFrame::bytes(const IrTimings &timings, const uint8_t *data, uint8_t length)
+{
+    bool fits = mark(timings.hdrMark) && space(timings.hdrSpace);
+    for (uint8_t i = 0; i < length; i++)
+    {
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            uint8_t mask = timings.lsbFirst ? 1 << bit : 0b10000000 >> bit;
+            fits = fits && mark(timings.bitMark) && space(data[i] & mask ? timings.oneSpace : timings.zeroSpace);
+        }
+    }
+    return fits && mark(timings.rptMark) && space(timings.rptSpace);
+}
@@ -0,0 +1,121 @@
+/**
+ * @file irframe.h
+ * @brief Buffer of IR mark and space timings, built before sending.
+ *
+ * This has no Arduino dependencies so that frames can be built and checked on
+ * a computer as well as the ESP32.
+ *
+ * @author Jotham Gates
+ * @date Apr 2025
+ */
+#pragma once
+#include <stdint.h>
+
+#define IR_FRAME_MAX 600 // Maximum number of marks and spaces in a frame. Mitsubishi needs 584.
+#define IR_FRAME_MAX_DURATION UINT16_MAX // Longer marks and spaces are shortened to this.
+
+// HVAC TOSHIBA_
+#define HVAC_TOSHIBA_KHZ 38
+#define HVAC_TOSHIBA_HDR_MARK 4400
+#define HVAC_TOSHIBA_HDR_SPACE 4300
+#define HVAC_TOSHIBA_BIT_MARK 543
+#define HVAC_TOSHIBA_ONE_SPACE 1623
+#define HVAC_TOSHIBA_ZERO_SPACE 472
+#define HVAC_TOSHIBA_RPT_MARK 440
+#define HVAC_TOSHIBA_RPT_SPACE 7048 // Above original iremote limit
+
+// HVAC MITSUBISHI_
+#define HVAC_MITSUBISHI_KHZ 38
+#define HVAC_MITSUBISHI_HDR_MARK 3400
+#define HVAC_MITSUBISHI_HDR_SPACE 1750
+#define HVAC_MITSUBISHI_BIT_MARK 450
+#define HVAC_MITSUBISHI_ONE_SPACE 1300
+#define HVAC_MITSUBISHI_ZERO_SPACE 420
+#define HVAC_MITSUBISHI_RPT_MARK 440
+#define HVAC_MITSUBISHI_RPT_SPACE 17100
+
+// HVAC PANASONIC_
+#define HVAC_PANASONIC_KHZ 38
+#define HVAC_PANASONIC_HDR_MARK 3500
+#define HVAC_PANASONIC_HDR_SPACE 1750
+#define HVAC_PANASONIC_BIT_MARK 435
+#define HVAC_PANASONIC_ONE_SPACE 1300
+#define HVAC_PANASONIC_ZERO_SPACE 435
+#define HVAC_PANASONIC_RPT_MARK 435
+#define HVAC_PANASONIC_RPT_SPACE 10000
+
+/**
+ * @brief Timings of a pulse distance protocol, where every bit is a mark of
+ * the same length followed by a long (1) or short (0) space.
+ *
+ */
+struct IrTimings
+{
+    uint16_t hdrMark;
+    uint16_t hdrSpace;
+    uint16_t bitMark;
+    uint16_t oneSpace;
+    uint16_t zeroSpace;
+    uint16_t rptMark; // Mark at the end of the data.
+    uint16_t rptSpace; // Gap before anything else is sent.
+    bool lsbFirst;
+};
+
+extern const IrTimings toshibaTimings;
+extern const IrTimings mitsubishiTimings;
+extern const IrTimings panasonicTimings;
+
+/**
+ * @brief A sequence of alternating marks (carrier on) and spaces (carrier off)
+ * in us, starting with a mark.
+ *
+ */
+class IrFrame
+{
+public:
+    /**
+     * @brief Empties the frame.
+     *
+     */
+    void clear() { length = 0; }
+
+    /**
+     * @brief Adds a mark. Joined onto the previous mark if there was no space
+     * in between.
+     *
+     * @param time the time in us.
+     * @return true if there was room.
+     */
+    bool mark(uint32_t time) { return add(time, true); }
+
+    /**
+     * @brief Adds a space. Joined onto the previous space if there was no mark
+     * in between. Spaces at the start are ignored.
+     *
+     * @param time the time in us.
+     * @return true if there was room.
+     */
+    bool space(uint32_t time) { return add(time, false); }
+
+    /**
+     * @brief Adds a header, the bytes given and the end mark and gap.
+     *
+     * @param timings the protocol timings.
+     * @param data the bytes to send.
+     * @param length the number of bytes.
+     * @return true if there was room.
+     */
+    bool bytes(const IrTimings &timings, const uint8_t *data, uint8_t length);
+
+    /**
+     * @brief Total time of the frame in us.
+     *
+     */
+    uint32_t duration() const;
+
+    uint16_t length = 0;
+    uint16_t durations[IR_FRAME_MAX];
+
+private:
+    bool add(uint32_t time, bool isMark);
+};
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <Arduino.h>
+#include <esp_heap_caps.h>
 
 // Networking physical layer
 #ifdef USE_ETHERNET
@@ -17,6 +18,9 @@
 #define CONNECTION_METHOD "Ethernet"
 #else
 #include <WiFi.h>
+#include <Preferences.h>
+#include <esp_netif_net_stack.h>
+#include <lwip/dhcp.h>
 #define CONNECTION_METHOD "WiFi"
 #endif
 
@@ -24,6 +28,9 @@
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
 
+// Flash storage
+#include <LittleFS.h>
+
 // LoRa
 #define PJON_INCLUDE_TL
 #define TL_RESPONSE_DELAY 30 // Started out at 50ms, 20ms is too short, >=30ms works. // The PICAXE microcontrollers on the other end are pretty slow.
@@ -36,7 +43,13 @@
 
 // For alarm tunes
 #ifdef PIN_SPEAKER
-#include <TunePlayer.h>
+#include <esp_timer.h>
+#if PIN_SPEAKER == 25 || PIN_SPEAKER == 26
+// The speaker is on a DAC pin, so clips can be played.
+#define AUDIO_DAC
+#define AUDIO_DAC_CHANNEL (PIN_SPEAKER == 25 ? DAC_CHANNEL_MASK_CH0 : DAC_CHANNEL_MASK_CH1)
+#include <driver/dac_continuous.h>
+#endif
 #endif
 
 #if defined(GENERATE_TIMESERIES) && defined(USE_BMP180)
@@ -49,9 +62,18 @@
 
 #define MQTT_TOPIC_SEPARATOR '/'
 
-#define RECONNECT_DELAY 1000
-#define MQTT_RETRY_ITERATIONS 20
 #define WIFI_RECONNECT_ATTEMPT_TIME 60000 // If not connected in 1 minute, disconnect and attempt again.
+#define WIFI_FAST_CONNECT_TIME 5000 // Time to try the cached access point and IP before falling back to a full scan and DHCP.
+#define WIFI_CACHE_NAMESPACE "wifiCache" // NVS namespace for the cached connection details.
+#define KEY_MAP_NAMESPACE "keyMap" // NVS namespace for the hash of the last key maps published (COMPACT_TELEMETRY_KEYS).
+#define BACKOFF_MIN 1000 // First delay before retrying a failed connection. Doubles each failure.
+#define BACKOFF_MAX 60000 // Longest delay before retrying a failed connection.
+#define NETWORK_POLL_INTERVAL 1000 // Longest time the networking task waits for an event when not connected.
+#define MQTT_RX_BUFFER_SIZE 2048 // Large enough for the device registry attribute.
+#define MQTT_TX_BUFFER_SIZE 256 // Only needs to fit connect and subscribe packets and topics, as payloads are streamed.
+#define NTP_SERVER "pool.ntp.org" // For timestamping telemetry and checking cached DHCP leases.
+#define TIME_VALID_AFTER 1700000000 // Times before this (in s since the epoch) mean NTP hasn't set the clock yet.
+#define MQTT_STREAM_CHUNK 64 // Small writes are collected into chunks of this size before sending when streaming.
 
 // Logging (with mutexes)
 #define SERIAL_TAKE() xSemaphoreTake(serialMutex, portMAX_DELAY)
@@ -93,14 +115,221 @@
 #endif
 
 #define LORA_LED_FLASH_TIME 100
+#define LED_BRIGHTNESS_FULL 255
+#define LED_BRIGHTNESS_DIM 30 // Used for status that doesn't need attention.
+#define LED_PWM_FREQUENCY 5000
+#define LED_PWM_RESOLUTION 8 // Bits, so brightnesses are 0 to 255.
+#define LED_TIMER_RETRY 1 // Time in ms before the timer callback tries again if a task is changing the LED.
 
 // Pins
 // LORA pins are specified in platformio.ini
 // LEDs (Defined in platformio.ini. If not defined, these LEDs will not be used (LED_BUILTIN will always be used).
 // Speaker (Defined in platformio.ini. If not defined, no audio capabilities will be included).
 
+// Device registry
+#define REGISTRY_PATH "/devices.json"
+
 #define LORA_CHECK_INTERVAL 30000
+#define LORA_MAX_SOFT_RECOVERIES 3 // Attempts to reset the radio before restarting everything.
+#define LORA_RECOVERY_DELAY 2000 // Time between attempts to reset the radio.
+#define LORA_RESET_PULSE 10 // Time to hold the radio reset pin low and wait afterwards.
+#define RADIO_REQUEST_TIMEOUT 5000 // Longest to wait for the radio task to accept or finish a request.
 #define LORA_TX_INTERVAL 10000
 #define LORA_MAX_PACKET_SIZE 50
 
+// Statistics
+#define STATS_INTERVAL 60000 // Time between publishing gateway statistics.
+#define LATENCY_BUCKETS 32 // Number of power of 2 buckets in each latency histogram (up to 2^31us).
+#define JSON_ARENA_SLOT_SIZE 16 // ArduinoJson 7.2 variant slot on a 32 bit processor (7.3 made them smaller). ArduinoJson is pinned in platformio.ini to match.
+#define JSON_ARENA_POOL_SIZE (ARDUINOJSON_POOL_CAPACITY * JSON_ARENA_SLOT_SIZE + 8) // One ArduinoJson memory pool and its arena block header.
+#define JSON_ARENA_SIZE 2048 // Size of the per task arenas used for JSON documents.
+#define JSON_ARENA_SMALL_SIZE (JSON_ARENA_POOL_SIZE + 256) // Size of arenas created on the stack for tiny documents. A pool and room for strings.
+#define RADIO_LOOP_MERGE_INTERVAL 1000 // How often the PJON task adds its loop timings to the shared histograms.
+
+// Duplicate packets
+#define DEDUP_CACHE_SIZE 16 // Number of recent packets remembered.
+#define DEDUP_WINDOW 5000 // Packets with the same sender and payload within this time are dropped.
+
+// Packet capture (only used with PACKET_CAPTURE)
+#define CAPTURE_PATH "/capture.bin" // Ring of received packets in flash.
+#define CAPTURE_SLOTS 512 // Number of packets kept.
+#define CAPTURE_READ_RECORDS 8 // Records returned by each captureRead RPC call.
+#define CAPTURE_WRITE_BATCH 8 // Records collected in RAM before writing them to flash.
+#define CAPTURE_FLUSH_INTERVAL 10000 // Longest a record waits in RAM before being written.
+#define CAPTURE_REPLAY_BATCH 4 // Most records replayed each time the radio task polls.
+#define CAPTURE_REPLAY_READ 8 // Records read from flash at a time when replaying.
+
+// Simulated radio (only used with SIMULATE_RADIO)
+#ifndef SIM_NODE_COUNT
+#define SIM_NODE_COUNT 200 // Number of virtual nodes, each with its own id and using the fields of one of the known devices.
+#endif
+#ifndef SIM_NODE_INTERVAL
+#define SIM_NODE_INTERVAL 60000 // Average time between packets from each node.
+#endif
+#ifndef SIM_LOSS_PERCENT
+#define SIM_LOSS_PERCENT 5 // Percentage of packets lost before reaching the radio.
+#endif
+#ifndef SIM_ACK_PERCENT
+#define SIM_ACK_PERCENT 10 // Percentage of packets from the virtual nodes that ask for an acknowledgement.
+#endif
+#define SIM_PAYLOAD_MAX (PJON_PACKET_MAX_LENGTH - 9) // Leaves room for PJON's header, sender id and CRC.
+#define SIM_AIRTIME 150 // Time each packet is in the air. Packets that overlap collide.
+#define SIM_RSSI_MIN -130 // Range of RSSI given to the nodes.
+#define SIM_RSSI_MAX -40
+#define SIM_REPORT_INTERVAL 60000 // Time between publishing the results (and increasing the rate with SIM_RAMP).
+
+// Device and field lookups
+#define LOOKUP_INDEX_MIN_COUNT 16 // Managers with fewer items than this are searched linearly instead of indexed.
+#define BENCHMARK_SIZES 10, 100, 1000 // Numbers of devices to time lookups for with BENCHMARK_LOOKUPS.
+#define BENCHMARK_FIELDS 8 // Fields in each benchmark device.
+#define BENCHMARK_ITERATIONS 10000 // Lookups timed for each number of devices.
+
+// IR codes learnt from remotes (see irlearn.h)
+#define IR_CODE_DIR "/ir" // Folder the codes are stored in.
+#define IR_NAME_LENGTH 24 // Longest name of a code.
+#define IR_LEARN_TIMEOUT 10000 // Time to wait for a remote to be pressed.
+#define IR_LEARN_IDLE 30000 // Time in us without any change that ends a code. Longer than the gaps inside codes.
+#define IR_LEARN_MIN_LENGTH 8 // Anything with fewer marks and spaces is treated as noise.
+#define IR_LEARN_MAX_SYMBOLS (IR_FRAME_MAX / 2) // Longest code received (each symbol is a mark and space). Longer codes are rejected.
+#define IR_LEARN_MEM_BLOCKS RMT_MEM_NUM_BLOCKS_6 // RMT memory to receive into, must hold IR_LEARN_MAX_SYMBOLS (64 symbols per block).
+
+// Tunes
+#define TUNE_MAX_STEPS 640 // Longest tune once decoded (each note is a tone and a gap).
+#define TUNE_MAX_WORDS 4096 // Tunes without an end stop being read after this.
+#define TUNE_MAX_REPEAT_DEPTH 4 // Most repeats inside each other.
+#define TUNE_DEFAULT_BPM 120 // Used until a tune sets the tempo.
+#define TUNE_NOTE_GAP 20 // Silence at the end of each note.
+#define TUNE_LEDC_RESOLUTION 10 // Bits of LEDC duty resolution.
+
+// Audio clips (only used if the speaker is on a DAC pin)
+#define AUDIO_CLIP_ALARM "/audio/alarm.wav"
+#define AUDIO_CLIP_DOORBELL "/audio/doorbell.wav"
+#define AUDIO_CHUNK_SIZE 1024 // Samples in each DMA buffer.
+#define AUDIO_DMA_BUFFERS 4 // Number of DMA buffers.
+#define AUDIO_ADPCM_BLOCK_MAX 1024 // Largest ADPCM block size supported (ffmpeg uses up to 1024 bytes).
+
+// Queues
+#define ALARM_QUEUE_LENGTH 3
+#define AUDIO_QUEUE_LENGTH 3
+#define MQTT_PUBLISH_QUEUE_LENGTH 15
+#define RPC_QUEUE_LENGTH 4
+#define RADIO_QUEUE_LENGTH 4
+#define RX_RING_SIZE 16 // Received packets waiting to be decoded. Must be a power of 2.
+
+// Slow RPC actions (see rpcTask())
+#define RPC_QUEUE_TIMEOUT 3000 // Time to wait when passing alarms and doorbells on to their tasks.
+#define RPC_RESET_DELAY 10000 // Time between acknowledging a reset and restarting.
+
+// Everything allocated statically (tasks, queues, mutexes, arenas and the
+// larger buffers listed in memoryBudget in main.cpp) must fit in this. Checked
+// when compiling.
+#ifndef STATIC_MEMORY_BUDGET
+#define STATIC_MEMORY_BUDGET 73728
+#endif
+
+// Task placement (stack size in bytes, priority and core). Any of these can be
+// overridden with build flags in platformio.ini, e.g. -D TASK_PJON_CORE=0.
+// MQTT and the network stack share core 0 so the radio isn't held up by socket work.
+#ifndef TASK_NETWORKING_STACK
+#define TASK_NETWORKING_STACK 5120 // Room for the captureRead reply.
+#endif
+#ifndef TASK_NETWORKING_PRIORITY
+#define TASK_NETWORKING_PRIORITY 1
+#endif
+#ifndef TASK_NETWORKING_CORE
+#define TASK_NETWORKING_CORE 0
+#endif
+// Radio RX is time critical, so it gets the highest priority on the core away from networking.
+#ifndef TASK_PJON_STACK
+#define TASK_PJON_STACK 4096
+#endif
+#ifndef TASK_PJON_PRIORITY
+#define TASK_PJON_PRIORITY 3
+#endif
+#ifndef TASK_PJON_CORE
+#define TASK_PJON_CORE 1
+#endif
+// Decoding and publishing is kept away from the radio so a slow network can't hold it up.
+#ifndef TASK_RX_DECODER_STACK
+#define TASK_RX_DECODER_STACK 4096
+#endif
+#ifndef TASK_RX_DECODER_PRIORITY
+#define TASK_RX_DECODER_PRIORITY 2
+#endif
+#ifndef TASK_RX_DECODER_CORE
+#define TASK_RX_DECODER_CORE 1
+#endif
+#ifndef TASK_LORA_TX_STACK
+#define TASK_LORA_TX_STACK 4096
+#endif
+#ifndef TASK_LORA_TX_PRIORITY
+#define TASK_LORA_TX_PRIORITY 2
+#endif
+#ifndef TASK_LORA_TX_CORE
+#define TASK_LORA_TX_CORE 1
+#endif
+#ifndef TASK_LORA_WATCHDOG_STACK
+#define TASK_LORA_WATCHDOG_STACK 3072
+#endif
+#ifndef TASK_LORA_WATCHDOG_PRIORITY
+#define TASK_LORA_WATCHDOG_PRIORITY 1
+#endif
+#ifndef TASK_LORA_WATCHDOG_CORE
+#define TASK_LORA_WATCHDOG_CORE 1
+#endif
+#ifndef TASK_ALARM_STACK
+#define TASK_ALARM_STACK 4096
+#endif
+#ifndef TASK_ALARM_PRIORITY
+#define TASK_ALARM_PRIORITY 1
+#endif
+#ifndef TASK_ALARM_CORE
+#define TASK_ALARM_CORE 1
+#endif
+#ifndef TASK_AUDIO_STACK
+#define TASK_AUDIO_STACK 3072 // Room for reading clips from LittleFS.
+#endif
+#ifndef TASK_AUDIO_PRIORITY
+#define TASK_AUDIO_PRIORITY 1
+#endif
+#ifndef TASK_AUDIO_CORE
+#define TASK_AUDIO_CORE 1
+#endif
+#ifndef TASK_LEDS_STACK
+#define TASK_LEDS_STACK 2048
+#endif
+#ifndef TASK_LEDS_PRIORITY
+#define TASK_LEDS_PRIORITY 1
+#endif
+#ifndef TASK_LEDS_CORE
+#define TASK_LEDS_CORE 1
+#endif
+#ifndef TASK_TIMESERIES_STACK
+#define TASK_TIMESERIES_STACK 4096
+#endif
+#ifndef TASK_TIMESERIES_PRIORITY
+#define TASK_TIMESERIES_PRIORITY 1
+#endif
+#ifndef TASK_TIMESERIES_CORE
+#define TASK_TIMESERIES_CORE 0
+#endif
+#ifndef TASK_STATS_STACK
+#define TASK_STATS_STACK 3072
+#endif
+#ifndef TASK_STATS_PRIORITY
+#define TASK_STATS_PRIORITY 1
+#endif
+#ifndef TASK_STATS_CORE
+#define TASK_STATS_CORE 0
+#endif
+#ifndef TASK_RPC_STACK
+#define TASK_RPC_STACK 3072 // Room for reading IR codes from LittleFS.
+#endif
+#ifndef TASK_RPC_PRIORITY
+#define TASK_RPC_PRIORITY 1
+#endif
+#ifndef TASK_RPC_CORE
+#define TASK_RPC_CORE 1
+#endif
+
 #include "src/topics.h"
\ No newline at end of file
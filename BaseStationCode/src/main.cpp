@@ -19,15 +19,19 @@ bool ethernetConnected = false;
 WiFiClient wifi;
 PubSubClient mqtt(wifi);
 #endif
-PJONThroughLora bus(PJON_DEVICE_ID);
 QueueHandle_t alarmQueue;
 #ifdef PIN_SPEAKER
 QueueHandle_t audioQueue;
 #endif
 QueueHandle_t mqttPublishQueue;
-SemaphoreHandle_t loraMutex;
+QueueHandle_t rpcQueue;
+QueueHandle_t radioQueue;
 SemaphoreHandle_t mqttMutex;
 SemaphoreHandle_t serialMutex;
+SemaphoreHandle_t statsMutex;
+#ifdef PACKET_CAPTURE
+SemaphoreHandle_t captureMutex;
+#endif
 
 #include "device_list.h"
 #include "src/networking.h"
@@ -38,13 +42,24 @@ SemaphoreHandle_t serialMutex;
 #include "src/leds.h"
 #include "src/ota.h"
 #include "src/timeseries.h"
+#include "src/stats.h"
+#include "src/registry.h"
+#include "src/simulation.h"
+#include "src/benchmark.h"
+#include "src/irlearn.h"
+
+GatewayBus bus(PJON_DEVICE_ID);
 
 // States used for LED control.
 SemaphoreHandle_t stateUpdateMutex;
+SemaphoreHandle_t ledMutex;
 AlarmState alarmState;
 NetworkState networkState;
 uint32_t lastLoRaTime;
 TaskHandle_t ledTaskHandle;
+TaskHandle_t loraTxTaskHandle;
+TaskHandle_t rxDecoderTaskHandle;
+TaskHandle_t networkingTaskHandle; // Set by the networking task itself.
 bool otaUpdating = false;
 
 #ifdef PIN_IR
@@ -52,6 +67,239 @@ bool otaUpdating = false;
 HVAC airConditioner(PIN_IR);
 #endif
 
+// Statically allocated buffers defined in other files, for the memory budget.
+extern RxRing rxRing;
+extern StaticArena<JSON_ARENA_SIZE> pjonArena;
+extern StaticArena<JSON_ARENA_SIZE> networkingArena;
+extern DuplicateFilter duplicateFilter;
+#ifdef GENERATE_TIMESERIES
+extern StaticArena<JSON_ARENA_SMALL_SIZE> timeseriesArena;
+#endif
+#ifdef LATENCY_TRACING
+extern LatencyHistogram latencyHistograms[LATENCY_STAGE_COUNT];
+#endif
+#ifdef PIN_SPEAKER
+extern TuneSchedule tuneSchedule;
+#ifdef AUDIO_DAC
+extern ClipReader clip;
+extern uint8_t clipBuffer[AUDIO_CHUNK_SIZE];
+#endif
+#endif
+#ifdef PIN_IR
+extern IrFrame irSendFrame;
+extern uint8_t irSendCode[IR_CODE_MAX_SIZE];
+#ifdef PIN_IR_RX
+extern IrFrame irLearnFrame;
+extern uint8_t irLearnCode[IR_CODE_MAX_SIZE];
+extern IrLearnState irLearn;
+extern rmt_data_t irLearnSymbols[IR_LEARN_MAX_SYMBOLS];
+#endif
+#endif
+#ifdef PACKET_CAPTURE
+extern CaptureHeader captureHeader;
+extern CaptureReplayState captureReplay;
+extern File captureFile;
+extern CaptureRecord captureBuffer[CAPTURE_WRITE_BATCH];
+#endif
+#ifdef SIMULATE_RADIO
+extern PJON<SimulatedNodeRadio> simulatedNodes;
+#endif
+
+// Storage for queues and mutexes so that nothing needs to be allocated from
+// the heap at boot.
+uint8_t alarmQueueStorage[ALARM_QUEUE_LENGTH * sizeof(AlarmState)];
+StaticQueue_t alarmQueueBuffer;
+#ifdef PIN_SPEAKER
+uint8_t audioQueueStorage[AUDIO_QUEUE_LENGTH * sizeof(AlarmState)];
+StaticQueue_t audioQueueBuffer;
+#endif
+uint8_t mqttPublishQueueStorage[MQTT_PUBLISH_QUEUE_LENGTH * sizeof(MqttMsg)];
+StaticQueue_t mqttPublishQueueBuffer;
+uint8_t rpcQueueStorage[RPC_QUEUE_LENGTH * sizeof(RpcJob)];
+StaticQueue_t rpcQueueBuffer;
+uint8_t radioQueueStorage[RADIO_QUEUE_LENGTH * sizeof(RadioCommand)];
+StaticQueue_t radioQueueBuffer;
+StaticSemaphore_t mqttMutexBuffer;
+StaticSemaphore_t serialMutexBuffer;
+StaticSemaphore_t stateUpdateMutexBuffer;
+StaticSemaphore_t statsMutexBuffer;
+StaticSemaphore_t ledMutexBuffer;
+#ifdef PACKET_CAPTURE
+StaticSemaphore_t captureMutexBuffer;
+#endif
+
+/**
+ * @brief Declares the stack and task control block for a statically allocated
+ * task.
+ *
+ */
+#define STATIC_TASK(NAME, STACK)    \
+    StackType_t NAME##Stack[STACK]; \
+    StaticTask_t NAME##Buffer
+
+STATIC_TASK(networking, TASK_NETWORKING_STACK);
+STATIC_TASK(pjon, TASK_PJON_STACK);
+STATIC_TASK(rxDecoder, TASK_RX_DECODER_STACK);
+STATIC_TASK(alarm, TASK_ALARM_STACK);
+#ifdef PIN_SPEAKER
+STATIC_TASK(audio, TASK_AUDIO_STACK);
+#endif
+STATIC_TASK(loraTx, TASK_LORA_TX_STACK);
+STATIC_TASK(leds, TASK_LEDS_STACK);
+#ifdef GENERATE_TIMESERIES
+STATIC_TASK(timeseries, TASK_TIMESERIES_STACK);
+#endif
+STATIC_TASK(stats, TASK_STATS_STACK);
+STATIC_TASK(rpc, TASK_RPC_STACK);
+
+/**
+ * @brief Settings used to create each task.
+ *
+ */
+struct TaskConfig
+{
+    TaskFunction_t function;
+    const char *name;
+    StackType_t *stack;
+    uint32_t stackSize;
+    UBaseType_t priority;
+    BaseType_t core;
+    StaticTask_t *buffer;
+    TaskHandle_t *handle;
+};
+
+/**
+ * @brief Fills in the storage for a task declared with STATIC_TASK.
+ *
+ */
+#define TASK_STORAGE(NAME) NAME##Stack, sizeof(NAME##Stack)
+
+/**
+ * @brief All tasks started from setup(). Stack sizes, priorities and cores are
+ * set in defines.h and can be overridden from platformio.ini. The LoRa watchdog
+ * is started by the PJON task once the radio is set up.
+ *
+ */
+const TaskConfig taskTable[] = {
+    // Created first as the other tasks notify it when their state changes.
+    {ledTask, "LEDs", TASK_STORAGE(leds), TASK_LEDS_PRIORITY, TASK_LEDS_CORE, &ledsBuffer, &ledTaskHandle},
+    {networkingTask, "Networking", TASK_STORAGE(networking), TASK_NETWORKING_PRIORITY, TASK_NETWORKING_CORE, &networkingBuffer, NULL},
+    // Created before the radio task as that notifies it of each packet.
+    {rxDecoderTask, "RX decoder", TASK_STORAGE(rxDecoder), TASK_RX_DECODER_PRIORITY, TASK_RX_DECODER_CORE, &rxDecoderBuffer, &rxDecoderTaskHandle},
+    {pjonTask, "PJON", TASK_STORAGE(pjon), TASK_PJON_PRIORITY, TASK_PJON_CORE, &pjonBuffer, NULL},
+    {alarmTask, "Alarm", TASK_STORAGE(alarm), TASK_ALARM_PRIORITY, TASK_ALARM_CORE, &alarmBuffer, NULL},
+#ifdef PIN_SPEAKER
+    {audioTask, "Audio", TASK_STORAGE(audio), TASK_AUDIO_PRIORITY, TASK_AUDIO_CORE, &audioBuffer, NULL},
+#endif
+    {loraTxTask, "LoRa TX", TASK_STORAGE(loraTx), TASK_LORA_TX_PRIORITY, TASK_LORA_TX_CORE, &loraTxBuffer, &loraTxTaskHandle},
+#ifdef GENERATE_TIMESERIES
+    {timeseriesTask, "TS", TASK_STORAGE(timeseries), TASK_TIMESERIES_PRIORITY, TASK_TIMESERIES_CORE, &timeseriesBuffer, NULL},
+#endif
+    {statsTask, "Stats", TASK_STORAGE(stats), TASK_STATS_PRIORITY, TASK_STATS_CORE, &statsBuffer, NULL},
+    {rpcTask, "RPC", TASK_STORAGE(rpc), TASK_RPC_PRIORITY, TASK_RPC_CORE, &rpcBuffer, NULL}};
+
+/**
+ * @brief An entry in the memory budget.
+ *
+ */
+struct MemoryBudgetItem
+{
+    const char *name;
+    size_t bytes;
+};
+
+/**
+ * @brief Everything allocated statically: tasks, queues, mutexes and the
+ * larger buffers and arenas. Each row is under the same #ifdef as what it
+ * measures. This is checked against STATIC_MEMORY_BUDGET when compiling and
+ * printed at boot.
+ *
+ */
+constexpr MemoryBudgetItem memoryBudget[] = {
+    {"Networking task", sizeof(networkingStack) + sizeof(networkingBuffer)},
+    {"PJON task", sizeof(pjonStack) + sizeof(pjonBuffer)},
+    {"PJON bus", sizeof(bus)},
+#ifdef SIMULATE_RADIO
+    {"Simulated nodes", sizeof(simulatedNodes)},
+#endif
+    {"RX decoder task", sizeof(rxDecoderStack) + sizeof(rxDecoderBuffer)},
+    {"RX ring", sizeof(rxRing)},
+    {"LoRa watchdog task", sizeof(loraWatchdogStack) + sizeof(loraWatchdogBuffer)},
+    {"Alarm task", sizeof(alarmStack) + sizeof(alarmBuffer)},
+#ifdef PIN_SPEAKER
+    {"Audio task", sizeof(audioStack) + sizeof(audioBuffer)},
+#endif
+    {"LoRa TX task", sizeof(loraTxStack) + sizeof(loraTxBuffer)},
+    {"LEDs task", sizeof(ledsStack) + sizeof(ledsBuffer)},
+#ifdef GENERATE_TIMESERIES
+    {"TS task", sizeof(timeseriesStack) + sizeof(timeseriesBuffer)},
+#endif
+    {"Stats task", sizeof(statsStack) + sizeof(statsBuffer)},
+    {"RPC task", sizeof(rpcStack) + sizeof(rpcBuffer)},
+    {"Alarm queue", sizeof(alarmQueueStorage) + sizeof(alarmQueueBuffer)},
+#ifdef PIN_SPEAKER
+    {"Audio queue", sizeof(audioQueueStorage) + sizeof(audioQueueBuffer)},
+#endif
+    {"MQTT publish queue", sizeof(mqttPublishQueueStorage) + sizeof(mqttPublishQueueBuffer)},
+    {"RPC queue", sizeof(rpcQueueStorage) + sizeof(rpcQueueBuffer)},
+    {"Radio queue", sizeof(radioQueueStorage) + sizeof(radioQueueBuffer)},
+    {"PJON arena", sizeof(pjonArena)},
+    {"Networking arena", sizeof(networkingArena)},
+#ifdef GENERATE_TIMESERIES
+    {"TS arena", sizeof(timeseriesArena)},
+#endif
+    {"Duplicate filter", sizeof(duplicateFilter)},
+#ifdef LATENCY_TRACING
+    {"Latency histograms", sizeof(latencyHistograms)},
+#endif
+#ifdef PIN_SPEAKER
+    {"Tune schedule", sizeof(tuneSchedule)},
+#ifdef AUDIO_DAC
+    {"Clip reader", sizeof(clip)},
+    {"Clip buffer", sizeof(clipBuffer)},
+#endif
+#endif
+#ifdef PIN_IR
+    {"IR buffers", sizeof(airConditioner)},
+    {"IR send frame", sizeof(irSendFrame)},
+    {"IR send code", sizeof(irSendCode)},
+#ifdef PIN_IR_RX
+    {"IR learn frame", sizeof(irLearnFrame)},
+    {"IR learn code", sizeof(irLearnCode)},
+    {"IR learn state", sizeof(irLearn)},
+    {"IR learn symbols", sizeof(irLearnSymbols)},
+#endif
+#endif
+#ifdef PACKET_CAPTURE
+    {"Capture state", sizeof(captureHeader) + sizeof(captureFile)},
+    {"Capture buffer", sizeof(captureBuffer)},
+    {"Capture replay", sizeof(captureReplay)},
+#endif
+    {"MQTT mutex", sizeof(mqttMutexBuffer)},
+    {"Serial mutex", sizeof(serialMutexBuffer)},
+    {"State update mutex", sizeof(stateUpdateMutexBuffer)},
+    {"Stats mutex", sizeof(statsMutexBuffer)},
+    {"LED mutex", sizeof(ledMutexBuffer)},
+#ifdef PACKET_CAPTURE
+    {"Capture mutex", sizeof(captureMutexBuffer)},
+#endif
+};
+
+/**
+ * @brief Adds up everything in the memory budget.
+ *
+ */
+constexpr size_t memoryBudgetTotal()
+{
+    size_t total = 0;
+    for (const MemoryBudgetItem &item : memoryBudget)
+    {
+        total += item.bytes;
+    }
+    return total;
+}
+static_assert(memoryBudgetTotal() <= STATIC_MEMORY_BUDGET, "Statically allocated tasks, queues, mutexes and buffers are over STATIC_MEMORY_BUDGET.");
+
 #define PIO_VERSION_STR "Env=" PIO_ENV ", Platform=" PIO_PLATFORM " (" PIO_PLATFORM_VERSION "), FRAMEWORK=" PIO_FRAMEWORK "."
 
 void setup()
@@ -60,113 +308,75 @@ void setup()
     // In case a reset pccured at the wrong time.
     pinMode(PIN_SPEAKER, OUTPUT);
     digitalWrite(PIN_SPEAKER, LOW);
-    audioQueue = xQueueCreate(3, sizeof(AlarmState));
+    audioQueue = xQueueCreateStatic(AUDIO_QUEUE_LENGTH, sizeof(AlarmState), audioQueueStorage, &audioQueueBuffer);
 #endif
 
     // Setup queues and mutexes
     // TODO: Swap to notifications
-    alarmQueue = xQueueCreate(3, sizeof(AlarmState));
-    mqttPublishQueue = xQueueCreate(15, sizeof(MqttMsg));
-    mqttMutex = xSemaphoreCreateMutex();
-    serialMutex = xSemaphoreCreateMutex(); // Needs to be created before logging anything.
-    loraMutex = xSemaphoreCreateMutex();
-    stateUpdateMutex = xSemaphoreCreateMutex();
+    alarmQueue = xQueueCreateStatic(ALARM_QUEUE_LENGTH, sizeof(AlarmState), alarmQueueStorage, &alarmQueueBuffer);
+    mqttPublishQueue = xQueueCreateStatic(MQTT_PUBLISH_QUEUE_LENGTH, sizeof(MqttMsg), mqttPublishQueueStorage, &mqttPublishQueueBuffer);
+    rpcQueue = xQueueCreateStatic(RPC_QUEUE_LENGTH, sizeof(RpcJob), rpcQueueStorage, &rpcQueueBuffer);
+    radioQueue = xQueueCreateStatic(RADIO_QUEUE_LENGTH, sizeof(RadioCommand), radioQueueStorage, &radioQueueBuffer);
+    mqttMutex = xSemaphoreCreateMutexStatic(&mqttMutexBuffer);
+    serialMutex = xSemaphoreCreateMutexStatic(&serialMutexBuffer); // Needs to be created before logging anything.
+    stateUpdateMutex = xSemaphoreCreateMutexStatic(&stateUpdateMutexBuffer);
+    statsMutex = xSemaphoreCreateMutexStatic(&statsMutexBuffer);
+    ledMutex = xSemaphoreCreateMutexStatic(&ledMutexBuffer);
+#ifdef PACKET_CAPTURE
+    captureMutex = xSemaphoreCreateMutexStatic(&captureMutexBuffer);
+#endif
 
     Serial.begin(SERIAL_BAUD); // Already running from the bootloader.
     // Serial.setDebugOutput(true);
     LOGI("Setup", "Farm PJON LoRa base station v" VERSION ". Compiled " __DATE__ ", " __TIME__ ". Connecting using " CONNECTION_METHOD ".");
     LOGI("Setup", PIO_VERSION_STR);
 
-    if (!alarmQueue ||
-#ifdef PIN_SPEAKER
-        !audioQueue ||
-#endif
-        !mqttPublishQueue || !mqttMutex || !serialMutex || !loraMutex || !stateUpdateMutex)
+    // Print the memory budget.
+    for (const MemoryBudgetItem &item : memoryBudget)
+    {
+        LOGI("Setup", "%-20s %6u bytes", item.name, item.bytes);
+    }
+    LOGI("Setup", "%-20s %6u bytes (budget %u)", "Total static", memoryBudgetTotal(), STATIC_MEMORY_BUDGET);
+
+    // Load the device registry from flash if there is one.
+    if (!LittleFS.begin(true))
     {
-        LOGE("SETUP", "Could not create something!!!");
+        LOGE("Setup", "Could not mount LittleFS.");
     }
+    registryLoad(deviceManager);
+#ifdef SIMULATE_RADIO
+    simulationBegin(deviceManager);
+#endif
+#ifdef PACKET_CAPTURE
+    captureBegin();
+#endif
+
+#ifdef BENCHMARK_LOOKUPS
+    lookupBenchmark();
+#endif
 
     // Setup IR pin if fitted
 #ifdef PIN_IR
-    airConditioner.begin();
+    if (!airConditioner.begin())
+    {
+        LOGE("Setup", "Could not set up IR.");
+    }
+#ifdef PIN_IR_RX
+    irLearnBegin();
+#endif
 #endif
 
     // Create tasks
-    xTaskCreatePinnedToCore(
-        networkingTask,
-        "Networking",
-        4096,
-        NULL,
-        1,
-        NULL,
-        1);
-
-    // xTaskCreatePinnedToCore(
-    //     fakeReceiveTask,
-    //     "FakeData",
-    //     4096,
-    //     NULL,
-    //     1,
-    //     NULL,
-    //     1);
-
-    xTaskCreatePinnedToCore(
-        pjonTask,
-        "PJON",
-        4096,
-        NULL,
-        1,
-        NULL,
-        1);
-
-    xTaskCreatePinnedToCore(
-        alarmTask,
-        "Alarm",
-        4096,
-        NULL,
-        1,
-        NULL,
-        1);
-
-#ifdef PIN_SPEAKER
-    xTaskCreatePinnedToCore(
-        audioTask,
-        "Audio",
-        2048,
-        NULL,
-        1,
-        NULL,
-        1);
-#endif
-
-    xTaskCreatePinnedToCore(
-        loraTxTask,
-        "LoRa TX",
-        4096,
-        NULL,
-        1,
-        NULL,
-        1);
-
-    xTaskCreatePinnedToCore(
-        ledTask,
-        "LEDs",
-        2048,
-        NULL,
-        1,
-        &ledTaskHandle,
-        1);
-
-#ifdef GENERATE_TIMESERIES
-    xTaskCreatePinnedToCore(
-        timeseriesTask,
-        "TS",
-        4096,
-        NULL,
-        1,
-        NULL,
-        1);
-#endif
+    for (const TaskConfig &task : taskTable)
+    {
+        LOGI("Setup", "Starting task '%s' (stack %lu, priority %u, core %d).", task.name, task.stackSize, task.priority, task.core);
+        TaskHandle_t handle = xTaskCreateStaticPinnedToCore(task.function, task.name, task.stackSize, NULL, task.priority, task.stack, task.buffer, task.core);
+        if (task.handle)
+        {
+            *task.handle = handle;
+        }
+    }
+    LOGI("Setup", "Heap free: %u bytes, largest free block: %u bytes.", ESP.getFreeHeap(), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
     // TODO: Actually measure ram and high water marks rather than guessing.
 
 #ifdef OTA_ENABLE
@@ -31,6 +31,7 @@ void alarmTask(void *pvParameters)
         xSemaphoreTake(stateUpdateMutex, portMAX_DELAY);
         alarmState = state;
         xSemaphoreGive(stateUpdateMutex);
+        xTaskNotifyGive(ledTaskHandle); // Tell the led task something changed.
 #ifdef PIN_SPEAKER
         xQueueSend(audioQueue, (void *)&state, portMAX_DELAY);
 #endif
@@ -0,0 +1,113 @@
+/**
+ * @file arena.cpp
+ * @brief Bump allocator for ArduinoJson documents so that short lived
+ * documents don't fragment the heap.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-02-15
+ */
+#include "arena.h"
+
+// Each block is preceded by its size. This is 8 bytes to keep blocks aligned.
+#define ARENA_HEADER_SIZE 8
+#define ARENA_ALIGN(SIZE) (((SIZE) + 7) & ~(size_t)7)
+
+std::atomic<uint32_t> localArenaOverflows{0};
+
+void *ArenaAllocator::allocate(size_t size)
+{
+#ifndef JSON_ARENA_DISABLE
+    size_t blockSize = ARENA_ALIGN(size);
+    if (m_used + ARENA_HEADER_SIZE + blockSize <= m_size)
+    {
+        // Fits in the arena.
+        uint8_t *ptr = m_buffer + m_used + ARENA_HEADER_SIZE;
+        m_blockSize(ptr) = blockSize;
+        m_used += ARENA_HEADER_SIZE + blockSize;
+        if (m_used > peak)
+        {
+            peak = m_used;
+        }
+        return ptr;
+    }
+
+    // Doesn't fit, use the heap instead.
+    overflows++;
+#endif
+    return malloc(size);
+}
+
+void ArenaAllocator::deallocate(void *ptr)
+{
+    if (!m_contains(ptr))
+    {
+        free(ptr);
+    }
+    else if (m_isTop(ptr))
+    {
+        // Most recent block, so can be given back straight away.
+        m_used = (uint8_t *)ptr - m_buffer - ARENA_HEADER_SIZE;
+    }
+    // Otherwise this is freed when the scope is released.
+}
+
+void *ArenaAllocator::reallocate(void *ptr, size_t newSize)
+{
+    if (!ptr)
+    {
+        return allocate(newSize);
+    }
+    if (!m_contains(ptr))
+    {
+        return realloc(ptr, newSize);
+    }
+
+    // Shrinking can always happen in place.
+    size_t oldSize = m_blockSize(ptr);
+    size_t blockSize = ARENA_ALIGN(newSize);
+    if (blockSize <= oldSize && !m_isTop(ptr))
+    {
+        return ptr;
+    }
+
+    // The most recent block can be resized in place if there is space.
+    if (m_isTop(ptr))
+    {
+        size_t start = (uint8_t *)ptr - m_buffer;
+        if (start + blockSize <= m_size)
+        {
+            m_blockSize(ptr) = blockSize;
+            m_used = start + blockSize;
+            if (m_used > peak)
+            {
+                peak = m_used;
+            }
+            return ptr;
+        }
+    }
+
+    // Need to move it somewhere else.
+    void *newPtr = allocate(newSize);
+    if (newPtr)
+    {
+        memcpy(newPtr, ptr, oldSize < newSize ? oldSize : newSize);
+        deallocate(ptr);
+    }
+    return newPtr;
+}
+
+bool ArenaAllocator::m_contains(void *ptr)
+{
+    return (uint8_t *)ptr >= m_buffer && (uint8_t *)ptr < m_buffer + m_size;
+}
+
+size_t &ArenaAllocator::m_blockSize(void *ptr)
+{
+    return *(size_t *)((uint8_t *)ptr - ARENA_HEADER_SIZE);
+}
+
+bool ArenaAllocator::m_isTop(void *ptr)
+{
+    return (uint8_t *)ptr + m_blockSize(ptr) == m_buffer + m_used;
+}
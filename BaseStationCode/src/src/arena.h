@@ -0,0 +1,138 @@
+/**
+ * @file arena.h
+ * @brief Bump allocator for ArduinoJson documents so that short lived
+ * documents don't fragment the heap.
+ *
+ * Each task that builds documents owns an arena. An ArenaScope is created
+ * before any documents and everything allocated after it is released in one
+ * go when it goes out of scope. If an arena runs out of space, allocations
+ * fall back to the heap and are counted as overflows.
+ *
+ * ArduinoJson allocates its variants in pools of ARDUINOJSON_POOL_CAPACITY
+ * slots, so even an empty object needs JSON_ARENA_POOL_SIZE bytes. Arenas are
+ * sized from this and LocalArena is used for short lived arenas on the stack,
+ * which adds its overflows to localArenaOverflows when it goes away.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-02-15
+ */
+
+#pragma once
+#include "../defines.h"
+#include <atomic>
+
+static_assert(ARDUINOJSON_VERSION_MAJOR == 7 && ARDUINOJSON_VERSION_MINOR == 2, "JSON_ARENA_SLOT_SIZE is the ArduinoJson 7.2 slot size. Check it before changing versions.");
+static_assert(JSON_ARENA_SMALL_SIZE >= JSON_ARENA_POOL_SIZE, "Small arenas must hold an ArduinoJson memory pool.");
+static_assert(JSON_ARENA_SMALL_SIZE <= 1024, "Small arenas are on task stacks. Reduce ARDUINOJSON_POOL_CAPACITY.");
+static_assert(JSON_ARENA_SIZE >= 4 * JSON_ARENA_POOL_SIZE, "Per task arenas should hold several ArduinoJson memory pools.");
+
+extern std::atomic<uint32_t> localArenaOverflows; // Overflows from every LocalArena that has been destroyed.
+
+/**
+ * @brief ArduinoJson allocator that hands out memory from a fixed buffer.
+ *
+ */
+class ArenaAllocator : public ArduinoJson::Allocator
+{
+public:
+    /**
+     * @brief Construct a new Arena Allocator object.
+     *
+     * @param buffer the memory to allocate from. Must be 8 byte aligned.
+     * @param size the size of buffer in bytes.
+     */
+    ArenaAllocator(uint8_t *buffer, size_t size) : m_buffer(buffer), m_size(size) {}
+
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr) override;
+    void *reallocate(void *ptr, size_t newSize) override;
+
+    /**
+     * @brief Returns the current position in the arena to later release back
+     * to.
+     *
+     */
+    size_t mark() { return m_used; }
+
+    /**
+     * @brief Frees everything allocated since mark() was called.
+     *
+     * @param position the value returned by mark().
+     */
+    void release(size_t position) { m_used = position; }
+
+    uint32_t overflows = 0; // Number of allocations that did not fit and went to the heap.
+    size_t peak = 0;        // The most that has been used at once.
+
+private:
+    /**
+     * @brief Checks if a pointer was allocated from this arena (rather than
+     * the heap).
+     *
+     */
+    bool m_contains(void *ptr);
+
+    /**
+     * @brief Returns the size of a block allocated from this arena.
+     *
+     */
+    size_t &m_blockSize(void *ptr);
+
+    /**
+     * @brief Checks if a block is the most recent allocation, in which case it
+     * can be resized or freed in place.
+     *
+     */
+    bool m_isTop(void *ptr);
+
+    uint8_t *const m_buffer;
+    const size_t m_size;
+    size_t m_used = 0;
+};
+
+/**
+ * @brief An arena along with its storage.
+ *
+ * @tparam SIZE the size of the arena in bytes.
+ */
+template <size_t SIZE>
+class StaticArena : public ArenaAllocator
+{
+public:
+    StaticArena() : ArenaAllocator(m_storage, SIZE) {}
+
+private:
+    alignas(8) uint8_t m_storage[SIZE];
+};
+
+/**
+ * @brief An arena for a single function on the stack. Overflows are added to
+ * localArenaOverflows when it goes out of scope so that they are still
+ * reported.
+ *
+ * @tparam SIZE the size of the arena in bytes.
+ */
+template <size_t SIZE>
+class LocalArena : public StaticArena<SIZE>
+{
+public:
+    ~LocalArena() { localArenaOverflows += this->overflows; }
+};
+
+/**
+ * @brief Releases everything allocated from an arena while this object
+ * existed. Must be created before the documents using the arena so that they
+ * are destroyed first.
+ *
+ */
+class ArenaScope
+{
+public:
+    ArenaScope(ArenaAllocator &arena) : m_arena(arena), m_mark(arena.mark()) {}
+    ~ArenaScope() { m_arena.release(m_mark); }
+
+private:
+    ArenaAllocator &m_arena;
+    const size_t m_mark;
+};
@@ -12,6 +12,61 @@
 extern SemaphoreHandle_t serialMutex;
 extern QueueHandle_t audioQueue;
 
+#ifdef AUDIO_DAC
+ClipReader clip;
+uint8_t clipBuffer[AUDIO_CHUNK_SIZE];
+
+bool playClip(const char *path, AlarmState &state, bool &interrupted)
+{
+    if (!clip.open(path))
+    {
+        return false;
+    }
+
+    // Stream the samples to the DAC with DMA.
+    dac_continuous_handle_t dac;
+    dac_continuous_config_t config = {
+        .chan_mask = AUDIO_DAC_CHANNEL,
+        .desc_num = AUDIO_DMA_BUFFERS,
+        .buf_size = AUDIO_CHUNK_SIZE,
+        .freq_hz = clip.sampleRate,
+        .offset = 0,
+        .clk_src = DAC_DIGI_CLK_SRC_APLL, // The default clock can't go below ~20kHz.
+        .chan_mode = DAC_CHANNEL_MODE_SIMUL};
+    if (dac_continuous_new_channels(&config, &dac) != ESP_OK)
+    {
+        LOGW("AUDIO", "Could not start the DAC at %luHz.", clip.sampleRate);
+        clip.close();
+        return false;
+    }
+    dac_continuous_enable(dac);
+    LOGI("AUDIO", "Playing '%s' at %luHz.", path, clip.sampleRate);
+
+    size_t length;
+    while ((length = clip.read(clipBuffer, sizeof(clipBuffer))) != 0)
+    {
+        // Sleeps until the DMA interrupt frees up a buffer.
+        dac_continuous_write(dac, clipBuffer, length, NULL, -1);
+        if (xQueueReceive(audioQueue, (void *)&state, 0))
+        {
+            interrupted = true;
+            break;
+        }
+    }
+
+    // Push the end of the clip out of the DMA buffers before stopping.
+    memset(clipBuffer, 128, sizeof(clipBuffer));
+    for (uint8_t i = 0; i < AUDIO_DMA_BUFFERS; i++)
+    {
+        dac_continuous_write(dac, clipBuffer, sizeof(clipBuffer), NULL, -1);
+    }
+    dac_continuous_disable(dac);
+    dac_continuous_del_channels(dac);
+    clip.close();
+    return true;
+}
+#endif
+
 // Converted from 'Doctor_Who_Theme_Tuneplayer' by TunePlayer Musescore plugin V1.8.2
 const uint16_t Doctor_Who_Theme_Tuneplayer[] PROGMEM = {
     0xe0c8, // Tempo change to 200 BPM
@@ -46,19 +101,16 @@ const uint16_t Doorbell[] PROGMEM = {
     0xf000 // End of tune. Stop playing.
 };
 
-FlashTuneLoader flashLoader;  // Where the notes come from
-ToneSound piezo(PIN_SPEAKER); // What plays the notes
-TunePlayer tune;              // Coordinates everything and does things at the right times.
-
-// Located here for now as the library doesn't like being included from other files.
 void audioTask(void *pvParameters)
 {
     // begin processing
     LOGD("AUDIO", "Beginning");
+    tuneBegin();
     bool skipWait = false;
     while (true)
     {
-        // // Wait for something to play.
+        // Wait for something to play. Tunes keep playing in the background
+        // while waiting.
         LOGD("AUDIO", "Waiting for a play instruction.");
         AlarmState state;
         if (!skipWait)
@@ -67,36 +119,36 @@ void audioTask(void *pvParameters)
         }
         skipWait = false;
 
+        // Whatever was playing is replaced.
+        tuneStop();
         if (state != ALARM_OFF)
         {
             // Start playing
             LOGI("AUDIO", "Playing.");
             // Choose what to play
             const uint16_t *selectedTune;
+            const char *selectedClip;
             switch (state)
             {
                 case ALARM_HIGH:
                 case ALARM_MEDIUM:
                     selectedTune = Doctor_Who_Theme_Tuneplayer;
+                    selectedClip = AUDIO_CLIP_ALARM;
                     break;
                 case ALARM_DOORBELL:
                     selectedTune = Doorbell;
+                    selectedClip = AUDIO_CLIP_DOORBELL;
             }
-            flashLoader.setTune(selectedTune);
-            tune.begin(&flashLoader, &piezo);
-            tune.play();
 
-            // Play the file
-            do
+#ifdef AUDIO_DAC
+            // Use a clip if there is one, otherwise fall back to the tune.
+            if (playClip(selectedClip, state, skipWait))
             {
-                tune.update();
-                yield();
-                if (xQueueReceive(audioQueue, (void *)&state, 0))
-                {
-                    skipWait = true;
-                }
-            } while (tune.isPlaying() && !skipWait);
-            tune.stop(); // Go back to beginning.
+                continue;
+            }
+#endif
+            tuneLoad(selectedTune);
+            tunePlay();
         }
     }
 }
@@ -1,6 +1,12 @@
 /**
  * @file audio.h
  * @brief Plays audio
+ *
+ * If the speaker is on a DAC pin (25 or 26), alarms play clips from flash
+ * (AUDIO_CLIP_ALARM and AUDIO_CLIP_DOORBELL, see clip.h for the formats) if
+ * they exist. These are streamed to the DAC with DMA, so the audio task only
+ * wakes up when a buffer needs refilling. Otherwise, the built in tunes are
+ * played in the background (see tune.h).
  * 
  * @author Jotham Gates
  * @version 0.1
@@ -12,6 +18,22 @@
 
 #ifdef PIN_SPEAKER
 #include "alarm.h"
+#include "clip.h"
+#include "tune.h"
+
+#ifdef AUDIO_DAC
+/**
+ * @brief Plays a clip through the DAC. Stops early if something else is added
+ * to the audio queue.
+ *
+ * @param path the path of the clip.
+ * @param state set to the new state if stopped early.
+ * @param interrupted set to true if stopped early.
+ * @return true if the clip was played, false if it couldn't be opened or the
+ * DAC couldn't be started.
+ */
+bool playClip(const char *path, AlarmState &state, bool &interrupted);
+#endif
 
 /**
  * @brief Task for playing audio
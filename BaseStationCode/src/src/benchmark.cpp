@@ -0,0 +1,114 @@
+/**
+ * @file benchmark.cpp
+ * @brief Measures how long device and field lookups take as the number of
+ * devices grows.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-03-08
+ */
+#include "benchmark.h"
+
+#ifdef BENCHMARK_LOOKUPS
+extern SemaphoreHandle_t serialMutex;
+
+void lookupBenchmark()
+{
+    const uint16_t sizes[] = {BENCHMARK_SIZES};
+    for (uint16_t size : sizes)
+    {
+        lookupBenchmarkSize(size);
+    }
+}
+
+void lookupBenchmarkSize(uint16_t deviceCount)
+{
+    // Every device shares the same fields, like a real fleet of identical
+    // nodes.
+    Field *fieldList[BENCHMARK_FIELDS];
+    for (uint8_t i = 0; i < BENCHMARK_FIELDS; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "Field%d", i);
+        fieldList[i] = new Field(strdup(name), 'A' + i, WIRE_U16);
+    }
+    LookupManager<Field> fields(fieldList, BENCHMARK_FIELDS);
+
+    Device **devices = new Device *[deviceCount];
+    for (uint16_t i = 0; i < deviceCount; i++)
+    {
+        char name[24];
+        snprintf(name, sizeof(name), "Benchmark Device %d", i);
+        devices[i] = new Device(strdup(name), 1 + i % (PJON_DEVICE_ID - 1), fields);
+    }
+    DeviceManager manager(devices, deviceCount);
+
+    // Pick the names in advance so only the lookups are timed.
+    const char **deviceNames = new const char *[BENCHMARK_ITERATIONS];
+    const char **fieldNames = new const char *[BENCHMARK_ITERATIONS];
+    char *symbols = new char[BENCHMARK_ITERATIONS];
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        Device *device = devices[esp_random() % deviceCount];
+        deviceNames[i] = device->name;
+        symbols[i] = device->symbol;
+        fieldNames[i] = fieldList[esp_random() % BENCHMARK_FIELDS]->name;
+    }
+
+    // RPC routing using the indexes.
+    uint32_t found = 0;
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        Device *device = manager.getWithName(deviceNames[i]);
+        found += device && device->fields.getWithName(fieldNames[i]);
+    }
+    int64_t rpcTime = esp_timer_get_time() - start;
+
+    // RPC routing by searching every device.
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        for (uint16_t j = 0; j < deviceCount; j++)
+        {
+            if (STRINGS_MATCH(devices[j]->name, deviceNames[i]))
+            {
+                found += devices[j]->fields.getWithName(fieldNames[i]) != NULL;
+                break;
+            }
+        }
+    }
+    int64_t linearTime = esp_timer_get_time() - start;
+
+    // Receiving packets.
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        found += manager.getWithSymbol(symbols[i]) != NULL;
+    }
+    int64_t symbolTime = esp_timer_get_time() - start;
+
+    LOGI("BENCHMARK", "%5d devices: RPC %6.2fus (linear %8.2fus), symbol %5.2fus per lookup (%lu found).",
+         deviceCount,
+         (float)rpcTime / BENCHMARK_ITERATIONS,
+         (float)linearTime / BENCHMARK_ITERATIONS,
+         (float)symbolTime / BENCHMARK_ITERATIONS,
+         found);
+
+    // Clean up.
+    delete[] deviceNames;
+    delete[] fieldNames;
+    delete[] symbols;
+    for (uint16_t i = 0; i < deviceCount; i++)
+    {
+        free((void *)devices[i]->name);
+        delete devices[i];
+    }
+    delete[] devices;
+    for (uint8_t i = 0; i < BENCHMARK_FIELDS; i++)
+    {
+        free((void *)fieldList[i]->name);
+        delete fieldList[i];
+    }
+}
+#endif
@@ -0,0 +1,35 @@
+/**
+ * @file benchmark.h
+ * @brief Measures how long device and field lookups take as the number of
+ * devices grows.
+ *
+ * Enabled with BENCHMARK_LOOKUPS. Runs once from setup() and logs the average
+ * time for the lookups done when routing an RPC call (device by name, then
+ * field by name) and when receiving a packet (device by symbol), using both
+ * the indexed managers and a plain linear search for comparison.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-03-08
+ */
+
+#pragma once
+#include "../defines.h"
+
+#ifdef BENCHMARK_LOOKUPS
+#include "devices.h"
+
+/**
+ * @brief Runs the benchmark for each size in BENCHMARK_SIZES and logs the
+ * results.
+ *
+ */
+void lookupBenchmark();
+
+/**
+ * @brief Runs the benchmark for a single number of devices.
+ *
+ * @param deviceCount the number of synthetic devices to create.
+ */
+void lookupBenchmarkSize(uint16_t deviceCount);
+#endif
@@ -0,0 +1,301 @@
+/**
+ * @file capture.cpp
+ * @brief Records received packets to a ring in flash so they can be downloaded
+ * over MQTT and replayed through pjonReceive later.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-03-22
+ */
+#include "capture.h"
+
+#ifdef PACKET_CAPTURE
+extern SemaphoreHandle_t serialMutex;
+extern SemaphoreHandle_t captureMutex;
+extern QueueHandle_t mqttPublishQueue;
+extern RxRing rxRing;
+
+CaptureHeader captureHeader; // Copy of the header in flash. Protected by captureMutex.
+CaptureReplayState captureReplay; // Only used from the receiving task once active.
+File captureFile; // Kept open. Protected by captureMutex.
+CaptureRecord captureBuffer[CAPTURE_WRITE_BATCH]; // Records not written to flash yet. Protected by captureMutex.
+uint8_t captureBuffered = 0;
+uint32_t captureBufferTime; // When the oldest record in captureBuffer was added.
+
+/**
+ * @brief Writes the in memory copy of the header to the start of the capture
+ * file. captureMutex must be held.
+ *
+ */
+static void captureWriteHeader()
+{
+    captureFile.seek(0);
+    captureFile.write((uint8_t *)&captureHeader, sizeof(captureHeader));
+}
+
+/**
+ * @brief Writes any buffered records and then the header, so the header only
+ * ever describes records that are in flash. captureMutex must be held.
+ *
+ */
+static void captureFlushLocked()
+{
+    if (!captureFile)
+    {
+        // Nowhere to put them (captureBegin() failed).
+        captureBuffered = 0;
+        return;
+    }
+    if (!captureBuffered)
+    {
+        return;
+    }
+
+    // Write as few runs as possible (two if the ring wraps around).
+    uint8_t written = 0;
+    while (written < captureBuffered)
+    {
+        uint8_t run = min((uint32_t)(captureBuffered - written), CAPTURE_SLOTS - captureHeader.next);
+        captureFile.seek(sizeof(CaptureHeader) + captureHeader.next * sizeof(CaptureRecord));
+        captureFile.write((uint8_t *)&captureBuffer[written], run * sizeof(CaptureRecord));
+        captureHeader.next = (captureHeader.next + run) % CAPTURE_SLOTS;
+        captureHeader.count = min(captureHeader.count + run, (uint32_t)CAPTURE_SLOTS);
+        written += run;
+    }
+    captureBuffered = 0;
+    captureWriteHeader();
+    captureFile.flush();
+}
+
+void captureBegin()
+{
+    // Check the existing capture matches this build.
+    captureFile = LittleFS.open(CAPTURE_PATH, "r+");
+    if (captureFile)
+    {
+        bool valid = captureFile.size() == sizeof(CaptureHeader) + CAPTURE_SLOTS * sizeof(CaptureRecord) &&
+                     captureFile.read((uint8_t *)&captureHeader, sizeof(captureHeader)) == sizeof(captureHeader) &&
+                     captureHeader.magic == CAPTURE_MAGIC &&
+                     captureHeader.recordSize == sizeof(CaptureRecord) &&
+                     captureHeader.slots == CAPTURE_SLOTS;
+        if (valid)
+        {
+            LOGI("CAPTURE", "Capture has %lu records, recording is %s.", captureHeader.count, captureHeader.enabled ? "on" : "off");
+            return;
+        }
+        captureFile.close();
+        LOGW("CAPTURE", "Capture file is invalid, recreating it.");
+    }
+
+    // Create an empty capture. The slots are written now so that records can
+    // be written anywhere later.
+    File file = LittleFS.open(CAPTURE_PATH, "w");
+    if (!file)
+    {
+        LOGE("CAPTURE", "Could not create " CAPTURE_PATH ".");
+        return;
+    }
+    captureHeader = {CAPTURE_MAGIC, sizeof(CaptureRecord), CAPTURE_SLOTS, 0, 0, false};
+    file.write((uint8_t *)&captureHeader, sizeof(captureHeader));
+    CaptureRecord empty = {};
+    for (uint16_t i = 0; i < CAPTURE_SLOTS; i++)
+    {
+        file.write((uint8_t *)&empty, sizeof(empty));
+    }
+    file.close();
+    captureFile = LittleFS.open(CAPTURE_PATH, "r+");
+    if (!captureFile)
+    {
+        LOGE("CAPTURE", "Could not open " CAPTURE_PATH ".");
+    }
+}
+
+void captureRecord(const uint8_t *payload, uint16_t length, const PJON_Packet_Info &packetInfo, int rssi, float snr, uint32_t time)
+{
+    if (!captureHeader.enabled || captureReplay.active)
+    {
+        return;
+    }
+
+    // Add it to the buffer and only write to flash once there are a few, as
+    // each write also has to update the file system.
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    if (!captureBuffered)
+    {
+        captureBufferTime = millis();
+    }
+    CaptureRecord &record = captureBuffer[captureBuffered++];
+    record = {};
+    record.time = time;
+    record.tx = packetInfo.tx.id;
+    record.rx = packetInfo.rx.id;
+    record.rssi = rssi;
+    record.snr = constrain(snr * 4, INT8_MIN, INT8_MAX);
+    record.length = min(length, (uint16_t)CAPTURE_PAYLOAD_SIZE);
+    memcpy(record.payload, payload, record.length);
+    if (captureBuffered == CAPTURE_WRITE_BATCH || millis() - captureBufferTime >= CAPTURE_FLUSH_INTERVAL)
+    {
+        captureFlushLocked();
+    }
+    xSemaphoreGive(captureMutex);
+}
+
+void captureFlush()
+{
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    captureFlushLocked();
+    xSemaphoreGive(captureMutex);
+}
+
+void captureSetEnabled(bool enable, bool clear)
+{
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    if (clear)
+    {
+        captureBuffered = 0;
+        captureHeader.next = 0;
+        captureHeader.count = 0;
+    }
+    captureFlushLocked();
+    captureHeader.enabled = enable;
+    if (captureFile)
+    {
+        captureWriteHeader();
+        captureFile.flush();
+    }
+    xSemaphoreGive(captureMutex);
+    LOGI("CAPTURE", "Recording %s%s.", enable ? "on" : "off", clear ? " and cleared" : "");
+}
+
+bool captureEnabled()
+{
+    return captureHeader.enabled;
+}
+
+uint32_t captureCount()
+{
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    captureFlushLocked();
+    uint32_t count = captureHeader.count;
+    xSemaphoreGive(captureMutex);
+    return count;
+}
+
+uint8_t captureRead(uint32_t offset, CaptureRecord *records, uint8_t maxRecords)
+{
+    uint8_t read = 0;
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    captureFlushLocked();
+    if (captureFile)
+    {
+        // Read the records in as few runs as possible (two if the ring wraps).
+        while (read < maxRecords && offset + read < captureHeader.count)
+        {
+            uint32_t slot = captureSlot(captureHeader, offset + read);
+            uint32_t run = min(min((uint32_t)(maxRecords - read), captureHeader.count - offset - read), CAPTURE_SLOTS - slot);
+            captureFile.seek(sizeof(CaptureHeader) + slot * sizeof(CaptureRecord));
+            size_t bytes = captureFile.read((uint8_t *)&records[read], run * sizeof(CaptureRecord));
+            read += bytes / sizeof(CaptureRecord);
+            if (bytes != run * sizeof(CaptureRecord))
+            {
+                break;
+            }
+        }
+    }
+    xSemaphoreGive(captureMutex);
+    return read;
+}
+
+uint32_t captureReplayStart(float speed)
+{
+    if (captureReplay.active)
+    {
+        LOGW("CAPTURE", "Already replaying.");
+        return 0;
+    }
+    captureReplay.index = 0;
+    captureReplay.total = captureCount();
+    captureReplay.startTime = millis();
+    captureReplay.clock.start(captureReplay.startTime, speed);
+    captureReplay.timed = false;
+    captureReplay.buffered = 0;
+    captureReplay.position = 0;
+    captureReplay.dropped = 0;
+    captureReplay.ringDropped = rxRing.dropped;
+    captureReplay.active = captureReplay.total != 0; // Set last as this starts the replay.
+    LOGI("CAPTURE", "Replaying %lu records at %.1fx.", captureReplay.total, speed);
+    return captureReplay.total;
+}
+
+void captureReplayPoll()
+{
+    // Only replay a few records each time so the radio still gets serviced.
+    for (uint8_t i = 0; i < CAPTURE_REPLAY_BATCH && captureReplay.active; i++)
+    {
+        // Read the next few records from flash once the last lot is used up.
+        if (captureReplay.position == captureReplay.buffered && captureReplay.index < captureReplay.total)
+        {
+            uint32_t remaining = captureReplay.total - captureReplay.index;
+            captureReplay.buffered = captureRead(captureReplay.index, captureReplay.records, min(remaining, (uint32_t)CAPTURE_REPLAY_READ));
+            captureReplay.position = 0;
+            if (!captureReplay.buffered)
+            {
+                captureReplay.total = captureReplay.index; // Ended early.
+            }
+        }
+
+        if (captureReplay.position < captureReplay.buffered)
+        {
+            CaptureRecord &record = captureReplay.records[captureReplay.position];
+            if (!captureReplay.timed)
+            {
+                captureReplay.due = captureReplay.clock.next(record.time);
+                captureReplay.timed = true;
+            }
+
+            // Replay it if it is time and the decoder has room. Waiting for
+            // the decoder rather than dropping means each record is decoded
+            // once.
+            if ((int32_t)(millis() - captureReplay.due) < 0 || rxRing.full())
+            {
+                return;
+            }
+            PJON_Packet_Info info;
+            info.tx.id = record.tx;
+            info.rx.id = record.rx;
+            if (!pjonReceive(record.payload, record.length, info, record.rssi, record.snr / 4.0, RX_REPLAYED))
+            {
+                captureReplay.dropped++;
+            }
+            captureReplay.index++;
+            captureReplay.position++;
+            captureReplay.timed = false;
+        }
+
+        // Finished once everything has been decoded, so the time is for the
+        // whole pipeline and not just filling the ring.
+        if (captureReplay.index >= captureReplay.total)
+        {
+            if (!rxRing.empty())
+            {
+                return;
+            }
+            uint32_t duration = millis() - captureReplay.startTime;
+            uint32_t ringDropped = rxRing.dropped - captureReplay.ringDropped;
+            LOGI("CAPTURE", "Replayed %lu records in %lums (%lu dropped).", captureReplay.index, duration, ringDropped);
+            LocalArena<JSON_ARENA_SMALL_SIZE> arena;
+            JsonDocument json(&arena);
+            json["replayPackets"] = captureReplay.index - captureReplay.dropped;
+            json["replayMs"] = duration;
+            json["replayDropped"] = ringDropped; // Includes any live packets dropped meanwhile.
+            MqttMsg msg{Topic::TELEMETRY_ME_UPLOAD, ""};
+            serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
+            if (xQueueSend(mqttPublishQueue, (void *)&msg, 0) != pdTRUE)
+            {
+                LOGW("CAPTURE", "Publish queue full. Replay results not sent.");
+            }
+            captureReplay.active = false;
+        }
+    }
+}
+#endif
@@ -0,0 +1,135 @@
+/**
+ * @file capture.h
+ * @brief Records received packets to a ring in flash so they can be downloaded
+ * over MQTT and replayed through pjonReceive later.
+ *
+ * Enabled with PACKET_CAPTURE. The capture is stored in CAPTURE_PATH in the
+ * format described in capturerecord.h, with CAPTURE_SLOTS records. Once full,
+ * the oldest records are overwritten.
+ *
+ * The file is kept open. Records are collected in RAM and written
+ * CAPTURE_WRITE_BATCH at a time (or once the oldest has waited
+ * CAPTURE_FLUSH_INTERVAL), followed by the header, so the header in flash only
+ * counts records that have been written. Up to a batch can be lost if the
+ * power goes.
+ *
+ * RPC methods (to the base station itself):
+ * - `capture` with `{"enable": true/false, "clear": true/false}` starts or
+ *   stops recording (remembered across restarts) and optionally clears it.
+ * - `captureRead` with `{"offset": n}` returns up to CAPTURE_READ_RECORDS raw
+ *   records from n as base64 in `data`, along with the `total` available.
+ * - `captureReplay` with `{"speed": x}` feeds the capture back through
+ *   pjonReceive at x times the original speed, or as fast as possible if x is
+ *   0. The number of packets, time taken and packets dropped by the RX ring
+ *   are published when finished, so a capture of real traffic doubles as a
+ *   throughput benchmark.
+ *
+ * Replayed packets are not recorded again and skip the duplicate filter, as
+ * replaying faster than real time makes repeated readings look like
+ * retransmissions. A replay waits for room in the RX ring rather than
+ * overflowing it.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-03-22
+ */
+
+#pragma once
+#include "../defines.h"
+
+#ifdef PACKET_CAPTURE
+#include "lora.h"
+#include "capturerecord.h"
+
+/**
+ * @brief State of a replay in progress.
+ *
+ */
+struct CaptureReplayState
+{
+    volatile bool active;
+    uint32_t index; // Next record to replay.
+    uint32_t total;
+    uint32_t startTime;
+    CaptureReplayClock clock;
+    uint32_t due; // When the current record should be replayed.
+    bool timed; // Whether due is set for the current record.
+    uint32_t dropped; // Records the RX ring refused (too long).
+    uint32_t ringDropped; // rxRing.dropped at the start.
+    CaptureRecord records[CAPTURE_REPLAY_READ]; // Read from flash a few at a time.
+    uint8_t buffered; // Number of records in records.
+    uint8_t position; // Current record in records.
+};
+
+/**
+ * @brief Opens the capture file, creating it if needed. LittleFS must be
+ * mounted and captureMutex created first.
+ *
+ */
+void captureBegin();
+
+/**
+ * @brief Records a received packet if capturing is enabled and not replaying.
+ *
+ * @param payload the packet payload.
+ * @param length the length of the payload.
+ * @param packetInfo the PJON packet info.
+ * @param rssi the RSSI of the packet.
+ * @param snr the SNR of the packet.
+ * @param time when the packet was received in ms.
+ */
+void captureRecord(const uint8_t *payload, uint16_t length, const PJON_Packet_Info &packetInfo, int rssi, float snr, uint32_t time);
+
+/**
+ * @brief Writes any records that are still waiting in RAM to flash. Called by
+ * the decoder task when no packets have arrived for a while.
+ *
+ */
+void captureFlush();
+
+/**
+ * @brief Enables or disables recording.
+ *
+ * @param enable whether to record packets.
+ * @param clear whether to discard everything recorded so far.
+ */
+void captureSetEnabled(bool enable, bool clear);
+
+/**
+ * @brief Returns whether recording is enabled.
+ *
+ */
+bool captureEnabled();
+
+/**
+ * @brief Returns the number of records available.
+ *
+ */
+uint32_t captureCount();
+
+/**
+ * @brief Reads records from the capture.
+ *
+ * @param offset the first record to read (0 is the oldest).
+ * @param records where to put the records.
+ * @param maxRecords the maximum number of records to read.
+ * @return uint8_t the number of records read.
+ */
+uint8_t captureRead(uint32_t offset, CaptureRecord *records, uint8_t maxRecords);
+
+/**
+ * @brief Starts replaying the capture from the task that receives packets.
+ *
+ * @param speed the speed multiplier, or 0 to replay as fast as possible.
+ * @return uint32_t the number of records that will be replayed.
+ */
+uint32_t captureReplayStart(float speed);
+
+/**
+ * @brief Replays up to CAPTURE_REPLAY_BATCH records that are due. Called from
+ * the loop of the task that receives packets so that pjonReceive is only ever
+ * called from one task. Never waits.
+ *
+ */
+void captureReplayPoll();
+#endif
@@ -0,0 +1,181 @@
+/**
+ * @file clip.cpp
+ * @brief Reads audio clips (WAV files) from flash as 8 bit samples for the DAC.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-04-19
+ */
+#include "clip.h"
+
+#ifdef AUDIO_DAC
+extern SemaphoreHandle_t serialMutex;
+
+// IMA ADPCM tables.
+static const int8_t adpcmIndexTable[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+static const uint16_t adpcmStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767};
+
+bool ClipReader::open(const char *path)
+{
+    m_file = LittleFS.open(path, "r");
+    if (!m_file)
+    {
+        return false;
+    }
+
+    // RIFF header.
+    char id[4];
+    uint32_t size;
+    if (m_file.read((uint8_t *)id, 4) != 4 || memcmp(id, "RIFF", 4) ||
+        m_file.read((uint8_t *)&size, 4) != 4 ||
+        m_file.read((uint8_t *)id, 4) != 4 || memcmp(id, "WAVE", 4))
+    {
+        LOGW("CLIP", "'%s' is not a WAV file.", path);
+        close();
+        return false;
+    }
+
+    // Find the format and data chunks.
+    bool haveFormat = false;
+    while (m_file.read((uint8_t *)id, 4) == 4 && m_file.read((uint8_t *)&size, 4) == 4)
+    {
+        if (!memcmp(id, "fmt ", 4))
+        {
+            uint16_t channels;
+            uint32_t byteRate;
+            m_file.read((uint8_t *)&m_format, 2);
+            m_file.read((uint8_t *)&channels, 2);
+            m_file.read((uint8_t *)&sampleRate, 4);
+            m_file.read((uint8_t *)&byteRate, 4);
+            m_file.read((uint8_t *)&m_blockAlign, 2);
+            m_file.read((uint8_t *)&m_bitsPerSample, 2);
+            bool pcm = m_format == WAV_FORMAT_PCM && (m_bitsPerSample == 8 || m_bitsPerSample == 16);
+            bool adpcm = m_format == WAV_FORMAT_IMA_ADPCM && m_bitsPerSample == 4 &&
+                         m_blockAlign > 4 && m_blockAlign <= AUDIO_ADPCM_BLOCK_MAX;
+            if (channels != 1 || !(pcm || adpcm))
+            {
+                LOGW("CLIP", "'%s' is not mono 8 or 16 bit PCM or IMA ADPCM.", path);
+                close();
+                return false;
+            }
+            haveFormat = true;
+            m_file.seek(size - 16, SeekCur);
+        }
+        else if (!memcmp(id, "data", 4))
+        {
+            if (!haveFormat)
+            {
+                break;
+            }
+            m_remaining = size;
+            m_blockLength = 0;
+            m_blockPosition = 0;
+            return true;
+        }
+        else
+        {
+            m_file.seek(size, SeekCur);
+        }
+        if (size & 1)
+        {
+            m_file.seek(1, SeekCur); // Chunks are padded to an even length.
+        }
+    }
+    LOGW("CLIP", "'%s' has no audio.", path);
+    close();
+    return false;
+}
+
+size_t ClipReader::read(uint8_t *samples, size_t maxSamples)
+{
+    size_t count = 0;
+    if (m_format == WAV_FORMAT_IMA_ADPCM)
+    {
+        int16_t sample;
+        while (count < maxSamples && m_readAdpcm(sample))
+        {
+            samples[count++] = (sample >> 8) + 128;
+        }
+    }
+    else if (m_bitsPerSample == 8)
+    {
+        // Already in the right format.
+        count = m_file.read(samples, min(maxSamples, (size_t)m_remaining));
+        m_remaining -= count;
+    }
+    else
+    {
+        // Keep the most significant byte of each sample, reading in place.
+        size_t bytes = m_file.read(samples, min(maxSamples, (size_t)m_remaining) & ~1);
+        m_remaining -= bytes;
+        for (; count < bytes / 2; count++)
+        {
+            samples[count] = (int8_t)samples[count * 2 + 1] + 128;
+        }
+    }
+    return count;
+}
+
+bool ClipReader::m_readAdpcm(int16_t &sample)
+{
+    // Load the next block.
+    if (m_blockPosition == 0 || m_blockPosition == 2 * m_blockLength - 7)
+    {
+        if (m_remaining == 0)
+        {
+            return false;
+        }
+        m_blockLength = m_file.read(m_block, min((uint32_t)m_blockAlign, m_remaining));
+        m_remaining = m_blockLength < 4 ? 0 : m_remaining - m_blockLength;
+        if (m_blockLength < 4)
+        {
+            return false;
+        }
+
+        // The header has the first sample and step index.
+        m_predictor = (int16_t)(m_block[0] | m_block[1] << 8);
+        m_index = constrain((int8_t)m_block[2], 0, 88);
+        m_blockPosition = 1;
+        sample = m_predictor;
+        return true;
+    }
+
+    // Each following byte has 2 samples, the first in the low nibble.
+    uint16_t nibbleIndex = m_blockPosition - 1;
+    uint8_t byte = m_block[4 + nibbleIndex / 2];
+    uint8_t nibble = nibbleIndex & 1 ? byte >> 4 : byte & 0x0f;
+    m_blockPosition++;
+
+    int32_t step = adpcmStepTable[m_index];
+    int32_t difference = step >> 3;
+    if (nibble & 1)
+    {
+        difference += step >> 2;
+    }
+    if (nibble & 2)
+    {
+        difference += step >> 1;
+    }
+    if (nibble & 4)
+    {
+        difference += step;
+    }
+    m_predictor += nibble & 8 ? -difference : difference;
+    m_predictor = constrain(m_predictor, -32768, 32767);
+    m_index = constrain(m_index + adpcmIndexTable[nibble], 0, 88);
+    sample = m_predictor;
+    return true;
+}
+
+void ClipReader::close()
+{
+    m_file.close();
+}
+#endif
@@ -0,0 +1,75 @@
+/**
+ * @file clip.h
+ * @brief Reads audio clips (WAV files) from flash as 8 bit samples for the DAC.
+ *
+ * Mono WAV files with 8 bit unsigned PCM, 16 bit signed PCM or 4 bit IMA ADPCM
+ * samples are supported. ADPCM is a quarter the size of 16 bit PCM, so is the
+ * best choice for longer clips. For example, to convert a file with ffmpeg:
+ * `ffmpeg -i siren.mp3 -ac 1 -ar 16000 -acodec adpcm_ima_wav alarm.wav`
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-04-19
+ */
+#pragma once
+#include "../defines.h"
+
+#ifdef AUDIO_DAC
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_IMA_ADPCM 0x11
+
+/**
+ * @brief Reads and decodes a clip a chunk at a time.
+ *
+ */
+class ClipReader
+{
+public:
+    /**
+     * @brief Opens a clip and reads the header.
+     *
+     * @param path the path of the WAV file.
+     * @return true if the clip can be played.
+     */
+    bool open(const char *path);
+
+    /**
+     * @brief Reads the next samples.
+     *
+     * @param samples where to write the samples (8 bit unsigned, 128 is silence).
+     * @param maxSamples the size of samples.
+     * @return the number of samples read, 0 at the end of the clip.
+     */
+    size_t read(uint8_t *samples, size_t maxSamples);
+
+    /**
+     * @brief Closes the file.
+     *
+     */
+    void close();
+
+    uint32_t sampleRate;
+
+private:
+    /**
+     * @brief Reads the next ADPCM sample, loading the next block if needed.
+     *
+     * @param sample set to the sample.
+     * @return true if there was a sample.
+     */
+    bool m_readAdpcm(int16_t &sample);
+
+    File m_file;
+    uint16_t m_format;
+    uint16_t m_bitsPerSample;
+    uint16_t m_blockAlign;
+    uint32_t m_remaining; // Bytes left in the data chunk.
+
+    // ADPCM decoder state.
+    int32_t m_predictor;
+    int8_t m_index;
+    uint16_t m_blockLength;
+    uint16_t m_blockPosition; // Nibble in the block (the header counts as the first sample).
+    uint8_t m_block[AUDIO_ADPCM_BLOCK_MAX];
+};
+#endif
@@ -0,0 +1,42 @@
+/**
+ * @file dedup.cpp
+ * @brief Drops repeated receptions of the same packet (retransmissions and
+ * multipath) before they are decoded and published again.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-03-15
+ */
+#include "dedup.h"
+
+bool DuplicateFilter::isDuplicate(uint8_t sender, const uint8_t *payload, uint16_t length, uint32_t time)
+{
+    checked++;
+    uint32_t hash = hashPacket(sender, payload, length);
+    for (uint8_t i = 0; i < DEDUP_CACHE_SIZE; i++)
+    {
+        DedupEntry &entry = m_entries[i];
+        if (entry.used && entry.hash == hash && time - entry.time < DEDUP_WINDOW)
+        {
+            // Seen recently. Keep the original time so that a genuinely
+            // repeated reading after the window is still published.
+            hits++;
+            return true;
+        }
+    }
+
+    // New packet, replace the oldest entry.
+    m_entries[m_next] = {hash, time, true};
+    m_next = (m_next + 1) % DEDUP_CACHE_SIZE;
+    return false;
+}
+
+uint32_t DuplicateFilter::hashPacket(uint8_t sender, const uint8_t *payload, uint16_t length)
+{
+    uint32_t hash = (2166136261 ^ sender) * 16777619;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ payload[i]) * 16777619;
+    }
+    return hash;
+}
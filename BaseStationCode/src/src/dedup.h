@@ -0,0 +1,61 @@
+/**
+ * @file dedup.h
+ * @brief Drops repeated receptions of the same packet (retransmissions and
+ * multipath) before they are decoded and published again.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-03-15
+ */
+
+#pragma once
+#include "../defines.h"
+
+/**
+ * @brief A recently received packet.
+ *
+ */
+struct DedupEntry
+{
+    uint32_t hash;
+    uint32_t time;
+    bool used;
+};
+
+/**
+ * @brief Fixed size cache of recently received packets. Not thread safe, so
+ * should only be used from the task receiving packets. The counters can be
+ * read from elsewhere.
+ *
+ */
+class DuplicateFilter
+{
+public:
+    /**
+     * @brief Checks if a packet with the same sender and payload was received
+     * in the DEDUP_WINDOW ms before it. If not, the packet is added to the
+     * cache.
+     *
+     * @param sender the PJON id of the sender.
+     * @param payload the packet payload.
+     * @param length the length of the payload.
+     * @param time when the packet was received in ms. Using this rather than
+     * the time it is checked means a backlog in the decoder doesn't change
+     * what counts as a duplicate.
+     * @return true if the packet is a duplicate and should be dropped.
+     */
+    bool isDuplicate(uint8_t sender, const uint8_t *payload, uint16_t length, uint32_t time);
+
+    uint32_t checked = 0;
+    uint32_t hits = 0;
+
+private:
+    /**
+     * @brief Hashes the sender and payload using 32 bit FNV-1a.
+     *
+     */
+    static uint32_t hashPacket(uint8_t sender, const uint8_t *payload, uint16_t length);
+
+    DedupEntry m_entries[DEDUP_CACHE_SIZE] = {};
+    uint8_t m_next = 0;
+};
@@ -8,10 +8,14 @@
  * @date 2023-08-12
  */
 #include "devices.h"
+#include "networking.h"
 
 extern SemaphoreHandle_t serialMutex;
 extern SemaphoreHandle_t mqttMutex;
 extern PubSubClient mqtt;
+extern StaticArena<JSON_ARENA_SIZE> networkingArena;
+extern TaskHandle_t ledTaskHandle;
+extern TaskHandle_t loraTxTaskHandle;
 
 DecodeResult Device::decodePacketFields(uint8_t *payload, uint8_t length, JsonDocument &json)
 {
@@ -42,6 +46,14 @@ DecodeResult Device::decodePacketFields(uint8_t *payload, uint8_t length, JsonDo
             {
                 // Successfully got the field. Account for the space taken up by the value.
                 i += result;
+
+                // Stop sending once the device reports the value that was set.
+                // Checked again under the lock in case an RPC just changed it.
+                // TODO: Some way to know when a flag has been successfully sent and received.
+                if (field->txRequired && manager && field->settled())
+                {
+                    manager->setFieldPending(this, field, false, true);
+                }
             }
             else
             {
@@ -78,17 +90,15 @@ DecodeResult Device::decodePacketFields(uint8_t *payload, uint8_t length, JsonDo
 
 bool Device::rpcWaiting()
 {
-    // For each field, check if it needs to be transmitted.
-    for (uint8_t i = 0; i < fields.count; i++)
+    return pendingFields != 0;
+}
+
+void Device::handleRpc(Field *field, JsonObject &data, JsonObject &replyData)
+{
+    if (field->handleRpc(data, replyData) && manager)
     {
-        if (fields.items[i]->txRequired)
-        {
-            return true;
-        }
+        manager->setFieldPending(this, field, true);
     }
-
-    // Nothing needs to be transmitted.
-    return false;
 }
 
 int8_t Device::generatePacket(uint8_t *payload, uint8_t maxLength)
@@ -118,37 +128,208 @@ int8_t Device::generatePacket(uint8_t *payload, uint8_t maxLength)
     return length;
 }
 
+void Device::addKeyMap(JsonObject attributes)
+{
+    JsonObject keyMap = attributes["keyMap"].to<JsonObject>();
+    for (uint8_t i = 0; i < fields.count; i++)
+    {
+        keyMap[fields.items[i]->compactKey] = fields.items[i]->name;
+    }
+}
+
+void Device::measureKeys(JsonDocument &json, size_t &fullLength, size_t &compactLength)
+{
+    // Each field's key is either its name or its symbol. SNR and RSSI are the
+    // same both ways.
+    size_t difference = 0;
+    JsonObjectConst values = json[name][0];
+    for (JsonPairConst pair : values)
+    {
+        Field *field = fields.getWithName(pair.key().c_str());
+        if (!field && pair.key().c_str()[0] && !pair.key().c_str()[1])
+        {
+            field = fields.getWithSymbol(pair.key().c_str()[0]);
+        }
+        if (field)
+        {
+            difference += strlen(field->name) - 1;
+        }
+    }
+    size_t length = measureJson(json);
+#ifdef COMPACT_TELEMETRY_KEYS
+    fullLength = length + difference;
+    compactLength = length;
+#else
+    fullLength = length;
+    compactLength = length - difference;
+#endif
+}
+
 void DeviceManager::connectDevices()
 {
+#ifdef COMPACT_TELEMETRY_KEYS
+    // Thingsboard keeps the key maps, so they only need publishing again when
+    // a new registry changes them.
+    uint32_t hash = keyMapHash();
+    Preferences preferences;
+    preferences.begin(KEY_MAP_NAMESPACE, false);
+    bool publishKeyMaps = preferences.getUInt("hash", 0) != hash;
+    bool keyMapsSent = true;
+#endif
+
     // For each device, connect it.
-    for (uint8_t i = 0; i < count; i++)
+    for (uint16_t i = 0; i < count; i++)
     {
         // Generate a json object with everything required.
-        JsonDocument json;
+        ArenaScope scope(networkingArena);
+        JsonDocument json(&networkingArena);
         json["device"] = items[i]->name;
-        char charBuff[MAX_JSON_TEXT_LENGTH];
-        serializeJson(json, charBuff, sizeof(charBuff));
 
         // Do the sending.
         xSemaphoreTake(mqttMutex, portMAX_DELAY);
-        LOGI("DEVICES", "Registering %s", charBuff);
-        mqtt.publish(Topic::DEVICE_CONNECT, charBuff);
+        LOGI("DEVICES", "Registering '%s'", items[i]->name);
+        mqttPublishJson(Topic::DEVICE_CONNECT, json);
         xSemaphoreGive(mqttMutex);
+
+#ifdef COMPACT_TELEMETRY_KEYS
+        // Let dashboards translate the compact keys back to names.
+        if (publishKeyMaps)
+        {
+            JsonDocument attributes(&networkingArena);
+            items[i]->addKeyMap(attributes[items[i]->name].to<JsonObject>());
+            xSemaphoreTake(mqttMutex, portMAX_DELAY);
+            keyMapsSent &= mqttPublishJson(Topic::ATTRIBUTE_GATEWAY_UPLOAD, attributes);
+            xSemaphoreGive(mqttMutex);
+        }
+#endif
+    }
+
+#ifdef COMPACT_TELEMETRY_KEYS
+    // Try again next time if any didn't make it.
+    if (publishKeyMaps && keyMapsSent)
+    {
+        LOGI("DEVICES", "Published the key maps.");
+        preferences.putUInt("hash", hash);
+    }
+    preferences.end();
+#endif
+}
+
+/**
+ * @brief Adds a string to a 32 bit FNV-1a hash. The terminator is included so
+ * that strings can't run together.
+ *
+ */
+static uint32_t hashString(uint32_t hash, const char *text)
+{
+    do
+    {
+        hash = (hash ^ (uint8_t)*text) * 16777619;
+    } while (*text++);
+    return hash;
+}
+
+uint32_t DeviceManager::keyMapHash()
+{
+    uint32_t hash = 2166136261;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        hash = hashString(hash, items[i]->name);
+        for (uint8_t j = 0; j < items[i]->fields.count; j++)
+        {
+            hash = hashString(hash, items[i]->fields.items[j]->compactKey);
+            hash = hashString(hash, items[i]->fields.items[j]->name);
+        }
     }
+    return hash;
 }
 
-uint8_t DeviceManager::txRequired()
+int32_t DeviceManager::nextPending(uint16_t start)
 {
-    uint8_t tx_count = 0;
-    // For each device, check if it needs to send a packet.
-    for (uint8_t i = 0; i < count; i++)
+    if (!pendingCount)
     {
-        if (items[i]->rpcWaiting())
+        return -1;
+    }
+
+    // Check each word of the bitmap, starting part way through the first.
+    uint16_t words = (count + 31) / 32;
+    uint16_t word = start < count ? start / 32 : 0;
+    uint32_t mask = start < count ? UINT32_MAX << (start % 32) : UINT32_MAX;
+    for (uint16_t i = 0; i <= words; i++)
+    {
+        uint32_t bits = pendingBitmap[word] & mask;
+        if (bits)
         {
-            // Transmission waiting
-            tx_count++;
+            return word * 32 + __builtin_ctz(bits);
         }
+
+        // Wrap around, coming back to the bits skipped at the start.
+        mask = UINT32_MAX;
+        word = (word + 1) % words;
     }
+    return -1;
+}
 
-    return tx_count;
+void DeviceManager::setFieldPending(Device *device, Field *field, bool required, bool ifSettled)
+{
+    bool changed = false;
+    portENTER_CRITICAL(&pendingLock);
+    if (field->txRequired != required && (!ifSettled || field->settled()))
+    {
+        field->txRequired = required;
+        if (required)
+        {
+            changed = device->pendingFields++ == 0;
+        }
+        else
+        {
+            changed = --device->pendingFields == 0;
+        }
+
+        if (changed)
+        {
+            uint32_t bit = 1UL << (device->index % 32);
+            if (required)
+            {
+                pendingBitmap[device->index / 32] |= bit;
+                pendingCount++;
+            }
+            else
+            {
+                pendingBitmap[device->index / 32] &= ~bit;
+                pendingCount--;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&pendingLock);
+
+    if (changed)
+    {
+        // Something to send or nothing left to send.
+        if (loraTxTaskHandle)
+        {
+            xTaskNotifyGive(loraTxTaskHandle);
+        }
+        if (ledTaskHandle)
+        {
+            xTaskNotifyGive(ledTaskHandle);
+        }
+    }
+}
+
+void DeviceManager::buildPending()
+{
+    delete[] pendingBitmap;
+    pendingBitmap = new uint32_t[(count + 31) / 32]();
+    pendingCount = 0;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        items[i]->manager = this;
+        items[i]->index = i;
+        items[i]->pendingFields = 0;
+        for (uint8_t j = 0; j < items[i]->fields.count; j++)
+        {
+            items[i]->fields.items[j]->txRequired = false;
+        }
+    }
 }
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include "../defines.h"
 #include "lookups.h"
 #include "fields.h"
+#include "arena.h"
 
 /**
  * @brief List of statuses to return when decoding packets.
@@ -18,6 +19,8 @@
  */
 enum DecodeResult {DECODE_SUCCESS, DECODE_PARTIAL, DECODE_FAIL};
 
+class DeviceManager;
+
 /**
  * @brief Each sensor / device on the PJON network.
  *
@@ -54,6 +57,16 @@ public:
      */
     bool rpcWaiting();
 
+    /**
+     * @brief Handles an RPC call for one of this device's fields and marks it
+     * as waiting to be transmitted if needed.
+     *
+     * @param field the field to set.
+     * @param data the RPC request.
+     * @param replyData the object to put the reply in.
+     */
+    void handleRpc(Field *field, JsonObject &data, JsonObject &replyData);
+
     /**
      * @brief Generates a packet containing all the fields and instructions to set.
      * 
@@ -63,29 +76,120 @@ public:
      */
     int8_t generatePacket(uint8_t *payload, uint8_t maxLength);
 
+    /**
+     * @brief Adds the mapping from compact keys to field names to an attributes
+     * object.
+     *
+     * @param attributes the object to add to.
+     */
+    void addKeyMap(JsonObject attributes);
+
+    /**
+     * @brief Measures a decoded reading as it would be serialised with full
+     * names and with compact keys as keys. Only the keys differ, so this is
+     * worked out from the one actually used rather than serialising twice.
+     *
+     * @param json the document produced by decodePacketFields().
+     * @param fullLength set to the length with field names as keys.
+     * @param compactLength set to the length with field symbols as keys.
+     */
+    void measureKeys(JsonDocument &json, size_t &fullLength, size_t &compactLength);
+
     LookupManager<Field> &fields;
+
+    // Set by the DeviceManager this device belongs to.
+    DeviceManager *manager = NULL;
+    uint16_t index = 0;
+    uint8_t pendingFields = 0; // Fields with txRequired set.
 };
 
 /**
  * @brief Class for managing all devices
  *
+ * Keeps a bitmap of the devices that have fields waiting to be transmitted so
+ * that checking whether anything needs to be sent doesn't have to look at
+ * every field. Changes to txRequired must go through setFieldPending() to keep
+ * this up to date.
  */
 class DeviceManager : public LookupManager<Device>
 {
 public:
-    DeviceManager(Device **items, uint8_t count) : LookupManager(items, count) {}
+    DeviceManager(Device **items, uint16_t count) : LookupManager(items, count)
+    {
+        buildPending();
+    }
+
+    ~DeviceManager()
+    {
+        delete[] pendingBitmap;
+    }
+
+    /**
+     * @brief Replaces the devices being managed. Not thread safe, so should
+     * only be used before other tasks start.
+     *
+     */
+    void setItems(Device **newItems, uint16_t newCount)
+    {
+        LookupManager::setItems(newItems, newCount);
+        buildPending();
+    }
 
     /**
-     * @brief Registers each device to Thingsboard over MQTT.
+     * @brief Registers each device to Thingsboard over MQTT. With
+     * COMPACT_TELEMETRY_KEYS, each device's keyMap attribute is also
+     * published, but only when it differs from the last one published
+     * (Thingsboard keeps attributes between connections).
      *
      */
     void connectDevices();
 
+    /**
+     * @brief Hashes every device name and field key and name using 32 bit
+     * FNV-1a, so changes to the key maps can be detected.
+     *
+     */
+    uint32_t keyMapHash();
+
     /**
      * @brief Returns the number of packets that need to be sent across all
      * devices.
      * 
-     * @return uint8_t 
+     * @return uint16_t 
+     */
+    uint16_t txRequired() { return pendingCount; }
+
+    /**
+     * @brief Finds the next device that needs a packet sent.
+     *
+     * @param start the index to start searching from (wraps around).
+     * @return int32_t the index of the device or -1 if none are waiting.
      */
-    uint8_t txRequired();
+    int32_t nextPending(uint16_t start);
+
+    /**
+     * @brief Sets whether a field needs to be transmitted, updating the count
+     * for its device and the pending bitmap. The LED and LoRa TX tasks are
+     * notified when a device starts or stops waiting.
+     *
+     * @param device the device the field belongs to.
+     * @param field the field.
+     * @param required whether the field needs to be transmitted.
+     * @param ifSettled only clear txRequired if the field is still settled
+     * once the lock is held. Device::handleRpc() changes setValue before
+     * setting the field as pending, so a new value set while a packet is
+     * decoded is never lost.
+     */
+    void setFieldPending(Device *device, Field *field, bool required, bool ifSettled = false);
+
+private:
+    /**
+     * @brief Allocates the bitmap and gives each device its index.
+     *
+     */
+    void buildPending();
+
+    uint32_t *pendingBitmap = NULL;
+    volatile uint16_t pendingCount = 0;
+    portMUX_TYPE pendingLock = portMUX_INITIALIZER_UNLOCKED;
 };
\ No newline at end of file
@@ -17,140 +17,89 @@ char Field::writeSymbol()
     return symbol | 0x80;
 }
 
-int8_t Field::decode(uint8_t *bytes, uint8_t length, JsonObject &json)
+uint8_t Field::wireLength(FieldWireType wireType)
 {
-    if (checkDecodeable(length))
+    switch (wireType)
     {
-        return actuallyDecode(bytes, length, json);
+    case WIRE_U8:
+    case WIRE_I8:
+        return 1;
+    case WIRE_U16:
+    case WIRE_I16:
+        return 2;
+    case WIRE_U32:
+        return 4;
+    case WIRE_FLAG:
+    default:
+        return 0;
     }
-    return FIELD_NO_MEMORY;
-}
-
-int8_t Field::encode(uint8_t *bytes, uint8_t length)
-{
-    return 0;
 }
 
-void Field::handleRpc(JsonObject &data, JsonObject &replyData)
-{
-}
-
-template <typename T>
-void SettableField<T>::setTxRequired()
+int8_t Field::decode(uint8_t *bytes, uint8_t length, JsonObject &json)
 {
-    if (setValue == curValue)
+    if (!checkDecodeable(length))
     {
-        // Mission accomplished
-        txRequired = false;
+        return FIELD_NO_MEMORY;
     }
-}
 
-template <typename T>
-void SettableField<T>::handleRpc(JsonObject &data, JsonObject &replyData)
-{
-    T candidate = data["params"];
-    if (isValidNewValue(candidate))
+    // Convert and save to json
+    int64_t value = readValue(bytes);
+    if (scale == SCALE_NONE)
     {
-        setValue = candidate;
-        txRequired = true;
-        replyData["success"] = true;
-        LOGD("RPC", "Successfully setting rpc call");
+        if (wireType == WIRE_U32)
+        {
+            json[jsonKey()] = (uint32_t)value;
+        }
+        else
+        {
+            json[jsonKey()] = (int32_t)value;
+        }
     }
     else
     {
-        replyData["success"] = false;
-        LOGD("RPC", "Invalid rpc call value to method '%s'", name);
+        // Separate the sign and magnitude.
+        const char *signStr = value < 0 ? "-" : "";
+        uint32_t magnitude = value < 0 ? -value : value;
+
+        // Use sprintf to manually format to avoid floating point rounding issues.
+        char charBuff[16];
+        if (scale == SCALE_TENTHS)
+        {
+            sprintf(charBuff, "%s%" PRIu32 ".%" PRIu32, signStr, magnitude / 10, magnitude % 10);
+        }
+        else
+        {
+            sprintf(charBuff, "%s%" PRIu32 ".%d", signStr, magnitude >> 1, (magnitude & 0x1) ? 5 : 0);
+        }
+        json[jsonKey()] = serialized(charBuff);
     }
-}
 
-template <typename T>
-bool SettableField<T>::isValidNewValue(T value)
-{
-    return true; // Always accepted by default
-}
-
-bool Field::checkDecodeable(uint8_t length)
-{
-    LOGD("FIELDS", "Decoding '%s' using %d bytes, %d bytes provided", name, encodedLength, length);
-    if (length < encodedLength)
+    // Keep track of the current value of anything that can be set.
+    if (settable && wireType != WIRE_FLAG)
     {
-        LOGI("FIELDS", "%d bytes provided, but need %d to decode.", length, encodedLength);
-        return false;
+        curValue = value;
     }
-    return true;
+    return encodedLength;
 }
 
-int8_t Field::actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json)
-{
-    return 0;
-}
-
-int8_t TenthsByteField::actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json)
-{
-
-    // Convert and save to json
-    // Obtain the value
-    uint8_t value = (uint8_t)bytes[0];
-    // Use sprintf to manually format to avoid floating point rounding issues.
-    char charBuff[8];
-    sprintf(charBuff, "%d.%d", value / 10, value % 10);
-    json[name] = serialized(charBuff);
-    return 1;
-}
-
-int8_t TenthsField::actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json)
+int8_t Field::encode(uint8_t *bytes, uint8_t length)
 {
-    // Convert and save to json
-    // Obtain the value
-    int16_t value = (int16_t)byteArrayToUInt(bytes);
-
-    // Separate the sign and magnitude into a string and variable
-    char signStr[2] = "-";
-    if (value >= 0)
+    if (!settable)
     {
-        // No sign. Replace with a null char to make the string empty.
-        signStr[0] = '\0';
+        return 0;
     }
-    value = abs(value);
-
-    // Use sprintf to manually format to avoid floating point rounding issues.
-    char charBuff[8];
-    sprintf(charBuff, "%s%d.%d", signStr, value / 10, value % 10);
-    json[name] = serialized(charBuff);
-    return 2;
-}
 
-int8_t LongUIntField::actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json)
-{
-    // Convert and save to json
-    json[name] = byteArrayToULong(bytes);
-    return 4;
-}
-
-int8_t ByteField::actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json)
-{
-    // Convert and save to json
-    json[name] = (uint8_t)bytes[0];
-    return 1;
-}
-
-int8_t SettableByteField::actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json)
-{
-    // Convert and save to json
-    json[name] = (int8_t)bytes[0];
-    curValue = bytes[0];
-    setTxRequired();
-    return 1;
-}
-
-int8_t SettableByteField::encode(uint8_t *bytes, uint8_t length)
-{
     uint8_t totalBytes = encodedLength + 1;
     if (length >= totalBytes)
     {
-        // Have enough memory to properly encode.
+        // Have enough memory to properly encode. Values are little endian.
         bytes[0] = writeSymbol();
-        bytes[1] = setValue;
+        uint32_t value = setValue;
+        for (uint8_t i = 1; i < totalBytes; i++)
+        {
+            bytes[i] = value & 0xFF;
+            value >>= 8;
+        }
         return totalBytes;
     }
     else
@@ -160,51 +109,69 @@ int8_t SettableByteField::encode(uint8_t *bytes, uint8_t length)
     }
 }
 
-int8_t FlagField::actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json)
+bool Field::handleRpc(JsonObject &data, JsonObject &replyData)
 {
-    // Convert and save to json
-    json[name] = 1; // Set to a constant
-    return 0;
+    if (!settable)
+    {
+        return false;
+    }
+
+    setValue = wrapValue(data["params"].as<int32_t>());
+    replyData["success"] = true;
+    LOGD("RPC", "Successfully setting rpc call");
+    return true;
 }
 
-int8_t SettableFlagField::actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json)
+bool Field::settled()
 {
-    // Convert and save to json
-    json[name] = 1; // Set to a constant
-    // TODO: Some way to know when this has been successfully sent and received.
-    setTxRequired();
-    return 0;
+    return setValue == curValue;
 }
 
-int8_t SettableFlagField::encode(uint8_t *bytes, uint8_t length)
+bool Field::checkDecodeable(uint8_t length)
 {
-    if (length >= (encodedLength + 1))
+    LOGD("FIELDS", "Decoding '%s' using %d bytes, %d bytes provided", name, encodedLength, length);
+    if (length < encodedLength)
     {
-        // Have enough memory to properly encode.
-        bytes[0] = writeSymbol();
-        return 1;
+        LOGI("FIELDS", "%d bytes provided, but need %d to decode.", length, encodedLength);
+        return false;
     }
-    else
+    return true;
+}
+
+int64_t Field::readValue(uint8_t *bytes)
+{
+    switch (wireType)
     {
-        LOGE("FIELD", "Not enough memory to encode field.");
-        return FIELD_NO_MEMORY;
+    case WIRE_U8:
+        return bytes[0];
+    case WIRE_I8:
+        return (int8_t)bytes[0];
+    case WIRE_U16:
+        return byteArrayToUInt(bytes);
+    case WIRE_I16:
+        return (int16_t)byteArrayToUInt(bytes);
+    case WIRE_U32:
+        return byteArrayToULong(bytes);
+    case WIRE_FLAG:
+    default:
+        return 1; // Flags are always set to a constant.
     }
 }
 
-int8_t PumpOnTimeField::actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json)
+int32_t Field::wrapValue(int32_t value)
 {
-    // Convert and save to json
-    uint16_t value = byteArrayToUInt(bytes);
-    // Use sprintf to manually format to avoid floating point rounding issues.
-    char charBuff[8];
-    sprintf(charBuff, "%d.%d", value >> 1, (value & 0x1) ? 5 : 0);
-    json[name] = serialized(charBuff);
-    return 2;
+    switch (wireType)
+    {
+    case WIRE_U8:
+        return (uint8_t)value;
+    case WIRE_I8:
+        return (int8_t)value;
+    case WIRE_U16:
+        return (uint16_t)value;
+    case WIRE_I16:
+        return (int16_t)value;
+    default:
+        return value;
+    }
 }
 
-int8_t UIntField::actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json)
-{
-    // Convert and save to json
-    json[name] = byteArrayToUInt(bytes);
-    return 2;
-}
\ No newline at end of file
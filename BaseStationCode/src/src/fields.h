@@ -14,14 +14,30 @@
 
 #define FIELD_NO_MEMORY -1
 
+/**
+ * @brief How a field's value is stored in a packet (all little endian).
+ *
+ */
+enum FieldWireType : uint8_t {WIRE_FLAG, WIRE_U8, WIRE_I8, WIRE_U16, WIRE_I16, WIRE_U32};
+
+/**
+ * @brief How the raw value is converted for display.
+ *
+ */
+enum FieldScale : uint8_t {SCALE_NONE, SCALE_TENTHS, SCALE_HALVES};
+
 /**
  * @brief Class for handling data fields in messages.
  *
+ * Every field is described by its wire type, scale and whether it can be set,
+ * so one generic decoder and encoder handles all of them. This means fields
+ * can also be created at runtime from the device registry.
+ *
  */
 class Field : public Lookupable
 {
 public:
-    Field(const char *name, char symbol, const uint8_t encodedLength) : Lookupable(name, symbol), encodedLength(encodedLength) {}
+    Field(const char *name, char symbol, FieldWireType wireType, FieldScale scale = SCALE_NONE, bool settable = false) : Lookupable(name, symbol), wireType(wireType), scale(scale), settable(settable), encodedLength(wireLength(wireType)), compactKey{symbol, '\0'} {}
 
     /**
      * @brief Decodes the value from bytes into an existing json document.
@@ -29,6 +45,7 @@ public:
      * @param bytes the data to decode.
      * @param length the amount of data remaining from the start of bytes.
      * @param json the document to place the results into.
+     * @returns the number of bytes used or FIELD_NO_MEMORY.
      */
     int8_t decode(uint8_t *bytes, uint8_t length, JsonObject &json);
 
@@ -39,7 +56,7 @@ public:
      * @param length the available length.
      * @returns the number of bytes used, including the symbol for the field.
      */
-    virtual int8_t encode(uint8_t *bytes, uint8_t length);
+    int8_t encode(uint8_t *bytes, uint8_t length);
 
     /**
      * @brief Returns the symbol in write mode (MSB set to 1).
@@ -50,80 +67,81 @@ public:
      * @brief handles an RPC call for a field.
      *
      * @param reply
+     * @return true if the field now needs to be sent to the device. The caller
+     * (Device::handleRpc) is responsible for setting txRequired.
      */
-    virtual void handleRpc(JsonObject &data, JsonObject &replyData);
+    bool handleRpc(JsonObject &data, JsonObject &replyData);
 
-    const uint8_t encodedLength;
-    bool txRequired = false;
+    /**
+     * @brief Checks if the device has reported the value that was set, meaning
+     * it no longer needs to be transmitted.
+     */
+    bool settled();
 
-protected:
     /**
-     * @brief Checks if the value can be decoded from the packet.
+     * @brief Returns the key used for this field in telemetry. This is the
+     * symbol if COMPACT_TELEMETRY_KEYS is defined, otherwise the name.
      *
-     * @param length the number of bytes provided.
-     * @return true if the packet can be successfully decoded.
-     * @return false otherwise.
      */
-    bool checkDecodeable(uint8_t length);
+    const char *jsonKey()
+    {
+#ifdef COMPACT_TELEMETRY_KEYS
+        return compactKey;
+#else
+        return name;
+#endif
+    }
 
     /**
-     * @brief Decodes the value from bytes into an existing json document. decode does the checking for length, so this doesn't need to.
+     * @brief Returns the number of bytes a wire type uses in a packet.
      *
-     * @param bytes the data to decode.
-     * @param length the amount of data remaining from the start of bytes.
-     * @param json the document to place the results into.
      */
-    virtual int8_t actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json);
-};
+    static uint8_t wireLength(FieldWireType wireType);
 
-/**
- * @brief Class for fields that can be set.
- *
- * @tparam T
- */
-template <typename T>
-class SettableField : public Field
-{
-public:
-    using Field::Field;
+    const FieldWireType wireType;
+    const FieldScale scale;
+    const bool settable;
+    const uint8_t encodedLength;
+    const char compactKey[2]; // The symbol as a string.
+    bool txRequired = false; // Only changed by DeviceManager::setFieldPending().
 
-    T setValue = 255;
-    T curValue = 255;
+    // Only used for settable fields. -1 until known.
+    int32_t setValue = -1;
+    int32_t curValue = -1;
 
+protected:
     /**
-     * @brief Updates txRequired (if setValue == current, then not required).
+     * @brief Checks if the value can be decoded from the packet.
+     *
+     * @param length the number of bytes provided.
+     * @return true if the packet can be successfully decoded.
+     * @return false otherwise.
      */
-    virtual void setTxRequired();
+    bool checkDecodeable(uint8_t length);
 
     /**
-     * @brief handles an RPC call for a field.
+     * @brief Reads the raw value from the packet according to the wire type.
      *
-     * @param reply
      */
-    virtual void handleRpc(JsonObject &data, JsonObject &replyData);
+    int64_t readValue(uint8_t *bytes);
 
-protected:
     /**
-     * @brief Checks if the given value is acceptable to transmit.
+     * @brief Truncates a value to what can be represented by the wire type.
      *
-     * @param value
-     * @return true
-     * @return false
      */
-    virtual bool isValidNewValue(T value);
+    int32_t wrapValue(int32_t value);
 };
 
+// Presets for the types of fields that the sensors use.
+
 /**
- * @brief Field for decoding 1 byte signed data in tenths.
+ * @brief Field for decoding 1 byte unsigned data in tenths.
  *
  */
 class TenthsByteField : public Field
 {
 public:
-    TenthsByteField(const char *name, char symbol) : Field(name, symbol, 1) {}
-
-protected:
-    virtual int8_t actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json);
+    TenthsByteField(const char *name, char symbol) : Field(name, symbol, WIRE_U8, SCALE_TENTHS) {}
 };
 
 /**
@@ -133,10 +151,7 @@ protected:
 class TenthsField : public Field
 {
 public:
-    TenthsField(const char *name, char symbol) : Field(name, symbol, 2) {}
-
-protected:
-    virtual int8_t actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json);
+    TenthsField(const char *name, char symbol) : Field(name, symbol, WIRE_I16, SCALE_TENTHS) {}
 };
 
 /**
@@ -146,10 +161,7 @@ protected:
 class LongUIntField : public Field
 {
 public:
-    LongUIntField(const char *name, char symbol) : Field(name, symbol, 4) {}
-
-protected:
-    virtual int8_t actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json);
+    LongUIntField(const char *name, char symbol) : Field(name, symbol, WIRE_U32) {}
 };
 
 /**
@@ -159,33 +171,18 @@ protected:
 class ByteField : public Field
 {
 public:
-    ByteField(const char *name, char symbol) : Field(name, symbol, 1) {}
-
-protected:
-    virtual int8_t actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json);
+    ByteField(const char *name, char symbol) : Field(name, symbol, WIRE_U8) {}
 };
 
 /**
- * @brief Fields that contain an unsigned, single byte integer that can be set
- * using an RPC call.
+ * @brief Fields that contain a single byte integer that can be set using an
+ * RPC call.
  *
  */
-class SettableByteField : public SettableField<int8_t>
+class SettableByteField : public Field
 {
 public:
-    SettableByteField(const char *name, char symbol) : SettableField(name, symbol, 1) {}
-
-    /**
-     * @brief Encodes the value to set into a packet ready to send.
-     *
-     * @param bytes the payload to place in.
-     * @param length the available length.
-     * @returns the number of bytes used, including the symbol for the field.
-     */
-    virtual int8_t encode(uint8_t *bytes, uint8_t length);
-
-protected:
-    virtual int8_t actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json);
+    SettableByteField(const char *name, char symbol) : Field(name, symbol, WIRE_I8, SCALE_NONE, true) {}
 };
 
 /**
@@ -195,32 +192,17 @@ protected:
 class FlagField : public Field
 {
 public:
-    FlagField(const char *name, char symbol) : Field(name, symbol, 0) {}
-
-protected:
-    virtual int8_t actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json);
+    FlagField(const char *name, char symbol) : Field(name, symbol, WIRE_FLAG) {}
 };
 
 /**
  * @brief Class for flags that can be set via an RPC call.
  *
  */
-class SettableFlagField : public SettableField<int8_t>
+class SettableFlagField : public Field
 {
 public:
-    SettableFlagField(const char *name, char symbol) : SettableField(name, symbol, 0) {}
-
-    /**
-     * @brief Encodes the value to set into a packet ready to send.
-     *
-     * @param bytes the payload to place in.
-     * @param length the available length.
-     * @returns the number of bytes used, including the symbol for the field.
-     */
-    virtual int8_t encode(uint8_t *bytes, uint8_t length);
-
-protected:
-    virtual int8_t actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json);
+    SettableFlagField(const char *name, char symbol) : Field(name, symbol, WIRE_FLAG, SCALE_NONE, true) {}
 };
 
 /**
@@ -230,10 +212,7 @@ protected:
 class PumpOnTimeField : public Field
 {
 public:
-    PumpOnTimeField(const char *name, char symbol) : Field(name, symbol, 2) {}
-
-protected:
-    virtual int8_t actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json);
+    PumpOnTimeField(const char *name, char symbol) : Field(name, symbol, WIRE_U16, SCALE_HALVES) {}
 };
 
 /**
@@ -243,8 +222,5 @@ protected:
 class UIntField : public Field
 {
 public:
-    UIntField(const char *name, char symbol) : Field(name, symbol, 2) {}
-
-protected:
-    virtual int8_t actuallyDecode(uint8_t *bytes, uint8_t length, JsonObject &json);
-};
\ No newline at end of file
+    UIntField(const char *name, char symbol) : Field(name, symbol, WIRE_U16) {}
+};
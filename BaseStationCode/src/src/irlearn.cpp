@@ -0,0 +1,252 @@
+/**
+ * @file irlearn.cpp
+ * @brief Learns raw IR codes from remotes and stores them in flash by name so
+ * they can be sent later.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-04-12
+ */
+#include "irlearn.h"
+
+#ifdef PIN_IR
+#include "networking.h"
+extern SemaphoreHandle_t serialMutex;
+extern QueueHandle_t mqttPublishQueue;
+extern HVAC airConditioner;
+extern StaticArena<JSON_ARENA_SIZE> networkingArena;
+
+// Sending and learning run on different tasks (RPC and networking), so each
+// has its own buffers.
+IrFrame irSendFrame;
+uint8_t irSendCode[IR_CODE_MAX_SIZE];
+#ifdef PIN_IR_RX
+IrFrame irLearnFrame;
+uint8_t irLearnCode[IR_CODE_MAX_SIZE];
+#endif
+
+/**
+ * @brief Writes the path of a code to path.
+ *
+ */
+static void irCodePath(char *path, const char *name)
+{
+    sprintf(path, IR_CODE_DIR "/%s", name);
+}
+
+bool irNameValid(const char *name)
+{
+    size_t length = strlen(name);
+    if (length == 0 || length > IR_NAME_LENGTH)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        if (!isalnum(name[i]) && name[i] != '-' && name[i] != '_')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char *irSendLearnt(const char *name)
+{
+    if (!irNameValid(name))
+    {
+        return "Invalid name";
+    }
+
+    // Load the code.
+    char path[sizeof(IR_CODE_DIR) + IR_NAME_LENGTH + 1];
+    irCodePath(path, name);
+    File file = LittleFS.open(path, "r");
+    if (!file)
+    {
+        return "Unknown code";
+    }
+    size_t size = file.read(irSendCode, sizeof(irSendCode));
+    file.close();
+
+    // Send it.
+    uint8_t khz;
+    if (!irCodeDecode(irSendCode, size, irSendFrame, khz))
+    {
+        return "Invalid code";
+    }
+    if (!airConditioner.sendRaw(irSendFrame.durations, irSendFrame.length, khz))
+    {
+        return "Could not send IR";
+    }
+    LOGI("IR", "Sent '%s' (%u marks and spaces at %ukHz).", name, irSendFrame.length, khz);
+    return NULL;
+}
+
+#ifdef PIN_IR_RX
+// Every learnt code must fit in a frame, which must fit in the symbols sendRaw
+// packs into. Each received half becomes at most one half when sent, as
+// IR_LEARN_IDLE ends a code before a space gets longer than a symbol half.
+static_assert(IR_LEARN_MAX_SYMBOLS * 2 <= IR_FRAME_MAX, "Learnt codes must fit in an IrFrame.");
+static_assert(IR_FRAME_MAX <= HVAC_IR_CACHE_SYMBOLS * 2, "Learnt codes must fit in the symbols sendRaw uses.");
+
+IrLearnState irLearn;
+rmt_data_t irLearnSymbols[IR_LEARN_MAX_SYMBOLS];
+
+bool irLearnBegin()
+{
+    // The receiver goes quiet for longer than IR_LEARN_IDLE after a code.
+    bool success = rmtInit(PIN_IR_RX, RMT_RX_MODE, IR_LEARN_MEM_BLOCKS, HVAC_IR_RESOLUTION) &&
+                   rmtSetRxMaxThreshold(PIN_IR_RX, IR_LEARN_IDLE);
+    if (!success)
+    {
+        LOGE("IR", "Could not set up RMT to receive on pin %d.", PIN_IR_RX);
+    }
+    return success;
+}
+
+/**
+ * @brief Starts (or restarts after noise) receiving.
+ *
+ */
+static bool irLearnListen()
+{
+    irLearn.symbolCount = IR_LEARN_MAX_SYMBOLS;
+    return rmtReadAsync(PIN_IR_RX, irLearnSymbols, &irLearn.symbolCount);
+}
+
+const char *irLearnStart(const char *name, uint8_t khz)
+{
+    if (irLearn.active)
+    {
+        return "Already learning";
+    }
+    if (!irNameValid(name))
+    {
+        return "Invalid name";
+    }
+    if (!irLearnListen())
+    {
+        return "Could not start receiving";
+    }
+    strcpy(irLearn.name, name);
+    irLearn.khz = khz;
+    irLearn.startTime = millis();
+    irLearn.active = true;
+    LOGI("IR", "Learning '%s'.", name);
+    return NULL;
+}
+
+/**
+ * @brief Converts the received symbols into marks and spaces in irLearnFrame.
+ *
+ * @return NULL if successful, otherwise a description of the error.
+ */
+static const char *irLearnToFrame()
+{
+    irLearnFrame.clear();
+    for (size_t i = 0; i < irLearn.symbolCount; i++)
+    {
+        // The receiver output is low while it sees the carrier.
+        const rmt_data_t &symbol = irLearnSymbols[i];
+        bool fits = symbol.level0 ? irLearnFrame.space(symbol.duration0) : irLearnFrame.mark(symbol.duration0);
+        if (symbol.duration1 == 0)
+        {
+            return fits ? NULL : "Code too long"; // End of the code.
+        }
+        fits = fits && (symbol.level1 ? irLearnFrame.space(symbol.duration1) : irLearnFrame.mark(symbol.duration1));
+        if (!fits)
+        {
+            return "Code too long";
+        }
+    }
+
+    // RMT stops once the buffer is full, so there may have been more.
+    return irLearn.symbolCount == IR_LEARN_MAX_SYMBOLS ? "Code too long" : NULL;
+}
+
+/**
+ * @brief Publishes the result of learning a code. Only called from the
+ * networking task (through irLearnPoll()), so networkingArena is used.
+ *
+ * @param error NULL if successful, otherwise a description of the error.
+ * @param size the size of the stored code.
+ */
+static void irLearnFinish(const char *error, size_t size)
+{
+    irLearn.active = false;
+    ArenaScope scope(networkingArena);
+    JsonDocument json(&networkingArena);
+    JsonObject result = json["irLearn"].to<JsonObject>();
+    result["name"] = irLearn.name;
+    result["result"] = error == NULL;
+    result["desc"] = error ? error : "";
+    result["length"] = irLearnFrame.length;
+    result["bytes"] = size;
+    MqttMsg msg{Topic::ATTRIBUTE_ME_UPLOAD, ""};
+    serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
+    LOGI("IR", "%s", msg.payload);
+
+    // This is called from the task that empties the queue, so don't wait.
+    if (!xQueueSend(mqttPublishQueue, (void *)&msg, 0))
+    {
+        LOGW("IR", "Queue full, could not publish the result.");
+    }
+}
+
+void irLearnPoll()
+{
+    if (!irLearn.active)
+    {
+        return;
+    }
+
+    if (!rmtReceiveCompleted(PIN_IR_RX))
+    {
+        if (millis() - irLearn.startTime > IR_LEARN_TIMEOUT)
+        {
+            // There is no way to cancel a read, so start again.
+            rmtDeinit(PIN_IR_RX);
+            irLearnBegin();
+            irLearnFrame.clear();
+            irLearnFinish("Timed out", 0);
+        }
+        return;
+    }
+
+    // Ignore noise and keep listening.
+    const char *error = irLearnToFrame();
+    if (!error && irLearnFrame.length < IR_LEARN_MIN_LENGTH)
+    {
+        if (!irLearnListen())
+        {
+            irLearnFinish("Could not start receiving", 0);
+        }
+        return;
+    }
+    if (error)
+    {
+        irLearnFinish(error, 0);
+        return;
+    }
+
+    // Compress and save it.
+    size_t size = irCodeEncode(irLearnFrame, irLearn.khz, irLearnCode, sizeof(irLearnCode));
+    if (!size)
+    {
+        irLearnFinish("Too many different times", 0);
+        return;
+    }
+    char path[sizeof(IR_CODE_DIR) + IR_NAME_LENGTH + 1];
+    irCodePath(path, irLearn.name);
+    File file = LittleFS.open(path, "w", true);
+    if (!file || file.write(irLearnCode, size) != size)
+    {
+        irLearnFinish("Could not save", 0);
+        return;
+    }
+    file.close();
+    irLearnFinish(NULL, size);
+}
+#endif
+#endif
@@ -0,0 +1,81 @@
+/**
+ * @file irlearn.h
+ * @brief Learns raw IR codes from remotes and stores them in flash by name so
+ * they can be sent later.
+ *
+ * Codes are compressed with irCodeEncode() and stored as IR_CODE_DIR/<name>.
+ * Learning needs an IR receiver module (demodulating, active low output such
+ * as a TSOP38238) on PIN_IR_RX. Sending learnt codes only needs PIN_IR.
+ *
+ * RPC methods (to the base station itself):
+ * - `irLearn` with `{"name": "tvPower", "khz": 38}` listens for up to
+ *   IR_LEARN_TIMEOUT for a code. The carrier frequency can't be measured
+ *   through the receiver, so it is given (38kHz if not). The result is
+ *   published as the `irLearn` attribute once a code is received.
+ * - `irSend` with `{"name": "tvPower"}` sends a learnt code.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-04-12
+ */
+#pragma once
+#include "../defines.h"
+
+#ifdef PIN_IR
+#include "hvacir.h"
+#include "ircodec.h"
+
+/**
+ * @brief Sends a code learnt earlier. Called from the RPC task, so this has
+ * separate buffers to learning.
+ *
+ * @param name the name of the code.
+ * @return NULL if successful, otherwise a description of the error.
+ */
+const char *irSendLearnt(const char *name);
+
+/**
+ * @brief Checks a name only has letters, numbers, '-' and '_' and is not too
+ * long to be used as a file name.
+ *
+ */
+bool irNameValid(const char *name);
+
+#ifdef PIN_IR_RX
+/**
+ * @brief State of learning a code.
+ *
+ */
+struct IrLearnState
+{
+    bool active;
+    uint8_t khz;
+    uint32_t startTime;
+    size_t symbolCount; // Space available, then the number received.
+    char name[IR_NAME_LENGTH + 1];
+};
+
+/**
+ * @brief Sets up the RMT peripheral to receive on PIN_IR_RX.
+ *
+ * @return true if successful.
+ */
+bool irLearnBegin();
+
+/**
+ * @brief Starts listening for a code.
+ *
+ * @param name the name to save the code as.
+ * @param khz the carrier frequency to send the code with later.
+ * @return NULL if successful, otherwise a description of the error.
+ */
+const char *irLearnStart(const char *name, uint8_t khz);
+
+/**
+ * @brief Checks if a code has been received (or listening timed out) and if
+ * so, saves it and publishes the result. Call often from the networking task.
+ *
+ */
+void irLearnPoll();
+#endif
+#endif
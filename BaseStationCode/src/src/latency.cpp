@@ -0,0 +1,141 @@
+/**
+ * @file latency.cpp
+ * @brief Timestamps packets as they move from the radio to the MQTT broker and
+ * keeps histograms of how long each stage takes.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-02-08
+ */
+#include "latency.h"
+#include "networking.h"
+
+#ifdef LATENCY_TRACING
+extern SemaphoreHandle_t serialMutex;
+extern SemaphoreHandle_t statsMutex;
+extern QueueHandle_t mqttPublishQueue;
+
+LatencyHistogram latencyHistograms[LATENCY_STAGE_COUNT];
+const char *const latencyStageNames[LATENCY_STAGE_COUNT] = {"latDecode", "latSerialise", "latQueue", "latPublish", "latTotal", "latRadioLoop"};
+
+void LatencyHistogram::add(uint32_t us)
+{
+    // Bucket i holds everything below 2^i.
+    uint8_t bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= LATENCY_BUCKETS)
+    {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    m_buckets[bucket]++;
+    count++;
+    if (us > max)
+    {
+        max = us;
+    }
+}
+
+uint32_t LatencyHistogram::percentile(uint8_t percent)
+{
+    // Find the bucket that the requested rank falls in.
+    uint32_t rank = ((uint64_t)count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += m_buckets[i];
+        if (seen >= rank && seen != 0)
+        {
+            // Upper bound of this bucket, although nothing can be over the max.
+            uint32_t upper = (1ULL << i) - 1;
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        m_buckets[i] += other.m_buckets[i];
+    }
+    count += other.count;
+    if (other.max > max)
+    {
+        max = other.max;
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    memset(m_buckets, 0, sizeof(m_buckets));
+    count = 0;
+    max = 0;
+}
+
+void latencyRecord(const PacketTrace &trace)
+{
+    if (!trace.rxDone)
+    {
+        // Not from the radio.
+        return;
+    }
+
+    xSemaphoreTake(statsMutex, portMAX_DELAY);
+    latencyHistograms[LATENCY_DECODE].add(trace.decodeEnd - trace.decodeStart);
+    latencyHistograms[LATENCY_SERIALISE].add(trace.enqueued - trace.decodeEnd);
+    latencyHistograms[LATENCY_QUEUE].add(trace.dequeued - trace.enqueued);
+    latencyHistograms[LATENCY_PUBLISH].add(trace.published - trace.dequeued);
+    latencyHistograms[LATENCY_TOTAL].add(trace.published - trace.rxDone);
+    xSemaphoreGive(statsMutex);
+}
+
+void latencyMergeRadioLoop(const LatencyHistogram &loop)
+{
+    xSemaphoreTake(statsMutex, portMAX_DELAY);
+    latencyHistograms[LATENCY_RADIO_LOOP].merge(loop);
+    xSemaphoreGive(statsMutex);
+}
+
+void latencyReport()
+{
+    for (uint8_t i = 0; i < LATENCY_STAGE_COUNT; i++)
+    {
+        // Take a snapshot of the stage so the mutex isn't held while queueing.
+        xSemaphoreTake(statsMutex, portMAX_DELAY);
+        LatencyHistogram &histogram = latencyHistograms[i];
+        uint32_t count = histogram.count;
+        uint32_t p50 = histogram.percentile(50);
+        uint32_t p95 = histogram.percentile(95);
+        uint32_t p99 = histogram.percentile(99);
+        uint32_t max = histogram.max;
+        histogram.reset();
+        xSemaphoreGive(statsMutex);
+
+        if (!count)
+        {
+            // Nothing happened in this period.
+            continue;
+        }
+
+        // Key names are the stage name followed by the statistic.
+        JsonDocument json;
+        char key[24];
+        const char *name = latencyStageNames[i];
+        snprintf(key, sizeof(key), "%sN", name);
+        json[key] = count;
+        snprintf(key, sizeof(key), "%sP50", name);
+        json[key] = p50;
+        snprintf(key, sizeof(key), "%sP95", name);
+        json[key] = p95;
+        snprintf(key, sizeof(key), "%sP99", name);
+        json[key] = p99;
+        snprintf(key, sizeof(key), "%sMax", name);
+        json[key] = max;
+
+        MqttMsg msg{Topic::TELEMETRY_ME_UPLOAD, ""};
+        serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
+        LOGD("LATENCY", "%s", msg.payload);
+        xQueueSend(mqttPublishQueue, (void *)&msg, portMAX_DELAY);
+    }
+}
+#endif
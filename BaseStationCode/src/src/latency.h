@@ -0,0 +1,113 @@
+/**
+ * @file latency.h
+ * @brief Timestamps packets as they move from the radio to the MQTT broker and
+ * keeps histograms of how long each stage takes.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-02-08
+ */
+
+#pragma once
+#include "../defines.h"
+
+#ifdef LATENCY_TRACING
+/**
+ * @brief Timestamps (from micros()) recorded as a packet moves through the
+ * gateway. This is carried inside each MqttMsg so that no lookups are needed.
+ * A value of 0 means the trace point was not reached.
+ *
+ */
+struct PacketTrace
+{
+    uint32_t rxDone;
+    uint32_t decodeStart;
+    uint32_t decodeEnd;
+    uint32_t enqueued;
+    uint32_t dequeued;
+    uint32_t published;
+};
+
+/**
+ * @brief Records the current time in a trace point.
+ *
+ */
+#define TRACE_POINT(TRACE, POINT) (TRACE).POINT = micros()
+
+/**
+ * @brief Stages that the time between trace points is grouped into.
+ * LATENCY_RADIO_LOOP is the time between the PJON task servicing the radio,
+ * which shows scheduling delays from the task placement.
+ *
+ */
+enum LatencyStage {LATENCY_DECODE, LATENCY_SERIALISE, LATENCY_QUEUE, LATENCY_PUBLISH, LATENCY_TOTAL, LATENCY_RADIO_LOOP, LATENCY_STAGE_COUNT};
+
+/**
+ * @brief Histogram with logarithmically sized buckets. Bucket i holds values
+ * less than 2^i microseconds, so percentiles are accurate to within a factor
+ * of 2 while only needing a few hundred bytes and no sorting.
+ *
+ */
+class LatencyHistogram
+{
+public:
+    /**
+     * @brief Adds a measurement to the histogram.
+     *
+     * @param us the duration in microseconds.
+     */
+    void add(uint32_t us);
+
+    /**
+     * @brief Calculates an upper bound for the given percentile.
+     *
+     * @param percent the percentile to find (0 to 100).
+     * @return uint32_t the upper bound in microseconds, capped at the maximum.
+     */
+    uint32_t percentile(uint8_t percent);
+
+    /**
+     * @brief Adds all measurements from another histogram to this one.
+     *
+     * @param other the histogram to add.
+     */
+    void merge(const LatencyHistogram &other);
+
+    /**
+     * @brief Clears all measurements.
+     *
+     */
+    void reset();
+
+    uint32_t count = 0;
+    uint32_t max = 0;
+
+private:
+    uint32_t m_buckets[LATENCY_BUCKETS] = {0};
+};
+
+/**
+ * @brief Adds the stages of a completed trace to the histograms. Traces that
+ * did not start at the radio are ignored.
+ *
+ * @param trace the trace to record.
+ */
+void latencyRecord(const PacketTrace &trace);
+
+/**
+ * @brief Adds the radio loop timings measured by the PJON task to the shared
+ * histograms.
+ *
+ * @param loop the histogram kept by the PJON task.
+ */
+void latencyMergeRadioLoop(const LatencyHistogram &loop);
+
+/**
+ * @brief Publishes the p50, p95, p99 and maximum of each stage as telemetry
+ * and resets the histograms for the next period.
+ *
+ */
+void latencyReport();
+#else
+#define TRACE_POINT(TRACE, POINT)
+#endif
@@ -15,35 +15,205 @@ extern DeviceManager deviceManager;
 extern SemaphoreHandle_t stateUpdateMutex;
 extern SemaphoreHandle_t serialMutex;
 extern uint32_t lastLoRaTime;
+extern SemaphoreHandle_t ledMutex;
+
+// Patterns
+static const LedStep stepsOff[] = {{0, 0, false}};
+static const LedStep stepsOn[] = {{LED_BRIGHTNESS_FULL, 0, false}};
+static const LedStep stepsDim[] = {{LED_BRIGHTNESS_DIM, 0, false}};
+static const LedStep stepsFastBlink[] = {{LED_BRIGHTNESS_FULL, 100, false}, {0, 100, false}};
+static const LedStep stepsBlink[] = {{LED_BRIGHTNESS_FULL, 500, false}, {0, 500, false}};
+static const LedStep stepsShortOn[] = {{LED_BRIGHTNESS_FULL, 100, false}, {0, 900, false}};
+static const LedStep stepsLongOn[] = {{LED_BRIGHTNESS_FULL, 900, false}, {0, 100, false}};
+static const LedStep stepsDoubleFlash[] = {{LED_BRIGHTNESS_FULL, 150, false}, {0, 150, false}, {LED_BRIGHTNESS_FULL, 150, false}, {0, 4550, false}};
+static const LedStep stepsBreathe[] = {{LED_BRIGHTNESS_FULL, 1000, true}, {LED_BRIGHTNESS_DIM, 1000, true}};
+
+static const LedPattern patternOff = LED_PATTERN(stepsOff);
+static const LedPattern patternOn = LED_PATTERN(stepsOn);
+static const LedPattern patternDim = LED_PATTERN(stepsDim);
+static const LedPattern patternFastBlink = LED_PATTERN(stepsFastBlink);
+static const LedPattern patternBlink = LED_PATTERN(stepsBlink);
+static const LedPattern patternShortOn = LED_PATTERN(stepsShortOn);
+static const LedPattern patternLongOn = LED_PATTERN(stepsLongOn);
+static const LedPattern patternDoubleFlash = LED_PATTERN(stepsDoubleFlash);
+static const LedPattern patternBreathe = LED_PATTERN(stepsBreathe);
+
+#ifdef PIN_LED_TOP
+#define SET_LED_TOP(PATTERN) ledTop.show(PATTERN)
+#define FLASH_LED_TOP(BRIGHTNESS) ledTop.flash(BRIGHTNESS, LORA_LED_FLASH_TIME)
+#else
+#define SET_LED_TOP(PATTERN)
+#define FLASH_LED_TOP(BRIGHTNESS)
+#endif
+#ifdef PIN_LED_INSIDE
+#define SET_LED_INSIDE(PATTERN) ledInside.show(PATTERN)
+#else
+#define SET_LED_INSIDE(PATTERN)
+#endif
 
 void Led::begin()
 {
-    pinMode(pin, OUTPUT);
-    set(false); // Turn off by default.
+    ledcAttach(pin, LED_PWM_FREQUENCY, LED_PWM_RESOLUTION);
+    esp_timer_create_args_t args = {
+        .callback = m_timerCallback,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "led",
+        .skip_unhandled_events = true};
+    esp_timer_create(&args, &m_timer);
+    show(patternOff); // Turn off by default.
 }
 
-void Led::tick()
+void Led::show(const LedPattern &pattern)
 {
-    // TODO
+    xSemaphoreTake(ledMutex, portMAX_DELAY);
+    if (pattern.steps != m_steps)
+    {
+        m_steps = pattern.steps;
+        m_count = pattern.count;
+        m_step = 0;
+        if (!m_flashing)
+        {
+            m_startStep();
+        }
+    }
+    xSemaphoreGive(ledMutex);
 }
 
-void Led::set(bool state)
+void Led::flash(uint8_t brightness, uint16_t time)
 {
-    digitalWrite(pin, state);
+    xSemaphoreTake(ledMutex, portMAX_DELAY);
+    m_flashing = true;
+    m_brightness = brightness;
+    ledcWrite(pin, brightness);
+    m_startTimer(time);
+    xSemaphoreGive(ledMutex);
 }
 
-#define NOTIFY_DELAY(TIME) ulTaskNotifyTake(pdTRUE, TIME / portTICK_PERIOD_MS)
+void Led::m_timerCallback(void *arg)
+{
+    Led *led = (Led *)arg;
 
-#ifdef PIN_LED_TOP
-#define SET_LED_TOP(STATE) ledTop.set(STATE)
-#else
-#define SET_LED_TOP(STATE)
-#endif
-#ifdef PIN_LED_INSIDE
-#define SET_LED_INSIDE(STATE) ledInside.set(STATE)
-#else
-#define SET_LED_INSIDE(STATE)
-#endif
+    // Don't block the esp_timer task (shared with everything else using
+    // esp_timer) while another task changes the LED. Try again shortly
+    // instead. If that task restarts the timer, this retry is not needed and
+    // starting it fails harmlessly.
+    if (!xSemaphoreTake(ledMutex, 0))
+    {
+        esp_timer_start_once(led->m_timer, LED_TIMER_RETRY * 1000ULL);
+        return;
+    }
+
+    // The timer may have been restarted while this was waiting for the mutex.
+    if (esp_timer_get_time() >= led->m_due)
+    {
+        if (led->m_flashing)
+        {
+            // Go back to the start of the pattern.
+            led->m_flashing = false;
+            led->m_step = 0;
+        }
+        else
+        {
+            led->m_step = (led->m_step + 1) % led->m_count;
+        }
+        led->m_startStep();
+    }
+    xSemaphoreGive(ledMutex);
+}
+
+void Led::m_startStep()
+{
+    const LedStep &step = m_steps[m_step];
+    if (step.fade)
+    {
+        // The LEDC hardware does the fade.
+        ledcFade(pin, m_brightness, step.brightness, step.time);
+    }
+    else
+    {
+        ledcWrite(pin, step.brightness);
+    }
+    m_brightness = step.brightness;
+
+    // Patterns with one step don't change.
+    if (m_count > 1)
+    {
+        m_startTimer(step.time);
+    }
+    else
+    {
+        esp_timer_stop(m_timer);
+    }
+}
+
+void Led::m_startTimer(uint16_t time)
+{
+    esp_timer_stop(m_timer);
+    m_due = esp_timer_get_time() + time * 1000LL;
+    esp_timer_start_once(m_timer, time * 1000ULL);
+}
+
+/**
+ * @brief Which pattern each LED should show.
+ *
+ */
+struct LedPatterns
+{
+    const LedPattern *top;
+    const LedPattern *inside;
+    const LedPattern *builtin;
+};
+
+/**
+ * @brief Chooses the patterns for the current state, in the priority OTA
+ * updates > Alarms > Networking > Other stuff.
+ *
+ */
+static LedPatterns ledPatternsFor(bool otaUpdating, AlarmState alarmState, NetworkState networkState, bool txRequired)
+{
+    if (otaUpdating)
+    {
+        // In the middle of an update, flash some LEDs.
+        return {&patternFastBlink, &patternFastBlink, &patternFastBlink};
+    }
+
+    switch (alarmState)
+    {
+    case ALARM_HIGH:
+        // High priority alarms
+        return {&patternBlink, &patternBlink, &patternBlink};
+
+    case ALARM_OFF:
+        // No alarm, so use the LEDs for other status indication. The built in
+        // LED shows when the network state is being displayed.
+        switch (networkState)
+        {
+        case NETWORK_NONE:
+            return {&patternOn, &patternOn, &patternOn};
+
+        case NETWORK_WIFI_CONNECTING:
+            // On for a short time, off for long time.
+            return {&patternOff, &patternShortOn, &patternShortOn};
+
+        case NETWORK_MQTT_CONNECTING:
+            // On for a long time, off for a short time.
+            return {&patternOff, &patternLongOn, &patternLongOn};
+
+        case NETWORK_CONNECTED:
+        default:
+            // Network is happy, so show the radio status. Breathes while
+            // waiting to transmit.
+            const LedPattern *radio = txRequired ? &patternBreathe : &patternOff;
+            return {radio, &patternDim, radio};
+        }
+
+    case ALARM_MEDIUM:
+    default:
+        // Other alarms.
+        return {&patternDoubleFlash, &patternDoubleFlash, &patternOn};
+    }
+}
 
 void ledTask(void *pvParameters)
 {
@@ -59,124 +229,34 @@ void ledTask(void *pvParameters)
     Led ledBuiltin(LED_BUILTIN);
     ledBuiltin.begin();
 
+    uint32_t lastLoRaTimeShown = lastLoRaTime;
     while (true)
     {
         // Create a copy of the states to avoid race conditions.
         xSemaphoreTake(stateUpdateMutex, portMAX_DELAY);
         AlarmState alarmStateCopy = alarmState;
         NetworkState networkStateCopy = networkState;
-        bool txRequired = deviceManager.txRequired(); // Still liable to change.
         uint32_t lastLoRaTimeCopy = lastLoRaTime;
         bool otaUpdatingCopy = otaUpdating;
         xSemaphoreGive(stateUpdateMutex);
+        bool txRequired = deviceManager.txRequired(); // Still liable to change.
 
-        // Handle each state in the priority OTA updates > Alarms > Networking > Other stuff.
-        if (!otaUpdatingCopy)
-        {
-            // Not in the middle of an update.
-            switch (alarmStateCopy)
-            {
-            case ALARM_HIGH:
-                // High priority alarms
-                ledBuiltin.set(true);
-                SET_LED_TOP(true);
-                SET_LED_INSIDE(true);
-                if (!NOTIFY_DELAY(500))
-                {
-                    // No event, keep going
-                    SET_LED_TOP(false);
-                    SET_LED_INSIDE(false);
-                    ledBuiltin.set(false);
-                    NOTIFY_DELAY(500);
-                }
-                break;
-
-            case ALARM_OFF:
-                // No alarm, so use the LEDs for other status indication.
-                switch (networkStateCopy)
-                {
-                case NETWORK_NONE:
-                    ledBuiltin.set(true); // Show that we are displaying the network state.
-                    SET_LED_TOP(true);
-                    SET_LED_INSIDE(true);
-                    break;
-
-                case NETWORK_WIFI_CONNECTING:
-                    // On for a short time, off for long time.
-                    SET_LED_TOP(false);
-                    SET_LED_INSIDE(true);
-                    ledBuiltin.set(true); // Show that we are displaying the network state.
-                    if (!NOTIFY_DELAY(100))
-                    {
-                        // No event, keep going
-                        SET_LED_INSIDE(false);
-                        ledBuiltin.set(false);
-                        NOTIFY_DELAY(900);
-                    }
-                    break;
-
-                case NETWORK_MQTT_CONNECTING:
-                    // On for a long time, off for a short time.
-                    SET_LED_TOP(false);
-                    SET_LED_INSIDE(true);
-                    ledBuiltin.set(true); // Show that we are displaying the network state.
-                    if (!NOTIFY_DELAY(900))
-                    {
-                        // No event, keep going
-                        SET_LED_INSIDE(false);
-                        ledBuiltin.set(false);
-                        NOTIFY_DELAY(100);
-                    }
-                    break;
-
-                case NETWORK_CONNECTED:
-                default:
-                    // Network is happy, so show the radio status.
-                    // Show that we are not displaying the network state.
-                    SET_LED_INSIDE(true);
-                    if (millis() - lastLoRaTimeCopy < LORA_LED_FLASH_TIME)
-                    {
-                        // TX or RX happened recently.
-                        SET_LED_TOP(!txRequired);
-                        ledBuiltin.set(!txRequired);
-                    }
-                    else
-                    {
-                        // No TX or RX recently.
-                        SET_LED_TOP(txRequired);
-                        ledBuiltin.set(txRequired);
-                    }
-                }
-                break;
-
-            case ALARM_MEDIUM:
-            default:
-                // OTher alarms.
-                SET_LED_TOP(true);
-                SET_LED_INSIDE(true);
-                ledBuiltin.set(true);
-                if (!NOTIFY_DELAY(1000))
-                {
-                    // No event, keep going
-                    SET_LED_TOP(false);
-                    SET_LED_INSIDE(false);
-                    ledBuiltin.set(true);
-                    NOTIFY_DELAY(4000);
-                }
-            }
-            taskYIELD();
-        }
-        else
+        LedPatterns patterns = ledPatternsFor(otaUpdatingCopy, alarmStateCopy, networkStateCopy, txRequired);
+        SET_LED_TOP(*patterns.top);
+        SET_LED_INSIDE(*patterns.inside);
+        ledBuiltin.show(*patterns.builtin);
+
+        // Flash the opposite way when a packet is sent or received.
+        bool showingRadio = patterns.inside == &patternDim;
+        if (showingRadio && lastLoRaTimeCopy != lastLoRaTimeShown)
         {
-            // In the middle of an update, flash some LEDs.
-            SET_LED_TOP(true);
-            SET_LED_INSIDE(true);
-            ledBuiltin.set(true);
-            NOTIFY_DELAY(100);
-            SET_LED_TOP(false);
-            SET_LED_INSIDE(false);
-            ledBuiltin.set(false);
-            NOTIFY_DELAY(100);
+            uint8_t brightness = txRequired ? 0 : LED_BRIGHTNESS_FULL;
+            FLASH_LED_TOP(brightness);
+            ledBuiltin.flash(brightness, LORA_LED_FLASH_TIME);
         }
+        lastLoRaTimeShown = lastLoRaTimeCopy;
+
+        // Sleep until something changes.
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     }
-}
\ No newline at end of file
+}
@@ -2,6 +2,10 @@
  * @file leds.h
  * @brief Controls the LEDs on the unit.
  *
+ * Each LED shows a pattern, which is a list of brightness steps that repeats.
+ * Steps are timed with an esp_timer and fades are done by the LEDC hardware,
+ * so the LED task only wakes up when a state it shows changes.
+ *
  * @author Jotham Gates
  * @version 0.1
  * @date 2023-11-05
@@ -12,6 +16,30 @@
 #include "networking.h"
 #include "devices.h"
 
+/**
+ * @brief A brightness to go to and how long to stay there.
+ *
+ */
+struct LedStep
+{
+    uint8_t brightness;
+    uint16_t time; // Time until the next step in ms.
+    bool fade; // Fade to the brightness over the time instead of jumping.
+};
+
+/**
+ * @brief Steps that repeat forever. Patterns with a single step stay at that
+ * brightness.
+ *
+ */
+struct LedPattern
+{
+    const LedStep *steps;
+    uint8_t count;
+};
+
+#define LED_PATTERN(STEPS) {STEPS, sizeof(STEPS) / sizeof(STEPS[0])}
+
 /**
  * @brief Class for controlling an LED.
  *
@@ -33,24 +61,55 @@ public:
     void begin();
 
     /**
-     * @brief Called regularly to update the LED during fades and animations.
+     * @brief Starts showing a pattern. Does nothing if already showing it.
      *
+     * @param pattern the pattern.
      */
-    void tick();
+    void show(const LedPattern &pattern);
 
     /**
-     * @brief Turns the LED on or off.
-     * 
-     * @param state true if on, false is off.
+     * @brief Briefly changes the brightness, then starts the pattern again.
+     *
+     * @param brightness the brightness.
+     * @param time how long for in ms.
      */
-    void set(bool state);
+    void flash(uint8_t brightness, uint16_t time);
 
 private:
+    /**
+     * @brief Moves to the next step when the timer goes off. Runs on the
+     * esp_timer task, so never waits for ledMutex.
+     *
+     * @param arg the Led.
+     */
+    static void m_timerCallback(void *arg);
+
+    /**
+     * @brief Sets the brightness for the current step and starts the timer
+     * until the next. Must hold ledMutex.
+     *
+     */
+    void m_startStep();
+
+    /**
+     * @brief Starts the timer. Must hold ledMutex.
+     *
+     * @param time the time in ms.
+     */
+    void m_startTimer(uint16_t time);
+
     const uint8_t pin;
+    const LedStep *m_steps = nullptr;
+    uint8_t m_count = 0;
+    uint8_t m_step = 0;
+    uint8_t m_brightness = 0;
+    bool m_flashing = false;
+    int64_t m_due = 0; // When the timer should go off, to ignore stale callbacks.
+    esp_timer_handle_t m_timer;
 };
 
 /**
  * @brief Task that manages the LEDs on the unit.
  *
  */
-void ledTask(void *pvParameters);
\ No newline at end of file
+void ledTask(void *pvParameters);
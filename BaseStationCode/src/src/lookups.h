@@ -27,12 +27,45 @@ public:
 /**
  * @brief Class for looking up and managing devices and fields.
  *
+ * Managers with at least LOOKUP_INDEX_MIN_COUNT items build a hash index of
+ * the names and a direct index of the symbols so that lookups take the same
+ * time regardless of how many items there are. Smaller managers (such as the
+ * fields of most devices) are searched linearly, which is faster for a handful
+ * of items and saves the memory. If several items share a name or symbol, the
+ * first one is returned either way.
  */
 template <typename LookupableClass>
 class LookupManager
 {
 public:
-    LookupManager(LookupableClass **items, uint8_t count) : items(items), count(count) {}
+    LookupManager(LookupableClass **items, uint16_t count) : items(items), count(count)
+    {
+        buildIndex();
+    }
+
+    ~LookupManager()
+    {
+        delete[] nameIndex;
+        delete[] symbolIndex;
+    }
+
+    // Copies would share and then double free the indexes.
+    LookupManager(const LookupManager &) = delete;
+    LookupManager &operator=(const LookupManager &) = delete;
+
+    /**
+     * @brief Replaces the items being managed. Not thread safe, so should only
+     * be used before other tasks start.
+     *
+     * @param newItems
+     * @param newCount
+     */
+    void setItems(LookupableClass **newItems, uint16_t newCount)
+    {
+        items = newItems;
+        count = newCount;
+        buildIndex();
+    }
 
     /**
      * @brief Gets the object with the given symbol.
@@ -42,7 +75,13 @@ public:
      */
     LookupableClass *getWithSymbol(char symbol)
     {
-        for (uint8_t i = 0; i < count; i++)
+        if (symbolIndex)
+        {
+            uint16_t index = symbolIndex[(uint8_t)symbol];
+            return index ? items[index - 1] : NULL;
+        }
+
+        for (uint16_t i = 0; i < count; i++)
         {
             if (items[i]->symbol == symbol)
             {
@@ -60,7 +99,21 @@ public:
      */
     LookupableClass *getWithName(const char *name)
     {
-        for (uint8_t i = 0; i < count; i++)
+        if (nameIndex)
+        {
+            // Probe until the name or an empty slot is found.
+            for (uint32_t slot = hashName(name) & nameMask; nameIndex[slot]; slot = (slot + 1) & nameMask)
+            {
+                LookupableClass *item = items[nameIndex[slot] - 1];
+                if (STRINGS_MATCH(item->name, name))
+                {
+                    return item;
+                }
+            }
+            return NULL;
+        }
+
+        for (uint16_t i = 0; i < count; i++)
         {
             if (STRINGS_MATCH(items[i]->name, name))
             {
@@ -72,6 +125,70 @@ public:
         return NULL;
     }
 
+    /**
+     * @brief Hashes a name using 32 bit FNV-1a.
+     *
+     * @param name the null terminated name.
+     * @return uint32_t the hash.
+     */
+    static uint32_t hashName(const char *name)
+    {
+        uint32_t hash = 2166136261;
+        while (*name)
+        {
+            hash = (hash ^ (uint8_t)*name++) * 16777619;
+        }
+        return hash;
+    }
+
     LookupableClass **items;
-    uint8_t count;
+    uint16_t count;
+
+private:
+    /**
+     * @brief (Re)builds the name and symbol indexes if there are enough items
+     * to be worth it. Indexes store the item index + 1 so that 0 means empty.
+     *
+     */
+    void buildIndex()
+    {
+        delete[] nameIndex;
+        delete[] symbolIndex;
+        nameIndex = NULL;
+        symbolIndex = NULL;
+        if (count < LOOKUP_INDEX_MIN_COUNT)
+        {
+            return;
+        }
+
+        // Keep the name table at most half full so probes stay short.
+        uint32_t size = 1;
+        while (size < 2 * (uint32_t)count)
+        {
+            size <<= 1;
+        }
+        nameMask = size - 1;
+        nameIndex = new uint16_t[size]();
+        symbolIndex = new uint16_t[256]();
+        for (uint16_t i = 0; i < count; i++)
+        {
+            // Items earlier in the list are inserted first, so are found first.
+            uint32_t slot = hashName(items[i]->name) & nameMask;
+            while (nameIndex[slot])
+            {
+                slot = (slot + 1) & nameMask;
+            }
+            nameIndex[slot] = i + 1;
+
+            uint8_t symbol = items[i]->symbol;
+            if (!symbolIndex[symbol])
+            {
+                symbolIndex[symbol] = i + 1;
+            }
+        }
+    }
+
+    uint16_t *nameIndex = NULL;
+    uint16_t *symbolIndex = NULL;
+    uint32_t nameMask = 0;
 };
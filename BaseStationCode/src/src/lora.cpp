@@ -8,40 +8,110 @@
  */
 
 #include "lora.h"
+#include "telemetry.h"
 
-extern PJONThroughLora bus;
+extern GatewayBus bus;
 extern DeviceManager deviceManager;
 extern QueueHandle_t mqttPublishQueue;
 extern SemaphoreHandle_t serialMutex;
 extern SemaphoreHandle_t mqttMutex;
 extern PubSubClient mqtt;
-extern SemaphoreHandle_t loraMutex;
+extern QueueHandle_t radioQueue;
 extern TaskHandle_t ledTaskHandle;
+extern TaskHandle_t rxDecoderTaskHandle;
 extern SemaphoreHandle_t stateUpdateMutex;
 extern uint32_t lastLoRaTime;
 extern void setAttributeState(const char *const attribute, bool state);
+extern TelemetryCounters telemetryCounters;
 
-void pjonReceive(uint8_t *payload, uint16_t length, const PJON_Packet_Info &packetInfo, int rssi, float snr)
+StaticArena<JSON_ARENA_SIZE> pjonArena; // Only used from the RX decoder task.
+DuplicateFilter duplicateFilter; // Only used from the RX decoder task.
+RxRing rxRing;
+
+bool radioTxQueued[PJON_MAX_PACKETS]; // PJON packets queued by RADIO_SEND and not sent yet. Only used from the radio task.
+
+StackType_t loraWatchdogStack[TASK_LORA_WATCHDOG_STACK];
+StaticTask_t loraWatchdogBuffer;
+
+bool pjonReceive(uint8_t *payload, uint16_t length, const PJON_Packet_Info &packetInfo, int rssi, float snr, RxSource source)
+{
+    // Copy and leave the rest to the decoder task so the radio isn't held up.
+    RxPacket packet;
+    packet.length = length;
+    memcpy(packet.payload, payload, min((size_t)length, sizeof(packet.payload)));
+    packet.info = packetInfo;
+    packet.rssi = rssi;
+    packet.snr = snr;
+    packet.source = source;
+    packet.received = millis();
+#ifdef LATENCY_TRACING
+    packet.rxDone = micros();
+#endif
+    if (!rxRing.push(packet))
+    {
+        return false;
+    }
+    if (rxDecoderTaskHandle)
+    {
+        xTaskNotifyGive(rxDecoderTaskHandle);
+    }
+    return true;
+}
+
+void pjonReceive(uint8_t *payload, uint16_t length, const PJON_Packet_Info &packetInfo)
 {
+    int rssi = bus.strategy.packetRssi();
+    float snr = bus.strategy.packetSnr();
+#ifdef SIMULATE_RADIO
+    pjonReceive(payload, length, packetInfo, rssi, snr, RX_SIMULATED);
+#else
+    pjonReceive(payload, length, packetInfo, rssi, snr, RX_RADIO);
+#endif
+}
+
+void rxDecode(RxPacket &packet)
+{
+#ifdef PACKET_CAPTURE
+    if (packet.source == RX_RADIO)
+    {
+        captureRecord(packet.payload, packet.length, packet.info, packet.rssi, packet.snr, packet.received);
+    }
+#endif
+
     // Get the device, decode the payload and add it to the json object.
+    MqttMsg msg{Topic::TELEMETRY_UPLOAD, ""};
+#ifdef LATENCY_TRACING
+    msg.trace.rxDone = packet.rxDone;
+#endif
     LOGD("PJON", "Received a packet.");
-    Device *device = deviceManager.getWithSymbol((char)(packetInfo.tx.id));
-    if (device)
+    uint8_t sender = packet.info.tx.id;
+    Device *device = deviceManager.getWithSymbol((char)sender);
+    if (packet.source != RX_REPLAYED && duplicateFilter.isDuplicate(sender, packet.payload, packet.length, packet.received))
+    {
+        LOGD("LORA", "Duplicate packet from '%d'. Discarding.", sender);
+    }
+    else if (device)
     {
         // Decode
-        JsonDocument json;
-        device->decodePacketFields(payload, length, json, rssi, snr);
-
-        // Convert to a string
-        MqttMsg msg{Topic::TELEMETRY_UPLOAD, ""};
-        serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
-
-        // Log and send to console
-        xQueueSend(mqttPublishQueue, (void *)&msg, portMAX_DELAY);
+        TRACE_POINT(msg.trace, decodeStart);
+        ArenaScope scope(pjonArena);
+        JsonDocument json(&pjonArena);
+        device->decodePacketFields(packet.payload, packet.length, json, packet.rssi, packet.snr);
+        TRACE_POINT(msg.trace, decodeEnd);
+
+        // Keep track of how much compact keys would save (or are saving).
+        size_t fullLength, compactLength;
+        device->measureKeys(json, fullLength, compactLength);
+        telemetryCounters.readings++;
+        telemetryCounters.bytesFullKeys += fullLength;
+        telemetryCounters.bytesCompactKeys += compactLength;
+
+        // Convert to a string (or several if too long) and queue.
+        telemetryEnqueue(msg, device->name, json, &pjonArena);
     }
     else
     {
-        LOGI("LORA", "Received packet for unkown device '%d'. Discarding.", packetInfo.tx.id);
+        LOGI("LORA", "Received packet for unkown device '%d'. Discarding.", sender);
     }
     xSemaphoreTake(stateUpdateMutex, portMAX_DELAY);
     lastLoRaTime = millis();
@@ -49,9 +119,27 @@ void pjonReceive(uint8_t *payload, uint16_t length, const PJON_Packet_Info &pack
     xTaskNotifyGive(ledTaskHandle); // Tell the led task something changed.
 }
 
-void pjonReceive(uint8_t *payload, uint16_t length, const PJON_Packet_Info &packetInfo)
+void rxDecoderTask(void *pvParameters)
 {
-    pjonReceive(payload, length, packetInfo, bus.strategy.packetRssi(), bus.strategy.packetSnr());
+    RxPacket packet;
+    while (true)
+    {
+        // Notified by pjonReceive for each packet.
+#ifdef PACKET_CAPTURE
+        if (!ulTaskNotifyTake(pdTRUE, CAPTURE_FLUSH_INTERVAL / portTICK_PERIOD_MS))
+        {
+            // Quiet for a while, so save any recorded packets still in RAM.
+            captureFlush();
+            continue;
+        }
+#else
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#endif
+        while (rxRing.pop(packet))
+        {
+            rxDecode(packet);
+        }
+    }
 }
 
 void pjonError(uint8_t code, uint16_t data, void *customPointer)
@@ -60,6 +148,7 @@ void pjonError(uint8_t code, uint16_t data, void *customPointer)
     {
     case PJON_CONNECTION_LOST:
         LOGW("PJON", "Lost connection with device %d.", bus.packets[data].content[0]);
+        radioTxQueued[data] = false; // Given up on, so not reported as sent.
         break;
 
     case PJON_PACKETS_BUFFER_FULL:
@@ -75,162 +164,310 @@ void pjonError(uint8_t code, uint16_t data, void *customPointer)
     }
 }
 
-// void fakeReceiveTask(void *pvParameters)
-// {
-//     const uint32_t TIME_BETWEEN = 20000;
-//     while (true)
-//     {
-//         LOGI("LORA", "Receiving fake pump data");
-//         PJON_Packet_Info info;
-//         info.rx.id = 255;
-//         info.tx.id = 0x5A; // Pressure pump
-//         uint8_t pressurePump[] = {80, 26, 0, 97, 51, 0, 99, 1, 0};
-//         pjonReceive(pressurePump, sizeof(pressurePump) / sizeof(uint8_t), info, -90, 10);
-
-//         delay(TIME_BETWEEN);
-
-//         LOGI("LORA", "Receiving fake pump data 2");
-//         uint8_t pressurePump2[] = {80, 58, 0, 97, 57, 0, 99, 2, 0};
-//         pjonReceive(pressurePump2, sizeof(pressurePump2) / sizeof(uint8_t), info, -87, 5);
-
-//         delay(TIME_BETWEEN);
-
-//         LOGI("LORA", "Receiving fake fence data");
-//         info.tx.id = 0x4A; // Fence
-//         uint8_t electricFence[] = {86, 122, 0, 84, 21, 0, 70, 1, 114, 1, 73, 10};
-//         pjonReceive(electricFence, sizeof(electricFence) / sizeof(uint8_t), info, -20, 25);
-
-//         delay(TIME_BETWEEN);
-
-//         LOGI("LORA", "Receiving fake fence data 2");
-//         uint8_t electricFence2[] = {86, 123, 0, 84, 244, 255, 70, 1, 114, 1, 73, 10};
-//         pjonReceive(electricFence2, sizeof(electricFence2) / sizeof(uint8_t), info, -150, -25);
-
-//         delay(TIME_BETWEEN);
-//     }
-// }
-
 void pjonTask(void *pvParameters)
 {
     // Setup LoRa and PJON
     LOGD("LORA", "Starting bus");
-    xSemaphoreTake(loraMutex, portMAX_DELAY);
     bus.set_acknowledge(false);
     bus.set_receiver(pjonReceive);
     bus.set_error(pjonError);
     // LoRa.setSPIFrequency(4E6);
     SPI.begin(PIN_LORA_SCLK, PIN_LORA_MISO, PIN_LORA_MOSI);
-    bus.strategy.setPins(PIN_LORA_CS, PIN_LORA_RESET, PIN_LORA_DIO);
-    while (!bus.strategy.setFrequency(433E6)) // Calls LoRa.begin()
+    while (!loraInit())
     {
         LOGE("LORA", "Could not set frequency / talk to radio!");
         vTaskDelay(1000/portTICK_PERIOD_MS);
     }
-    bus.strategy.setSpreadingFactor(9); // Crashes with divide by zero if not connected.
-    bus.begin();
-    xSemaphoreGive(loraMutex);
 
-    xTaskCreatePinnedToCore( // TODO: Create this task with all the others.
+    // Started here rather than with the other tasks as the radio needs to be set up first.
+    xTaskCreateStaticPinnedToCore(
         loraWatchdogTask,
         "LoRa Watchdog",
-        2024,
+        sizeof(loraWatchdogStack),
         NULL,
-        1,
-        NULL,
-        1);
-
+        TASK_LORA_WATCHDOG_PRIORITY,
+        loraWatchdogStack,
+        &loraWatchdogBuffer,
+        TASK_LORA_WATCHDOG_CORE);
+
+#ifdef LATENCY_TRACING
+    // Time between servicing the radio. This is kept locally and added to the
+    // shared histograms every so often to avoid taking the mutex each tick.
+    LatencyHistogram loopHistogram;
+    uint32_t lastLoopTime = micros();
+    uint32_t lastMergeTime = millis();
+#endif
     while (true)
     {
         // Check if we have to send or receive anything
-        xSemaphoreTake(loraMutex, portMAX_DELAY);
         bus.update();
+        radioCheckSent();
         bus.receive();
-        xSemaphoreGive(loraMutex);
-        vTaskDelay(1);
+#ifdef PACKET_CAPTURE
+        captureReplayPoll();
+#endif
+        // Handle a request between receiving. Waiting for one instead of a
+        // plain delay means requests are handled straight away.
+        radioPoll(1);
+
+#ifdef LATENCY_TRACING
+        uint32_t now = micros();
+        loopHistogram.add(now - lastLoopTime);
+        lastLoopTime = now;
+        if (millis() - lastMergeTime > RADIO_LOOP_MERGE_INTERVAL)
+        {
+            latencyMergeRadioLoop(loopHistogram);
+            loopHistogram.reset();
+            lastMergeTime = millis();
+        }
+#endif
+    }
+}
+
+bool radioSubmit(const RadioCommand &command, TickType_t timeout)
+{
+    return xQueueSend(radioQueue, (void *)&command, timeout);
+}
+
+bool radioRequest(RadioCommand &command)
+{
+    static std::atomic<uint32_t> nextSequence{0};
+    command.notify = xTaskGetCurrentTaskHandle();
+    command.sequence = nextSequence++ & (UINT32_MAX >> 1);
+    TimeOut_t timeOut;
+    TickType_t remaining = RADIO_REQUEST_TIMEOUT / portTICK_PERIOD_MS;
+    vTaskSetTimeOutState(&timeOut);
+    if (!radioSubmit(command, remaining))
+    {
+        LOGW("LORA", "Radio queue full.");
+        return false;
+    }
+
+    // Replies to earlier requests that timed out may still arrive.
+    uint32_t value;
+    while (xTaskCheckForTimeOut(&timeOut, &remaining) == pdFALSE &&
+           xTaskNotifyWait(0, UINT32_MAX, &value, remaining))
+    {
+        if (value >> 1 == command.sequence)
+        {
+            return value & 1;
+        }
+    }
+    LOGW("LORA", "Radio request timed out.");
+    return false;
+}
+
+void radioCheckSent()
+{
+    for (uint8_t i = 0; i < PJON_MAX_PACKETS; i++)
+    {
+        // PJON removes packets once dispatched (no acknowledgements).
+        if (radioTxQueued[i] && !bus.packets[i].state)
+        {
+            radioTxQueued[i] = false;
+            LOGD("LORA_TX", "Packet sent");
+
+            // Log the time that this was sent.
+            xSemaphoreTake(stateUpdateMutex, portMAX_DELAY);
+            lastLoRaTime = millis();
+            xSemaphoreGive(stateUpdateMutex);
+            xTaskNotifyGive(ledTaskHandle); // Tell the led task something changed.
+        }
     }
 }
 
+/**
+ * @brief Checks if the radio is responding.
+ *
+ */
+static bool radioConnected()
+{
+#ifdef SIMULATE_RADIO
+    return bus.strategy.isConnected();
+#else
+    return LoRa.isConnected();
+#endif
+}
+
+bool radioPoll(TickType_t wait)
+{
+    RadioCommand command;
+    if (!xQueueReceive(radioQueue, (void *)&command, wait))
+    {
+        return false;
+    }
+
+    bool result = false;
+    switch (command.type)
+    {
+    case RADIO_SEND:
+    {
+        // Only queued by PJON here, sent by bus.update() and then reported by
+        // radioCheckSent().
+        uint16_t index = bus.send(command.id, command.payload, command.length);
+        result = index != PJON_FAIL;
+        if (result)
+        {
+            radioTxQueued[index] = true;
+        }
+        else
+        {
+            LOGW("LORA", "Could not queue packet for '%d'.", command.id);
+        }
+        break;
+    }
+
+    case RADIO_PROBE:
+        result = radioConnected();
+        break;
+
+    case RADIO_RESET:
+        // Hardware reset of the radio.
+        pinMode(PIN_LORA_RESET, OUTPUT);
+        digitalWrite(PIN_LORA_RESET, LOW);
+        vTaskDelay(LORA_RESET_PULSE / portTICK_PERIOD_MS);
+        digitalWrite(PIN_LORA_RESET, HIGH);
+        vTaskDelay(LORA_RESET_PULSE / portTICK_PERIOD_MS);
+
+        // Set it up again.
+        result = loraInit() && radioConnected();
+        break;
+    }
+
+    // Let whoever asked know it is done.
+    if (command.notify)
+    {
+        xTaskNotify(command.notify, command.sequence << 1 | result, eSetValueWithOverwrite);
+    }
+    return true;
+}
+
 void loraWatchdogTask(void *pvParameters)
 {
     // Inform the server whether the radio is connected.
-    sendRadioConnectedMsg(LoRa.isConnected());
+    RadioCommand probe = {RADIO_PROBE};
+    sendRadioConnectedMsg(radioRequest(probe));
 
     // Main loop.
-    TickType_t lastWakeTime;
+    TickType_t lastWakeTime = xTaskGetTickCount();
+    uint32_t recoveries = 0;
     while (true)
     {
         // Check if the radio is connected
-        xSemaphoreTake(loraMutex, portMAX_DELAY);
-        bool connected = LoRa.isConnected();
-        xSemaphoreGive(loraMutex);
-        if (!connected)
+        if (!radioRequest(probe))
         {
-            // Not connected. We have issues.
-            LOGE("LORA_WATCHDOG", "LoRa radio is not connected. Resetting");
+            // Not connected. Try resetting just the radio first.
+            LOGE("LORA_WATCHDOG", "LoRa radio is not connected. Resetting the radio.");
             sendRadioConnectedMsg(false);
-            delay(10000);
-            ESP.restart();
+            uint32_t downStart = millis();
+            if (!loraRecover())
+            {
+                // Still not working. Last resort.
+                LOGE("LORA_WATCHDOG", "Could not recover the radio. Restarting.");
+                delay(10000);
+                ESP.restart();
+            }
+
+            // Back again.
+            recoveries++;
+            uint32_t downtime = millis() - downStart;
+            LOGI("LORA_WATCHDOG", "Radio recovered after %lums.", downtime);
+            sendRadioConnectedMsg(true);
+            MqttMsg msg{Topic::TELEMETRY_ME_UPLOAD, ""};
+            LocalArena<JSON_ARENA_SMALL_SIZE> arena;
+            JsonDocument json(&arena);
+            json["radioDownMs"] = downtime;
+            json["radioRecoveries"] = recoveries;
+            serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
+            xQueueSend(mqttPublishQueue, (void *)&msg, portMAX_DELAY);
         }
 
         xTaskDelayUntil(&lastWakeTime, LORA_CHECK_INTERVAL / portTICK_PERIOD_MS);
     }
 }
 
+bool loraInit()
+{
+    bus.strategy.setPins(PIN_LORA_CS, PIN_LORA_RESET, PIN_LORA_DIO);
+    if (!bus.strategy.setFrequency(433E6)) // Calls LoRa.begin()
+    {
+        return false;
+    }
+    bus.strategy.setSpreadingFactor(9); // Crashes with divide by zero if not connected.
+    bus.begin();
+    return true;
+}
+
+bool loraRecover()
+{
+    for (uint8_t attempt = 1; attempt <= LORA_MAX_SOFT_RECOVERIES; attempt++)
+    {
+        LOGW("LORA_WATCHDOG", "Recovery attempt %d of %d.", attempt, LORA_MAX_SOFT_RECOVERIES);
+        RadioCommand reset = {RADIO_RESET};
+        if (radioRequest(reset))
+        {
+            return true;
+        }
+        vTaskDelay(LORA_RECOVERY_DELAY / portTICK_PERIOD_MS);
+    }
+    return false;
+}
+
 void loraTxTask(void *pvParameters)
 {
     bool previousTxState = false;
     sendTxWaitingMsg(false);
+    uint16_t nextDevice = 0; // Take turns so one device can't hog the radio.
     while (true)
     {
-        for (uint8_t i = 0; i < deviceManager.count; i++)
+        int32_t index = deviceManager.nextPending(nextDevice);
+        if (index < 0)
         {
-            // For each device, check if we need to send a packet.
-            Device *device = deviceManager.items[i];
-            if (device->rpcWaiting())
+            // Nothing to send. Sleep until something changes.
+            previousTxState = sendOnTxNotRequired(previousTxState);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        nextDevice = index + 1;
+
+        // Need to send something.
+        Device *device = deviceManager.items[index];
+        LOGD("LORA_TX", "Sending packet to '%s'.", device->name);
+        RadioCommand send = {RADIO_SEND, (uint8_t)device->symbol};
+        int8_t length = device->generatePacket(send.payload, LORA_MAX_PACKET_SIZE);
+        if (length != FIELD_NO_MEMORY)
+        {
+            LOGD("LORA_TX", "Successfully encoded packet of length %d:", length);
+            debugLoRaPacket(send.payload, length);
+            // Send. Don't wait for the radio task as this task is notified
+            // about devices waiting. The radio task logs it and flashes the
+            // LED once it is actually sent.
+            send.length = length;
+            if (!radioSubmit(send, RADIO_REQUEST_TIMEOUT / portTICK_PERIOD_MS))
             {
-                // Need to send something.
-                LOGD("LORA_TX", "Sending packet to '%s'.", deviceManager.items[i]->name);
-                uint8_t payload[LORA_MAX_PACKET_SIZE];
-                int8_t length = device->generatePacket(payload, LORA_MAX_PACKET_SIZE);
-                if (length != FIELD_NO_MEMORY)
-                {
-                    LOGD("LORA_TX", "Successfully encoded packet of length %d:", length);
-                    debugLoRaPacket(payload, length);
-                    // Send
-                    xSemaphoreTake(loraMutex, portMAX_DELAY);
-                    bus.send(device->symbol, payload, length);
-                    xSemaphoreGive(loraMutex);
-                    LOGD("LORA_TX", "Packet sent");
-
-                    // Update the send queue info attribute. Always send each TX so we know it happened.
-                    previousTxState = true;
-                    sendTxWaitingMsg(previousTxState);
-
-                    // Log the time that this was sent.
-                    xSemaphoreTake(stateUpdateMutex, portMAX_DELAY);
-                    lastLoRaTime = millis();
-                    xSemaphoreGive(stateUpdateMutex);
-                    xTaskNotifyGive(ledTaskHandle); // Tell the led task something changed.
-
-                    // Wait for a while between transmissions to allow a reply / fairer spectrum usage.
-                    for (uint i = 0; i < LORA_TX_INTERVAL / 10; i++)
-                    {
-                        vTaskDelay(10 / portTICK_PERIOD_MS);
-                        // Send a no queue message when needed.
-                        previousTxState = sendOnTxNotRequired(previousTxState);
-                    }
-                }
-                else
-                {
-                    // Couldn't encode
-                    LOGE("LORA_TX", "Ran out of memory to encode packet. Will not send.");
-                }
+                LOGW("LORA_TX", "Radio queue full. Will try again.");
             }
+
+            // Update the send queue info attribute. Always send each TX so we know it happened.
+            previousTxState = true;
+            sendTxWaitingMsg(previousTxState);
+        }
+        else
+        {
+            // Couldn't encode. Still wait below so this isn't retried constantly.
+            LOGE("LORA_TX", "Ran out of memory to encode packet. Will not send.");
         }
-        vTaskDelay(10);
 
-        // Send a no queue message when needed.
-        previousTxState = sendOnTxNotRequired(previousTxState);
+        // Wait for a while between transmissions to allow a reply / fairer
+        // spectrum usage. Wake up early when notified to send a no queue
+        // message when needed.
+        TickType_t start = xTaskGetTickCount();
+        TickType_t elapsed;
+        while ((elapsed = xTaskGetTickCount() - start) < LORA_TX_INTERVAL / portTICK_PERIOD_MS)
+        {
+            ulTaskNotifyTake(pdTRUE, LORA_TX_INTERVAL / portTICK_PERIOD_MS - elapsed);
+            previousTxState = sendOnTxNotRequired(previousTxState);
+        }
     }
 }
 
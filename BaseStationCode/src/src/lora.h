@@ -13,10 +13,51 @@
 #include "devices.h"
 #include "networking.h"
 #include "rpc.h"
+#include "arena.h"
+#include "dedup.h"
+#include "capture.h"
+#include "rxring.h"
+#include "simulation.h"
+
+/**
+ * @brief The PJON bus type. The strategy is swapped for the virtual radio with
+ * SIMULATE_RADIO so that everything else runs as normal.
+ *
+ */
+#ifdef SIMULATE_RADIO
+typedef PJON<SimulatedLora> GatewayBus;
+#else
+typedef PJONThroughLora GatewayBus;
+#endif
+
+// Storage for the watchdog task, which is started from pjonTask.
+extern StackType_t loraWatchdogStack[TASK_LORA_WATCHDOG_STACK];
+extern StaticTask_t loraWatchdogBuffer;
+
+/**
+ * @brief Things other tasks can ask the radio task to do.
+ *
+ */
+enum RadioCommandType : uint8_t {RADIO_SEND, RADIO_PROBE, RADIO_RESET};
+
+/**
+ * @brief A request for the radio task, which is the only task that uses the
+ * radio and PJON bus. Requests are handled between receiving packets.
+ *
+ */
+struct RadioCommand
+{
+    RadioCommandType type;
+    uint8_t id; // Device to send to.
+    uint8_t length;
+    uint8_t payload[LORA_MAX_PACKET_SIZE];
+    TaskHandle_t notify; // Task to notify once done, or NULL.
+    uint32_t sequence; // Notification value is (sequence << 1) | result, so late replies can be told apart.
+};
 
 /**
  * @brief Handles an incoming packet received from the radio. Uses the latest
- * received snr and rssi.
+ * received snr and rssi. Called by PJON from the radio task.
  *
  * @param payload the data in the packet.
  * @param length the length of the payload.
@@ -26,15 +67,36 @@ void pjonReceive(uint8_t *payload, uint16_t length, const PJON_Packet_Info &pack
 
 /**
  * @brief Handles an incoming packet received from the radio and adds the given
- * snr and rssi to the packet.
+ * snr and rssi to the packet. The packet is copied to the RX ring for the
+ * decoder task, so this never waits. Must only be called from one task.
  *
  * @param payload the data in the packet.
  * @param length the length of the payload.
  * @param packetInfo information about the packet.
  * @param rssi the rssi of the received packet.
  * @param snr the received snr.
+ * @param source where the packet came from. Only packets from the radio are
+ * recorded with PACKET_CAPTURE and replayed packets skip the duplicate filter.
+ * @return true if the packet was queued.
+ * @return false if it was dropped as the RX ring is full.
+ */
+bool pjonReceive(uint8_t *payload, uint16_t length, const PJON_Packet_Info &packetInfo, int rssi, float snr, RxSource source);
+
+/**
+ * @brief Records, decodes and publishes a packet taken from the RX ring.
+ *
+ * @param packet the packet.
+ */
+void rxDecode(RxPacket &packet);
+
+/**
+ * @brief Task that decodes and publishes the packets in the RX ring. This may
+ * wait for the network, which only lets the ring fill up rather than stopping
+ * the radio.
+ *
+ * @param pvParameters
  */
-void pjonReceive(uint8_t *payload, uint16_t length, const PJON_Packet_Info &packetInfo, int rssi, float snr);
+void rxDecoderTask(void *pvParameters);
 
 /**
  * @brief Logs PJON errors.
@@ -46,26 +108,77 @@ void pjonReceive(uint8_t *payload, uint16_t length, const PJON_Packet_Info &pack
 void pjonError(uint8_t code, uint16_t data, void *customPointer);
 
 /**
- * @brief "Receives" some fake data for testing purposes.
+ * @brief Task that manages the pjon protocol and radio. This owns the radio,
+ * so other tasks need to use radioSubmit() or radioRequest().
  *
  */
-// void fakeReceiveTask(void *pvParameters);
+void pjonTask(void *pvParameters);
 
 /**
- * @brief Task that manages the pjon protocol and radio.
+ * @brief Queues a request for the radio task without waiting for it to be
+ * done.
  *
+ * @param command the request.
+ * @param timeout the time to wait if the queue is full.
+ * @return true if queued.
  */
-void pjonTask(void *pvParameters);
+bool radioSubmit(const RadioCommand &command, TickType_t timeout = portMAX_DELAY);
+
+/**
+ * @brief Queues a request for the radio task and waits until it is done or
+ * RADIO_REQUEST_TIMEOUT passes, so a stuck radio task can't hang the caller.
+ * This uses the calling task's notification, so shouldn't be used from tasks
+ * that are notified for other reasons.
+ *
+ * @param command the request.
+ * @return true if the request succeeded.
+ * @return false if it failed or timed out.
+ */
+bool radioRequest(RadioCommand &command);
+
+/**
+ * @brief Called by the radio task after the bus is serviced to report packets
+ * that have now actually been transmitted.
+ *
+ */
+void radioCheckSent();
+
+/**
+ * @brief Handles the next request for the radio task if there is one.
+ *
+ * @param wait the time to wait for a request.
+ * @return true if a request was handled.
+ */
+bool radioPoll(TickType_t wait);
 
 /**
- * @brief Task that checks if the radio is connected.
+ * @brief Task that checks if the radio is connected. If not, the radio is
+ * reset and set up again (see loraRecover()). The base station is only
+ * restarted if this doesn't work.
  *
  * @param pvParameters
  */
 void loraWatchdogTask(void *pvParameters);
 
 /**
- * @brief Task for sending packets when needed.
+ * @brief Sets up the radio and PJON bus. Used when starting and after
+ * resetting the radio. Only called from the radio task.
+ *
+ * @return true if the radio responded.
+ */
+bool loraInit();
+
+/**
+ * @brief Asks the radio task to reset the radio using its reset pin and set it
+ * up again, trying up to LORA_MAX_SOFT_RECOVERIES times.
+ *
+ * @return true if the radio is working again.
+ */
+bool loraRecover();
+
+/**
+ * @brief Task for sending packets when needed. Sleeps until the device manager
+ * notifies it that a device has something waiting to be sent.
  *
  * @param pvParameters
  */
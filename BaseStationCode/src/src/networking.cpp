@@ -8,6 +8,7 @@
  */
 #include "networking.h"
 #include "rpc.h"
+#include "irlearn.h"
 #ifdef USE_ETHERNET
 extern NetworkClient client;
 extern bool ethernetConnected;
@@ -23,12 +24,22 @@ extern DeviceManager deviceManager;
 extern NetworkState networkState;
 extern SemaphoreHandle_t stateUpdateMutex;
 extern TaskHandle_t ledTaskHandle;
+extern TaskHandle_t networkingTaskHandle;
 extern void mqttReceived(char *topic, byte *message, unsigned int length);
 
+StaticArena<JSON_ARENA_SIZE> networkingArena; // Only used from the networking task (including MQTT callbacks).
+
+#ifdef USE_ETHERNET
+#define WIFI_ATTEMPT_ENDED false // Ethernet comes up by itself.
+#else
+#define WIFI_ATTEMPT_ENDED wifiAttemptEnded
+#endif
+
 #define SET_NETWORK_STATE(STATE)                     \
     xSemaphoreTake(stateUpdateMutex, portMAX_DELAY); \
     networkState = STATE;                            \
-    xSemaphoreGive(stateUpdateMutex)
+    xSemaphoreGive(stateUpdateMutex);                \
+    xTaskNotifyGive(ledTaskHandle) // Tell the led task something changed.
 
 #ifdef USE_ETHERNET
 /**
@@ -47,11 +58,9 @@ void onEthernetEvent(arduino_event_id_t event)
         // The hostname must be set after the interface is started, but needs
         // to be set before DHCP, so set it from the event handler thread.
         ETH.setHostname(OTA_HOSTNAME);
-        SET_NETWORK_STATE(NETWORK_NONE);
         break;
     case ARDUINO_EVENT_ETH_CONNECTED:
         LOGI("ETH", "Connected.");
-        SET_NETWORK_STATE(NETWORK_WIFI_CONNECTING);
         break;
     case ARDUINO_EVENT_ETH_GOT_IP:
         LOGI("ETH", "Got IP address:");
@@ -59,99 +68,167 @@ void onEthernetEvent(arduino_event_id_t event)
         Serial.println(ETH);
         SERIAL_GIVE();
         ethernetConnected = true;
-        // SET_NETWORK_STATE(NETWORK_MQTT_CONNECTING);
         break;
     case ARDUINO_EVENT_ETH_LOST_IP:
         LOGI("ETH", "Lost IP address.");
         ethernetConnected = false;
-        SET_NETWORK_STATE(NETWORK_NONE);
         break;
     case ARDUINO_EVENT_ETH_DISCONNECTED:
         LOGI("ETH", "Disconnected.");
         ethernetConnected = false;
-        SET_NETWORK_STATE(NETWORK_NONE);
         break;
     case ARDUINO_EVENT_ETH_STOP:
         LOGI("ETH", "Stopped.");
         ethernetConnected = false;
-        SET_NETWORK_STATE(NETWORK_NONE);
         break;
     default:
-        break;
+        return;
     }
+    xTaskNotifyGive(networkingTaskHandle); // Wake the state machine.
 }
 #else
+volatile bool wifiAttemptEnded = false; // Set when the access point refuses or drops the connection.
+
 /**
- * @brief Connects to WiFi.
+ * @brief Handles WiFi events by waking the networking task to deal with them.
  *
+ * @param event The event that occurred.
+ * @param info Details of the event.
  */
-void wifiConnect()
+void onWifiEvent(arduino_event_id_t event, arduino_event_info_t info)
 {
-    do
+    switch (event)
     {
-        WiFi.disconnect();
-        LOGI("Networking", "Connecting to '" WIFI_SSID "'.");
-        SET_NETWORK_STATE(NETWORK_WIFI_CONNECTING);
-        WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-        for (uint32_t iterCount = 0; WiFi.status() != WL_CONNECTED && iterCount < WIFI_RECONNECT_ATTEMPT_TIME; iterCount++)
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+        // Ignore the event from disconnecting ourselves before each attempt.
+        if (info.wifi_sta_disconnected.reason != WIFI_REASON_ASSOC_LEAVE)
         {
-            vTaskDelay(1);
+            wifiAttemptEnded = true;
         }
-    } while (WiFi.status() != WL_CONNECTED);
-    LOGI("Networking", "Connected with IP address '%s'.", WiFi.localIP().toString().c_str());
+        xTaskNotifyGive(networkingTaskHandle);
+        break;
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+    case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+        xTaskNotifyGive(networkingTaskHandle);
+        break;
+    default:
+        break;
+    }
 }
-#endif
 
-/**
- * @brief Connects to the MQTT broker.
- */
-void mqttConnect()
+bool wifiStartConnecting(bool useCache, uint32_t &leaseExpiry)
 {
-    xSemaphoreTake(mqttMutex, portMAX_DELAY);
-    LOGI("Networking", "Connecting to MQTT broker '" MQTT_BROKER "' on port " xstringify(MQTT_PORT) ".");
-    SET_NETWORK_STATE(NETWORK_MQTT_CONNECTING);
-    mqtt.setServer(MQTT_BROKER, MQTT_PORT);
-    mqtt.setCallback(mqttReceived);
-    mqttSetup();
-    int iterations = 0;
-    while (!mqtt.connected())
+    WiFi.disconnect();
+    wifiAttemptEnded = false;
+    WifiCache cache;
+    time_t now = time(NULL);
+    if (useCache && wifiLoadCache(cache) && now >= TIME_VALID_AFTER && now < cache.leaseExpiry)
     {
-        vTaskDelay(1000 * portTICK_PERIOD_MS);
+        // Skip the scan and DHCP by going straight to the last access point
+        // with the last address.
+        LOGI("Networking", "Connecting to '" WIFI_SSID "' on channel %d using the cached details.", cache.channel);
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+        WiFi.begin(WIFI_SSID, WIFI_PASSWORD, cache.channel, cache.bssid);
+        leaseExpiry = cache.leaseExpiry;
+        return true;
+    }
 
+    // Full scan and DHCP.
+    LOGI("Networking", "Connecting to '" WIFI_SSID "'.");
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+    return false;
+}
+
+bool wifiLoadCache(WifiCache &cache)
+{
+    Preferences preferences;
+    preferences.begin(WIFI_CACHE_NAMESPACE, true);
+    bool valid = preferences.getBytes("cache", &cache, sizeof(cache)) == sizeof(cache);
+    preferences.end();
+    return valid;
+}
+
+bool wifiSaveCache(uint32_t linkUpTime)
+{
+    // The lease is stored as a time so it can be checked after restarting.
+    time_t now = time(NULL);
+    uint32_t lease = wifiLeaseTime();
+    if (now < TIME_VALID_AFTER || !lease)
+    {
+        return false;
+    }
+
+    WifiCache cache = {}; // Zeroed so the padding compares equal.
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.ip = WiFi.localIP();
+    cache.gateway = WiFi.gatewayIP();
+    cache.subnet = WiFi.subnetMask();
+    cache.dns = WiFi.dnsIP();
+    cache.leaseExpiry = now - (millis() - linkUpTime) / 1000 + lease;
+
+    // Only write when something changed to save wearing out the flash.
+    WifiCache previous = {};
+    if (wifiLoadCache(previous) && memcmp(&previous, &cache, sizeof(cache)) == 0)
+    {
+        return true;
+    }
+    Preferences preferences;
+    preferences.begin(WIFI_CACHE_NAMESPACE, false);
+    preferences.putBytes("cache", &cache, sizeof(cache));
+    preferences.end();
+    LOGI("Networking", "Saved the WiFi details for next time (lease of %lus).", lease);
+    return true;
+}
+
+void wifiClearCache()
+{
+    Preferences preferences;
+    preferences.begin(WIFI_CACHE_NAMESPACE, false);
+    preferences.remove("cache");
+    preferences.end();
+}
+
+uint32_t wifiLeaseTime()
+{
+    // Not exposed by esp_netif, so read it from lwIP.
+    struct netif *netif = (struct netif *)esp_netif_get_netif_impl(WiFi.STA.netif());
+    struct dhcp *dhcp = netif ? netif_dhcp_data(netif) : NULL;
+    return dhcp && dhcp->state == DHCP_STATE_BOUND ? dhcp->offered_t0_lease : 0;
+}
+#endif
+
+bool networkLinkUp()
+{
 #ifdef USE_ETHERNET
-        // Wait until ethernet is connected.
-        if (!ethernetConnected)
-        {
-            LOGD("Networking", "Waiting for ethernet to connect.");
-            while(!ethernetConnected)
-            {
-                vTaskDelay(10 * portTICK_PERIOD_MS);
-            }
-            LOGD("Networking", "Ethernet is now connected.");
-            SET_NETWORK_STATE(NETWORK_MQTT_CONNECTING);
-        }
+    return ethernetConnected;
 #else
-        // Check if WiFi is connected and reconnect if needed.
-        if (WiFi.status() != WL_CONNECTED)
-        {
-            wifiConnect();
-            SET_NETWORK_STATE(NETWORK_MQTT_CONNECTING);
-        }
+    // Also wait for an address, as DHCP may still be running after the cache
+    // was dropped.
+    return WiFi.status() == WL_CONNECTED && WiFi.localIP() != INADDR_NONE;
 #endif
-        // Attempt to start the connection every so often.
-        iterations++;
-        if (iterations == MQTT_RETRY_ITERATIONS)
-        {
-            LOGD("Networking", "Having another go at connecting MQTT.");
-            mqttSetup();
-            iterations = 0;
-        }
+}
+
+/**
+ * @brief Makes a single attempt to connect to the MQTT broker and subscribe.
+ * Connecting can block for a while, so the MQTT mutex is only taken once
+ * connected. This is safe as only the networking task uses the client.
+ *
+ * @return true if connected.
+ */
+bool mqttConnect()
+{
+    LOGI("Networking", "Connecting to MQTT broker '" MQTT_BROKER "' on port " xstringify(MQTT_PORT) ".");
+    if (!mqtt.connect(THINGSBOARD_NAME, THINGSBOARD_TOKEN, NULL))
+    {
+        return false;
     }
-    LOGI("Networking", "Connected to broker.");
+    xSemaphoreTake(mqttMutex, portMAX_DELAY);
+    mqttSetup();
+    bool connected = mqtt.connected();
     xSemaphoreGive(mqttMutex);
-    setVersionAttribute(); // Needs to publish directy in case queue is full.
-    setAirConditionerAttributeInitial();  // Needs to publish directy in case queue is full.
-    deviceManager.connectDevices(); // Publish the connected devices
+    return connected;
 }
 
 /**
@@ -160,72 +237,367 @@ void mqttConnect()
  */
 void mqttSetup()
 {
-    mqtt.connect(THINGSBOARD_NAME, THINGSBOARD_TOKEN, NULL);
     mqtt.subscribe(Topic::RPC_GATEWAY);
     mqtt.subscribe(Topic::RPC_ME_SUBSCRIBE);
+    mqtt.subscribe(Topic::ATTRIBUTE_ME_UPLOAD); // Shared attribute updates.
+}
+
+/**
+ * @brief Publishes everything needed after (re)connecting.
+ *
+ * @param outageTime how long it took to reconnect in ms, or 0 if this is the
+ * first connection.
+ * @param reconnects the number of times the connection has been lost.
+ */
+void mqttConnected(uint32_t outageTime, uint32_t reconnects)
+{
+    LOGI("Networking", "Connected to broker.");
+    setVersionAttribute(); // Needs to publish directy in case queue is full.
+    if (!reconnects)
+    {
+        // Time from boot until the first message was published.
+        uint32_t bootToPublish = millis();
+        LOGI("Networking", "First publish %lums after booting.", bootToPublish);
+        ArenaScope scope(networkingArena);
+        JsonDocument json(&networkingArena);
+        json["bootToPublishMs"] = bootToPublish;
+        xSemaphoreTake(mqttMutex, portMAX_DELAY);
+        mqttPublishJson(Topic::ATTRIBUTE_ME_UPLOAD, json);
+        xSemaphoreGive(mqttMutex);
+    }
+    setAirConditionerAttributeInitial();  // Needs to publish directy in case queue is full.
+    deviceManager.connectDevices(); // Publish the connected devices
+
+    if (reconnects)
+    {
+        // Record how long the outage lasted. Published directly as the queue
+        // may be full after being disconnected.
+        LOGI("Networking", "Reconnected after %lums.", outageTime);
+        ArenaScope scope(networkingArena);
+        JsonDocument json(&networkingArena);
+        json["reconnectMs"] = outageTime;
+        json["reconnects"] = reconnects;
+        xSemaphoreTake(mqttMutex, portMAX_DELAY);
+        mqttPublishJson(Topic::TELEMETRY_ME_UPLOAD, json);
+        xSemaphoreGive(mqttMutex);
+    }
+}
+
+/**
+ * @brief Services the MQTT connection and publishes one queued message if there
+ * is one.
+ *
+ */
+void mqttService()
+{
+    // Thread safe mqtt operations.
+    xSemaphoreTake(mqttMutex, portMAX_DELAY);
+    mqtt.loop();
+
+    // Check if there is anything to publish
+    MqttMsg msg;
+    int result = xQueueReceive(mqttPublishQueue, (void *)&msg, 0);
+    if (result)
+    {
+        // Something needs to be published.
+        TRACE_POINT(msg.trace, dequeued);
+        LOGI("Networking", "Publishing on topic '%s' message '%s'", msg.topic, msg.payload);
+        mqttPublishText(msg.topic, msg.payload);
+        TRACE_POINT(msg.trace, published);
+    }
+    xSemaphoreGive(mqttMutex);
+#ifdef LATENCY_TRACING
+    if (result)
+    {
+        latencyRecord(msg.trace);
+    }
+#endif
 }
 
 /**
  * Task that manages connecting to WiFi and MQTT and remaining connected.
+ *
+ * This is a state machine woken by network events. Failed attempts to bring up
+ * the link or connect to the broker are retried using jittered exponential
+ * backoff, waiting on notifications in between so nothing is held.
  */
 void networkingTask(void *pvParameters)
 {
-    SET_NETWORK_STATE(NETWORK_NONE);
+    // Set here rather than from setup() as events can arrive as soon as they are registered.
+    networkingTaskHandle = xTaskGetCurrentTaskHandle();
+    NetworkState state = NETWORK_NONE;
+    SET_NETWORK_STATE(state);
+    mqtt.setBufferSize(MQTT_RX_BUFFER_SIZE, MQTT_TX_BUFFER_SIZE);
+    mqtt.setServer(MQTT_BROKER, MQTT_PORT);
+    mqtt.setCallback(mqttReceived);
+    configTime(0, 0, NTP_SERVER); // Syncs in the background once connected.
 #ifdef USE_ETHERNET
     Network.onEvent(onEthernetEvent);
     ETH.begin();
+#else
+    WiFi.setAutoReconnect(false); // Handled here with backoff.
+    WiFi.onEvent(onWifiEvent);
+#endif
+
+    Backoff linkBackoff(BACKOFF_MIN, BACKOFF_MAX);
+    Backoff mqttBackoff(BACKOFF_MIN, BACKOFF_MAX);
+    uint32_t nextAttempt = millis();
+    uint32_t outageStart = millis();
+    uint32_t reconnects = 0;
+#ifndef USE_ETHERNET
+    bool useWifiCache = true;
+    bool fastAttempt = false;
+    bool cachedLink = false; // Link is using the cached address rather than DHCP.
+    bool cachePending = false; // DHCP lease to save once the clock is set.
+    uint32_t leaseExpiry = 0;
+    uint32_t linkUpTime = 0;
 #endif
-    mqtt.setBufferSize(500, 500);
     while (true)
     {
-#ifdef USE_ETHERNET
-        if (!ethernetConnected)
+        uint32_t now = millis();
+        bool linkUp = networkLinkUp();
+        NetworkState nextState = state;
+        switch (state)
         {
-            LOGW("Networking", "Waiting for ethernet to become available.");
-            while (!ethernetConnected)
+        case NETWORK_NONE:
+            // Waiting to try bringing the link up.
+            if (linkUp)
+            {
+                nextState = NETWORK_MQTT_CONNECTING;
+            }
+#ifndef USE_ETHERNET
+            else if ((int32_t)(now - nextAttempt) >= 0)
+            {
+                fastAttempt = wifiStartConnecting(useWifiCache, leaseExpiry);
+                nextAttempt = now + (fastAttempt ? WIFI_FAST_CONNECT_TIME : WIFI_RECONNECT_ATTEMPT_TIME);
+                nextState = NETWORK_WIFI_CONNECTING;
+            }
+#endif
+            break;
+
+        case NETWORK_WIFI_CONNECTING:
+            // Link is coming up (Ethernet comes up by itself).
+            if (linkUp)
             {
-                vTaskDelay(10/portTICK_PERIOD_MS);
+                LOGI("Networking", "Link up.");
+#ifndef USE_ETHERNET
+                // Only a real DHCP lease is saved for next time.
+                cachedLink = fastAttempt;
+                cachePending = !fastAttempt;
+                linkUpTime = now;
+                useWifiCache = true;
+#endif
+                linkBackoff.reset();
+                nextAttempt = now;
+                nextState = NETWORK_MQTT_CONNECTING;
+            }
+#ifndef USE_ETHERNET
+            else if (fastAttempt && (wifiAttemptEnded || (int32_t)(now - nextAttempt) >= 0))
+            {
+                // The cached details didn't work, so do a full scan straight away.
+                LOGW("Networking", "Could not connect using the cached details. Scanning.");
+                useWifiCache = false;
+                nextAttempt = now;
+                nextState = NETWORK_NONE;
+            }
+#endif
+            else if (WIFI_ATTEMPT_ENDED || (int32_t)(now - nextAttempt) >= 0)
+            {
+                // Timed out or the access point refused the connection.
+                uint32_t retryTime = linkBackoff.next();
+                LOGW("Networking", "Could not bring the link up. Trying again in %lums.", retryTime);
+                nextAttempt = now + retryTime;
+                nextState = NETWORK_NONE;
+            }
+            break;
+
+        case NETWORK_MQTT_CONNECTING:
+            if (!linkUp)
+            {
+                nextState = NETWORK_NONE;
+            }
+            else if ((int32_t)(now - nextAttempt) >= 0)
+            {
+                if (mqttConnect())
+                {
+                    mqttBackoff.reset();
+                    mqttConnected(reconnects ? millis() - outageStart : 0, reconnects);
+                    nextState = NETWORK_CONNECTED;
+                }
+#ifndef USE_ETHERNET
+                else if (cachedLink)
+                {
+                    // The cached address may have been given to something else
+                    // or the network changed. Get a new one with DHCP.
+                    LOGW("Networking", "Could not connect to MQTT using the cached address. Using DHCP.");
+                    wifiClearCache();
+                    useWifiCache = false;
+                    cachedLink = false;
+                    fastAttempt = wifiStartConnecting(false, leaseExpiry);
+                    nextAttempt = millis() + WIFI_RECONNECT_ATTEMPT_TIME;
+                    nextState = NETWORK_WIFI_CONNECTING;
+                }
+#endif
+                else
+                {
+                    uint32_t retryTime = mqttBackoff.next();
+                    LOGW("Networking", "Could not connect to MQTT (state %d). Trying again in %lums.", mqtt.state(), retryTime);
+                    nextAttempt = millis() + retryTime;
+                }
+            }
+            break;
+
+        case NETWORK_CONNECTED:
+        default:
+            if (!linkUp || !mqtt.connected())
+            {
+                LOGW("Networking", "Lost the %s connection.", linkUp ? "MQTT" : "network");
+                outageStart = now;
+                reconnects++;
+                nextAttempt = now;
+                nextState = linkUp ? NETWORK_MQTT_CONNECTING : NETWORK_NONE;
+            }
+#ifndef USE_ETHERNET
+            else if (cachedLink && time(NULL) >= leaseExpiry)
+            {
+                // Don't keep using the address past the end of the lease.
+                LOGI("Networking", "The cached lease has ended. Using DHCP.");
+                xSemaphoreTake(mqttMutex, portMAX_DELAY);
+                mqtt.disconnect();
+                xSemaphoreGive(mqttMutex);
+                outageStart = now;
+                reconnects++;
+                cachedLink = false;
+                fastAttempt = wifiStartConnecting(false, leaseExpiry);
+                nextAttempt = now + WIFI_RECONNECT_ATTEMPT_TIME;
+                nextState = NETWORK_WIFI_CONNECTING;
+            }
+#endif
+            else
+            {
+#ifndef USE_ETHERNET
+                if (cachePending && wifiSaveCache(linkUpTime))
+                {
+                    cachePending = false;
+                }
+#endif
+                mqttService();
+#ifdef PIN_IR_RX
+                irLearnPoll();
+#endif
             }
-            vTaskDelay(RECONNECT_DELAY / portTICK_PERIOD_MS);
-            mqttConnect(); // Force reconnection.
+            break;
         }
-#else
-        // Connect to WiFi
-        if (WiFi.status() != WL_CONNECTED)
+
+        // Update the state for the LEDs.
+        if (nextState != state)
         {
-            SET_NETWORK_STATE(NETWORK_NONE);
-            LOGW("Networking", "LOST WIFI CONNECTION!!!");
-            vTaskDelay(RECONNECT_DELAY / portTICK_PERIOD_MS);
-            wifiConnect();
-            vTaskDelay(RECONNECT_DELAY / portTICK_PERIOD_MS);
-            mqttConnect(); // Force reconnection to mqtt after messing with WiFi.
+            state = nextState;
+            SET_NETWORK_STATE(state);
+            continue; // Act on the new state straight away.
         }
-#endif
-        // Connect to MQTT
-        if (!mqtt.connected())
+
+        // Wait until something happens or the next attempt is due.
+        if (state == NETWORK_CONNECTED)
+        {
+            taskYIELD();
+        }
+        else
         {
-            LOGW("Networking", "LOST MQTT CONNECTION!!!");
-            vTaskDelay(RECONNECT_DELAY / portTICK_PERIOD_MS);
-            mqttConnect();
+            int32_t wait = nextAttempt - millis();
+            wait = constrain(wait, 1, NETWORK_POLL_INTERVAL);
+            ulTaskNotifyTake(pdTRUE, wait / portTICK_PERIOD_MS);
         }
+    }
+}
 
-        // Should be connected if we reached this point.
-        SET_NETWORK_STATE(NETWORK_CONNECTED);
+Backoff::Backoff(uint32_t minimum, uint32_t maximum) : m_minimum(minimum), m_maximum(maximum), m_current(minimum) {}
 
-        // Thread safe mqtt operations.
-        xSemaphoreTake(mqttMutex, portMAX_DELAY);
-        mqtt.loop();
+uint32_t Backoff::next()
+{
+    // Full jitter between half and all of the current delay so that many
+    // gateways don't all retry at once.
+    uint32_t retryTime = m_current / 2 + esp_random() % (m_current / 2 + 1);
+    m_current = min(m_current * 2, m_maximum);
+    return retryTime;
+}
 
-        // Check if there is anything to publish
-        MqttMsg msg;
-        int result = xQueueReceive(mqttPublishQueue, (void *)&msg, 0);
-        if (result)
+void Backoff::reset()
+{
+    m_current = m_minimum;
+}
+
+size_t MqttStreamWriter::write(uint8_t c)
+{
+    if (m_length == MQTT_STREAM_CHUNK)
+    {
+        flush();
+    }
+    if (m_failed)
+    {
+        // Tells ArduinoJson to stop.
+        return 0;
+    }
+    m_buffer[m_length++] = c;
+    return 1;
+}
+
+size_t MqttStreamWriter::write(const uint8_t *buffer, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (!write(buffer[i]))
         {
-            // Something needs to be published.
-            LOGI("Networking", "Publishing on topic '%s' message '%s'", msg.topic, msg.payload);
-            mqtt.publish(msg.topic, msg.payload);
+            return i;
         }
-        xSemaphoreGive(mqttMutex);
-        taskYIELD();
     }
-}
\ No newline at end of file
+    return size;
+}
+
+void MqttStreamWriter::flush()
+{
+    if (m_length && !m_failed)
+    {
+        m_failed = m_client.write(m_buffer, m_length) != m_length;
+    }
+    m_length = 0;
+}
+
+bool mqttPublishJson(const char *topic, JsonVariantConst json)
+{
+    // The length has to be known before starting.
+    size_t length = measureJson(json);
+    if (!mqtt.beginPublish(topic, length, false))
+    {
+        LOGW("Networking", "Could not start publishing %d bytes to '%s'.", length, topic);
+        return false;
+    }
+    MqttStreamWriter writer(mqtt);
+    serializeJson(json, writer);
+    writer.flush();
+    bool ended = mqtt.endPublish();
+    if (writer.failed())
+    {
+        LOGW("Networking", "Could not write all %d bytes to '%s'.", length, topic);
+        return false;
+    }
+    return ended;
+}
+
+bool mqttPublishText(const char *topic, const char *text)
+{
+    size_t length = strlen(text);
+    if (!mqtt.beginPublish(topic, length, false))
+    {
+        LOGW("Networking", "Could not start publishing %d bytes to '%s'.", length, topic);
+        return false;
+    }
+    bool written = mqtt.write((const uint8_t *)text, length) == length;
+    bool ended = mqtt.endPublish();
+    if (!written)
+    {
+        LOGW("Networking", "Could not write all %d bytes to '%s'.", length, topic);
+        return false;
+    }
+    return ended;
+}
@@ -10,21 +10,175 @@
 #include "../defines.h"
 #include "devices.h"
 #include "lora.h"
+#include "latency.h"
+#include "arena.h"
 
 struct MqttMsg
 {
     const char* topic;
     char payload[MAX_JSON_TEXT_LENGTH];
+#ifdef LATENCY_TRACING
+    PacketTrace trace;
+#endif
+};
+
+/**
+ * @brief Collects the small writes made by ArduinoJson when serialising into
+ * chunks before writing them to the MQTT client, as each write to the client
+ * is sent straight to the socket.
+ *
+ */
+class MqttStreamWriter : public Print
+{
+public:
+    MqttStreamWriter(PubSubClient &client) : m_client(client) {}
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    /**
+     * @brief Sends anything that is still buffered.
+     *
+     */
+    void flush();
+
+    /**
+     * @brief Checks if any part of the message could not be sent. Nothing more
+     * is written after a failure.
+     *
+     */
+    bool failed() const { return m_failed; }
+
+private:
+    PubSubClient &m_client;
+    uint8_t m_buffer[MQTT_STREAM_CHUNK];
+    size_t m_length = 0;
+    bool m_failed = false;
 };
 
 enum NetworkState {NETWORK_NONE, NETWORK_WIFI_CONNECTING, NETWORK_MQTT_CONNECTING, NETWORK_CONNECTED};
 
+/**
+ * @brief Retry delays that double after each failure, with random jitter.
+ *
+ */
+class Backoff
+{
+public:
+    Backoff(uint32_t minimum, uint32_t maximum);
+
+    /**
+     * @brief Returns how long to wait before the next attempt and increases
+     * the delay for next time.
+     *
+     */
+    uint32_t next();
+
+    /**
+     * @brief Goes back to the minimum delay after a success.
+     *
+     */
+    void reset();
+
+private:
+    const uint32_t m_minimum;
+    const uint32_t m_maximum;
+    uint32_t m_current;
+};
+
 #ifdef USE_ETHERNET
 void onEthernetEvent(arduino_event_id_t event);
 #else
-void wifiConnect();
+/**
+ * @brief Details of the last successful WiFi connection, kept in NVS so the
+ * scan and DHCP can be skipped when reconnecting. The address is only reused
+ * until the DHCP lease it came from runs out.
+ *
+ */
+struct WifiCache
+{
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint32_t leaseExpiry; // Unix time the lease ends.
+};
+
+void onWifiEvent(arduino_event_id_t event, arduino_event_info_t info);
+
+/**
+ * @brief Starts connecting to WiFi without waiting for the result.
+ *
+ * @param useCache whether to try the cached access point and address first.
+ * The cache is only used if the clock is set and the lease hasn't ended.
+ * @param leaseExpiry set to when the cached lease ends if it is used.
+ * @return true if the cached details are being used.
+ */
+bool wifiStartConnecting(bool useCache, uint32_t &leaseExpiry);
+
+/**
+ * @brief Loads the cached WiFi details.
+ *
+ * @param cache where to put the details.
+ * @return true if there were details saved.
+ */
+bool wifiLoadCache(WifiCache &cache);
+
+/**
+ * @brief Saves the details of the current WiFi connection if they changed.
+ * Must only be used when the address came from DHCP.
+ *
+ * @param linkUpTime millis() when the lease was obtained.
+ * @return true if saved (or unchanged). false if the clock isn't set yet or
+ * the lease time isn't known, so this should be tried again later.
+ */
+bool wifiSaveCache(uint32_t linkUpTime);
+
+/**
+ * @brief Forgets the cached WiFi details.
+ *
+ */
+void wifiClearCache();
+
+/**
+ * @brief Returns the length of the current DHCP lease in seconds, or 0 if not
+ * using DHCP.
+ *
+ */
+uint32_t wifiLeaseTime();
 #endif
+
+/**
+ * @brief Returns true if the network link (WiFi or Ethernet) is up.
+ *
+ */
+bool networkLinkUp();
 void mqttReceived(char *topic, byte *message, unsigned int length);
-void mqttConnect();
+bool mqttConnect();
 void mqttSetup();
-void networkingTask(void *pvParameters);
\ No newline at end of file
+void mqttConnected(uint32_t outageTime, uint32_t reconnects);
+void mqttService();
+void networkingTask(void *pvParameters);
+
+/**
+ * @brief Publishes a JSON document by serialising it straight into the MQTT
+ * connection. The payload isn't limited by the MQTT buffer size. mqttMutex must
+ * be held (or be called from the networking task).
+ *
+ * @param topic the topic to publish to.
+ * @param json the document to publish.
+ * @return true if the whole message was sent.
+ */
+bool mqttPublishJson(const char *topic, JsonVariantConst json);
+
+/**
+ * @brief Publishes a string without copying it into the MQTT buffer first.
+ * mqttMutex must be held (or be called from the networking task).
+ *
+ * @param topic the topic to publish to.
+ * @param text the null terminated payload.
+ * @return true if the whole message was sent.
+ */
+bool mqttPublishText(const char *topic, const char *text);
\ No newline at end of file
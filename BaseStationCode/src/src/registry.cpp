@@ -0,0 +1,239 @@
+/**
+ * @file registry.cpp
+ * @brief Loads the list of devices and their fields at runtime so that new
+ * nodes can be added without reflashing.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-02-22
+ */
+#include "registry.h"
+#include "rpc.h"
+
+extern SemaphoreHandle_t serialMutex;
+extern QueueHandle_t rpcQueue;
+
+bool registryLoad(DeviceManager &manager)
+{
+    File file = LittleFS.open(REGISTRY_PATH, "r");
+    if (!file)
+    {
+        LOGI("REGISTRY", "No registry in flash, using the built in devices.");
+        return false;
+    }
+
+    // Only happens once at boot, so fine to use the heap.
+    JsonDocument json;
+    DeserializationError error = deserializeJson(json, file);
+    file.close();
+    if (error)
+    {
+        LOGE("REGISTRY", "Could not parse " REGISTRY_PATH " (%s). Using the built in devices.", error.c_str());
+        return false;
+    }
+    if (!registryValidate(json))
+    {
+        LOGE("REGISTRY", "Invalid registry. Using the built in devices.");
+        return false;
+    }
+
+    Device **devices;
+    uint16_t count = registryBuild(json, devices);
+    manager.setItems(devices, count);
+    LOGI("REGISTRY", "Loaded %d devices from flash.", count);
+    return true;
+}
+
+void registryHandleAttributes(uint8_t *message, unsigned int length)
+{
+    JsonDocument json;
+    DeserializationError error = deserializeJson(json, message, length);
+    if (error)
+    {
+        LOGW("REGISTRY", "Could not deserialise the attributes. Discarding.");
+        return;
+    }
+
+    JsonVariantConst registry = json["deviceRegistry"];
+    if (registry.isNull())
+    {
+        // Some other attribute.
+        return;
+    }
+
+    if (!registryValidate(registry))
+    {
+        LOGW("REGISTRY", "Received an invalid registry. Ignoring.");
+        return;
+    }
+
+    // Check if anything changed to avoid restarting for nothing.
+    size_t newLength = measureJson(registry);
+    File file = LittleFS.open(REGISTRY_PATH, "r");
+    if (file)
+    {
+        bool same = false;
+        if (file.size() == newLength)
+        {
+            JsonDocument current;
+            same = !deserializeJson(current, file) && current.as<JsonVariantConst>() == registry;
+        }
+        file.close();
+        if (same)
+        {
+            LOGD("REGISTRY", "Registry unchanged.");
+            return;
+        }
+    }
+
+    // Save and restart to apply.
+    file = LittleFS.open(REGISTRY_PATH, "w");
+    if (!file)
+    {
+        LOGE("REGISTRY", "Could not open " REGISTRY_PATH " to write.");
+        return;
+    }
+    serializeJson(registry, file);
+    file.close();
+    LOGI("REGISTRY", "Saved a new registry. Restarting in a few seconds to apply it.");
+
+    // Called from the networking task, so let the RPC task restart once MQTT
+    // has had a chance to send anything waiting.
+    RpcJob job;
+    job.type = RPC_JOB_RESET;
+    strlcpy(job.id, "registry", sizeof(job.id));
+    if (!xQueueSend(rpcQueue, (void *)&job, 0))
+    {
+        // The RPC task is stuck, which is a good reason to restart anyway.
+        LOGW("REGISTRY", "Could not queue the restart. Restarting now.");
+        ESP.restart();
+    }
+}
+
+bool registryValidate(JsonVariantConst registry)
+{
+    JsonArrayConst devices = registry["devices"];
+    if (devices.isNull() || devices.size() == 0 || devices.size() > UINT16_MAX)
+    {
+        LOGW("REGISTRY", "Need between 1 and %d devices.", UINT16_MAX);
+        return false;
+    }
+
+    for (size_t deviceIndex = 0; deviceIndex < devices.size(); deviceIndex++)
+    {
+        JsonObjectConst device = devices[deviceIndex];
+        const char *name = device["name"];
+        int id = device["id"] | 0;
+        JsonArrayConst fields = device["fields"];
+        if (!name || id <= 0 || id >= PJON_DEVICE_ID || fields.isNull() || fields.size() > UINT8_MAX)
+        {
+            LOGW("REGISTRY", "Device is missing a name, id or fields, or has an invalid id.");
+            return false;
+        }
+
+        // Lookups by id and name only ever find the first match.
+        for (size_t other = 0; other < deviceIndex; other++)
+        {
+            const char *otherName = devices[other]["name"];
+            if ((devices[other]["id"] | 0) == id || STRINGS_MATCH(otherName, name))
+            {
+                LOGW("REGISTRY", "Device '%s' (%d) has the same id or name as another.", name, id);
+                return false;
+            }
+        }
+
+        for (size_t fieldIndex = 0; fieldIndex < fields.size(); fieldIndex++)
+        {
+            JsonObjectConst field = fields[fieldIndex];
+            const char *fieldName = field["name"];
+            const char *symbol = field["sym"];
+            const char *scale = field["scale"];
+            FieldWireType type;
+            if (!fieldName || !symbol || !registryWireType(field["type"].as<const char *>(), type))
+            {
+                LOGW("REGISTRY", "Field in '%s' is missing a name, symbol or type.", name);
+                return false;
+            }
+            if (!registrySymbolValid(symbol))
+            {
+                LOGW("REGISTRY", "Field '%s' in '%s' has an invalid symbol.", fieldName, name);
+                return false;
+            }
+            for (size_t other = 0; other < fieldIndex; other++)
+            {
+                const char *otherSymbol = fields[other]["sym"];
+                if (STRINGS_MATCH(otherSymbol, symbol))
+                {
+                    LOGW("REGISTRY", "Symbol '%s' is used by more than one field in '%s'.", symbol, name);
+                    return false;
+                }
+            }
+            if (scale && !STRINGS_MATCH(scale, "tenths") && !STRINGS_MATCH(scale, "halves"))
+            {
+                LOGW("REGISTRY", "Field '%s' has an unknown scale '%s'.", fieldName, scale);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+uint16_t registryBuild(JsonVariantConst registry, Device **&devices)
+{
+    JsonArrayConst devicesJson = registry["devices"];
+    uint16_t count = devicesJson.size();
+    devices = new Device *[count];
+    uint16_t deviceIndex = 0;
+    for (JsonObjectConst deviceJson : devicesJson)
+    {
+        // Create each field.
+        JsonArrayConst fieldsJson = deviceJson["fields"];
+        uint8_t fieldCount = fieldsJson.size();
+        Field **fields = new Field *[fieldCount];
+        uint8_t fieldIndex = 0;
+        for (JsonObjectConst fieldJson : fieldsJson)
+        {
+            FieldWireType type;
+            registryWireType(fieldJson["type"].as<const char *>(), type);
+            FieldScale scale = SCALE_NONE;
+            const char *scaleName = fieldJson["scale"];
+            if (scaleName)
+            {
+                scale = STRINGS_MATCH(scaleName, "tenths") ? SCALE_TENTHS : SCALE_HALVES;
+            }
+            fields[fieldIndex++] = new Field(strdup(fieldJson["name"].as<const char *>()), fieldJson["sym"].as<const char *>()[0], type, scale, fieldJson["set"] | false);
+        }
+
+        // Create the device.
+        LookupManager<Field> *fieldManager = new LookupManager<Field>(fields, fieldCount);
+        devices[deviceIndex++] = new Device(strdup(deviceJson["name"].as<const char *>()), deviceJson["id"].as<uint8_t>(), *fieldManager);
+    }
+    return count;
+}
+
+bool registryWireType(const char *name, FieldWireType &type)
+{
+    if (!name)
+    {
+        return false;
+    }
+
+    const char *const names[] = {"flag", "u8", "i8", "u16", "i16", "u32"};
+    const FieldWireType types[] = {WIRE_FLAG, WIRE_U8, WIRE_I8, WIRE_U16, WIRE_I16, WIRE_U32};
+    for (uint8_t i = 0; i < sizeof(types) / sizeof(FieldWireType); i++)
+    {
+        if (STRINGS_MATCH(name, names[i]))
+        {
+            type = types[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool registrySymbolValid(const char *symbol)
+{
+    // Symbols with the top bit set are writes, and control characters and
+    // spaces don't make sensible compact keys.
+    return symbol && strlen(symbol) == 1 && symbol[0] >= '!' && symbol[0] <= '~';
+}
@@ -0,0 +1,94 @@
+/**
+ * @file registry.h
+ * @brief Loads the list of devices and their fields at runtime so that new
+ * nodes can be added without reflashing.
+ *
+ * The registry is stored in flash as `/devices.json`. If it exists and is
+ * valid, it replaces the devices in device_list.h at boot. It can be uploaded
+ * with `pio run -t uploadfs` or set from Thingsboard using the
+ * `deviceRegistry` shared attribute, in which case it is saved to flash and
+ * the base station restarts to apply it. The format is:
+ *
+ * ```json
+ * {"devices": [
+ *     {"name": "Main Pressure Pump", "id": 90, "fields": [
+ *         {"name": "Temperature", "sym": "T", "type": "i16", "scale": "tenths"},
+ *         {"name": "TransmitEnabled", "sym": "r", "type": "i8", "set": true}
+ *     ]}
+ * ]}
+ * ```
+ *
+ * Device ids and names must be unique, as must the symbols within a device.
+ * Ids are PJON ids from 1 to PJON_DEVICE_ID - 1. Symbols are one printable
+ * ASCII character, as the top bit of a symbol on air marks a write and the
+ * symbol is used as the telemetry key with COMPACT_TELEMETRY_KEYS.
+ * `type` is one of flag, u8, i8, u16, i16 or u32. `scale` is optional and is
+ * one of tenths or halves. `set` is optional and makes the field settable
+ * using RPC calls.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-02-22
+ */
+
+#pragma once
+#include "../defines.h"
+#include "devices.h"
+#include "fields.h"
+
+/**
+ * @brief Replaces the devices in the device manager with those in the registry
+ * file if it exists. Must be called before any tasks that use the devices are
+ * started.
+ *
+ * @param manager the device manager to update.
+ * @return true if the registry was loaded.
+ * @return false if there is no registry or it is invalid (the built in devices
+ * are kept).
+ */
+bool registryLoad(DeviceManager &manager);
+
+/**
+ * @brief Handles a shared attributes message from Thingsboard. If it contains
+ * a new device registry, this is checked, saved to flash and the RPC task is
+ * asked to restart the base station.
+ *
+ * @param message the raw message.
+ * @param length the length of the message.
+ */
+void registryHandleAttributes(uint8_t *message, unsigned int length);
+
+/**
+ * @brief Checks that a registry document is complete and valid.
+ *
+ * @param registry the parsed registry.
+ * @return true if it can be built.
+ */
+bool registryValidate(JsonVariantConst registry);
+
+/**
+ * @brief Creates the devices described in a validated registry document. The
+ * devices and fields are never freed.
+ *
+ * @param registry the parsed registry.
+ * @param devices set to the array of created devices.
+ * @return uint16_t the number of devices.
+ */
+uint16_t registryBuild(JsonVariantConst registry, Device **&devices);
+
+/**
+ * @brief Converts a wire type name to the type.
+ *
+ * @param name the name, for example "u16".
+ * @param type set to the type if found.
+ * @return true if the name is valid.
+ */
+bool registryWireType(const char *name, FieldWireType &type);
+
+/**
+ * @brief Checks that a field symbol can be sent and decoded unambiguously.
+ *
+ * @param symbol the symbol as a string.
+ * @return true if it is a single character between '!' and '~'.
+ */
+bool registrySymbolValid(const char *symbol);
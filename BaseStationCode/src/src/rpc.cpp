@@ -16,18 +16,30 @@ extern SemaphoreHandle_t serialMutex;
 extern QueueHandle_t alarmQueue;
 extern QueueHandle_t audioQueue;
 extern DeviceManager deviceManager;
+extern QueueHandle_t rpcQueue;
+extern StaticArena<JSON_ARENA_SIZE> networkingArena;
 
 #ifdef PIN_IR
-#include "hvacir.h"
 extern HVAC airConditioner;
-HvacMode airConditionerMode = HVAC_AUTO;
-HvacFanMode airConditionerFanMode = FAN_SPEED_AUTO;
-int airConditionerTemp = 22;
-bool airConditionerOn = true;
+HvacSettings airConditionerSettings; // Last settings sent. Only used from the networking task.
+#include "irlearn.h"
+#endif
+
+#ifdef PACKET_CAPTURE
+#include "capture.h"
+#include <mbedtls/base64.h>
 #endif
 
 void mqttReceived(char *topic, byte *message, unsigned int length)
 {
+    // Shared attributes can be much longer than RPC calls, so handle these first.
+    if (STRINGS_MATCH(topic, Topic::ATTRIBUTE_ME_UPLOAD))
+    {
+        LOGD("MQTT", "MQTT message is a shared attribute update.");
+        registryHandleAttributes(message, length);
+        return;
+    }
+
     // Check that the message isn't too long.
     if (length >= MAX_JSON_TEXT_LENGTH)
     {
@@ -58,7 +70,8 @@ void mqttReceived(char *topic, byte *message, unsigned int length)
 
 void rpcMe(char *id, uint8_t *message, uint16_t length)
 {
-    JsonDocument json;
+    ArenaScope scope(networkingArena);
+    JsonDocument json(&networkingArena);
     DeserializationError error = deserializeJson(json, message, length);
     if (error)
     {
@@ -96,27 +109,41 @@ void rpcMe(char *id, uint8_t *message, uint16_t length)
                 }
             }
 
-            // Add to the queue
-            const unsigned int ALARM_TIMEOUT = 3000;
-            xQueueSend(alarmQueue, (void *)&state, ALARM_TIMEOUT / portTICK_PERIOD_MS);
-            replyMeRpc(id, (char *)"{}");
+            // The alarm task may be busy, so pass it on from the RPC task.
+            RpcJob job;
+            job.type = RPC_JOB_ALARM;
+            job.alarm = state;
+            JsonDocument reply(&networkingArena);
+            rpcDefer(id, job, reply);
+            replyMeRpc(id, reply);
         }
         else if (STRINGS_MATCH(method, "reset"))
         {
             // Reset
             LOGI("MQTT", "Reset method. Restarting in a few seconds");
-            replyMeRpc(id, (char *)"{}");
-            delay(10000);
-            ESP.restart();
+            RpcJob job;
+            job.type = RPC_JOB_RESET;
+            JsonDocument reply(&networkingArena);
+            bool queued = rpcDefer(id, job, reply);
+            replyMeRpc(id, reply);
+            if (!queued)
+            {
+                // The RPC task is stuck, which is a good reason to restart anyway.
+                LOGW("MQTT", "Could not queue the reset. Restarting now.");
+                ESP.restart();
+            }
         }
 #ifdef PIN_SPEAKER
         else if (STRINGS_MATCH(method, "doorbell"))
         {
             // Doorbell noises
             LOGI("MQTT", "Doorbell");
-            AlarmState state = ALARM_DOORBELL;
-            xQueueSend(audioQueue, (void *)&state, portMAX_DELAY);
-            replyMeRpc(id, (char *)"{}");
+            RpcJob job;
+            job.type = RPC_JOB_DOORBELL;
+            job.alarm = ALARM_DOORBELL;
+            JsonDocument reply(&networkingArena);
+            rpcDefer(id, job, reply);
+            replyMeRpc(id, reply);
         }
 #endif
 #ifdef PIN_IR
@@ -124,23 +151,102 @@ void rpcMe(char *id, uint8_t *message, uint16_t length)
         {
             // Send a signal over IR to the air conditioner.
             LOGI("MQTT", "Air conditioner");
-            JsonDocument reply;
-            sendAirConditioner(json["params"], reply);
-            airConditionerReplySettings(reply);
-            char buf[100];
-            serializeJson(reply, buf, sizeof(buf));
-            replyMeRpc(id, buf);
-            setAirConditionerAttribute(buf);
+            // Sending takes a while, so the attribute is updated by the RPC task once sent.
+            JsonDocument reply(&networkingArena);
+            RpcJob job;
+            job.type = RPC_JOB_AIRCOND;
+            if (parseAirConditioner(json["params"], reply, job.hvac) && rpcDefer(id, job, reply))
+            {
+                // Only remembered once it is going to be sent.
+                airConditionerSettings = job.hvac;
+            }
+            airConditionerReplySettings(airConditionerSettings, reply);
+            replyMeRpc(id, reply);
         }
         else if (STRINGS_MATCH(method, "aircondGet"))
         {
             // Return the previously used settings.
             LOGI("MQTT", "Air conditioner get");
-            JsonDocument reply;
-            airConditionerReplySettings(reply);
-            char buf[100];
-            serializeJson(reply, buf, sizeof(buf));
-            replyMeRpc(id, buf);
+            JsonDocument reply(&networkingArena);
+            airConditionerReplySettings(airConditionerSettings, reply);
+            replyMeRpc(id, reply);
+        }
+        else if (STRINGS_MATCH(method, "irSend"))
+        {
+            // Send a code learnt from a remote.
+            LOGI("MQTT", "IR send");
+            const char *name = json["params"]["name"] | "";
+            JsonDocument reply(&networkingArena);
+            if (irNameValid(name))
+            {
+                // Loaded from flash and sent by the RPC task.
+                RpcJob job;
+                job.type = RPC_JOB_IR_SEND;
+                strlcpy(job.irName, name, sizeof(job.irName));
+                rpcDefer(id, job, reply);
+            }
+            else
+            {
+                reply["result"] = false;
+                reply["desc"] = "Invalid name";
+            }
+            replyMeRpc(id, reply);
+        }
+#ifdef PIN_IR_RX
+        else if (STRINGS_MATCH(method, "irLearn"))
+        {
+            // Listen for a code from a remote. The result is published as an attribute.
+            LOGI("MQTT", "IR learn");
+            const char *name = json["params"]["name"] | "";
+            uint8_t khz = json["params"]["khz"] | HVAC_TOSHIBA_KHZ;
+            const char *error = irLearnStart(name, khz);
+            JsonDocument reply(&networkingArena);
+            reply["result"] = error == NULL;
+            reply["desc"] = error ? error : "Press the button on the remote";
+            replyMeRpc(id, reply);
+        }
+#endif
+#endif
+#ifdef PACKET_CAPTURE
+        else if (STRINGS_MATCH(method, "capture"))
+        {
+            // Start or stop recording packets.
+            LOGI("MQTT", "Capture");
+            bool enable = json["params"]["enable"] | captureEnabled();
+            bool clear = json["params"]["clear"] | false;
+            captureSetEnabled(enable, clear);
+            JsonDocument reply(&networkingArena);
+            reply["enabled"] = enable;
+            reply["total"] = captureCount();
+            replyMeRpc(id, reply);
+        }
+        else if (STRINGS_MATCH(method, "captureRead"))
+        {
+            // Download a few records as base64.
+            LOGI("MQTT", "Capture read");
+            uint32_t offset = json["params"]["offset"] | 0;
+            CaptureRecord records[CAPTURE_READ_RECORDS];
+            uint8_t count = captureRead(offset, records, CAPTURE_READ_RECORDS);
+            char data[4 * (sizeof(records) + 2) / 3 + 1];
+            size_t dataLength;
+            mbedtls_base64_encode((unsigned char *)data, sizeof(data), &dataLength, (const unsigned char *)records, count * sizeof(CaptureRecord));
+            data[dataLength] = '\0';
+
+            JsonDocument reply(&networkingArena);
+            reply["offset"] = offset;
+            reply["total"] = captureCount();
+            reply["size"] = sizeof(CaptureRecord);
+            reply["data"] = data;
+            replyMeRpc(id, reply);
+        }
+        else if (STRINGS_MATCH(method, "captureReplay"))
+        {
+            // Feed the capture back through the receive path.
+            LOGI("MQTT", "Capture replay");
+            float speed = json["params"]["speed"] | 1.0;
+            JsonDocument reply(&networkingArena);
+            reply["count"] = captureReplayStart(speed);
+            replyMeRpc(id, reply);
         }
 #endif
         else
@@ -154,7 +260,7 @@ void rpcMe(char *id, uint8_t *message, uint16_t length)
     }
 }
 
-void replyMeRpc(char *id, char *reply)
+void replyMeRpc(char *id, JsonVariantConst reply)
 {
     // Build the topic
     size_t rpcBaseLength = strlen(Topic::RPC_ME_RESPOND);
@@ -164,15 +270,14 @@ void replyMeRpc(char *id, char *reply)
 
     // Publish
     LOGD("MQTT", "Replying to topic %s", topic);
-    // xSemaphoreTake(mqttMutex, portMAX_DELAY);
-    mqtt.publish(topic, reply);
-    // xSemaphoreGive(mqttMutex);
+    mqttPublishJson(topic, reply);
 }
 
 void rpcGateway(uint8_t *message, uint16_t length)
 {
     // Deserialise
-    JsonDocument json;
+    ArenaScope scope(networkingArena);
+    JsonDocument json(&networkingArena);
     DeserializationError error = deserializeJson(json, message, length);
     if (error)
     {
@@ -220,23 +325,116 @@ void rpcGateway(uint8_t *message, uint16_t length)
     }
 
     // Handle the RPC call
-    JsonDocument reply;
+    JsonDocument reply(&networkingArena);
     JsonObject replyData = reply["data"].to<JsonObject>();
-    field->handleRpc(data, replyData);
+    device->handleRpc(field, data, replyData);
 
     // Add the other metadata and send the reply
     reply["id"] = data["id"];
     reply["device"] = deviceName;
 
-    char replyText[MAX_JSON_TEXT_LENGTH];
-    serializeJson(reply, replyText, MAX_JSON_TEXT_LENGTH);
-
-    LOGD("MQTT", "Replying with payload '%s'", replyText);
+    LOGD("MQTT", "Replying to '%s'", deviceName);
     // xSemaphoreTake(mqttMutex, portMAX_DELAY);
-    mqtt.publish(Topic::RPC_GATEWAY, replyText);
+    mqttPublishJson(Topic::RPC_GATEWAY, reply);
     // xSemaphoreGive(mqttMutex);
 }
 
+bool rpcDefer(const char *id, RpcJob &job, JsonDocument &reply)
+{
+    strlcpy(job.id, id, sizeof(job.id));
+    bool queued = xQueueSend(rpcQueue, (void *)&job, 0);
+    if (!queued)
+    {
+        LOGW("RPC", "RPC queue full. Discarding request '%s'.", job.id);
+    }
+    reply["result"] = queued;
+    reply["desc"] = queued ? "Queued" : "Busy";
+    return queued;
+}
+
+/**
+ * @brief Publishes the rpcDone attribute once a queued action has finished.
+ *
+ * @param job the action.
+ * @param error NULL on success, otherwise a description of what went wrong.
+ */
+static void rpcReportDone(const RpcJob &job, const char *error)
+{
+    const char *const methods[] = {"reset", "alarm", "doorbell", "aircond", "irSend"};
+    MqttMsg msg{Topic::ATTRIBUTE_ME_UPLOAD, ""};
+    LocalArena<JSON_ARENA_SMALL_SIZE> arena;
+    JsonDocument json(&arena);
+    JsonObject done = json["rpcDone"].to<JsonObject>();
+    done["id"] = job.id;
+    done["method"] = methods[job.type];
+    done["result"] = error == NULL;
+    done["desc"] = error ? error : "";
+    serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
+    xQueueSend(mqttPublishQueue, (void *)&msg, portMAX_DELAY);
+}
+
+void rpcTask(void *pvParameters)
+{
+    RpcJob job;
+    while (true)
+    {
+        xQueueReceive(rpcQueue, (void *)&job, portMAX_DELAY);
+        LOGD("RPC", "Running queued request '%s'.", job.id);
+        const char *error = NULL;
+        switch (job.type)
+        {
+        case RPC_JOB_RESET:
+            rpcReportDone(job, NULL);
+            vTaskDelay(RPC_RESET_DELAY / portTICK_PERIOD_MS);
+            ESP.restart();
+            break;
+
+        case RPC_JOB_ALARM:
+            if (!xQueueSend(alarmQueue, (void *)&job.alarm, RPC_QUEUE_TIMEOUT / portTICK_PERIOD_MS))
+            {
+                error = "Alarm busy";
+            }
+            break;
+
+#ifdef PIN_SPEAKER
+        case RPC_JOB_DOORBELL:
+            if (!xQueueSend(audioQueue, (void *)&job.alarm, RPC_QUEUE_TIMEOUT / portTICK_PERIOD_MS))
+            {
+                error = "Audio busy";
+            }
+            break;
+#endif
+
+#ifdef PIN_IR
+        case RPC_JOB_AIRCOND:
+            if (airConditioner.send(job.hvac))
+            {
+                // Let the dashboard know what was sent.
+                LocalArena<JSON_ARENA_SMALL_SIZE> arena;
+                JsonDocument settings(&arena);
+                airConditionerReplySettings(job.hvac, settings);
+                char buf[150];
+                serializeJson(settings, buf, sizeof(buf));
+                setAirConditionerAttribute(buf);
+            }
+            else
+            {
+                error = "Could not send IR";
+            }
+            break;
+
+        case RPC_JOB_IR_SEND:
+            error = irSendLearnt(job.irName);
+            break;
+#endif
+
+        default:
+            error = "Not supported";
+        }
+        rpcReportDone(job, error);
+    }
+}
+
 bool startsWith(char *input, const char *compare)
 {
     for (int i = 0; compare[i] != '\00'; i++)
@@ -251,8 +449,10 @@ bool startsWith(char *input, const char *compare)
 
 void setAttributeState(const char *const attribute, bool state)
 {
+    // Called from many tasks, so use an arena on the stack.
     MqttMsg msg{Topic::ATTRIBUTE_ME_UPLOAD, ""};
-    JsonDocument json;
+    LocalArena<JSON_ARENA_SMALL_SIZE> arena;
+    JsonDocument json(&arena);
     json[attribute] = state;
     serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
     xQueueSend(mqttPublishQueue, (void *)&msg, portMAX_DELAY);
@@ -260,8 +460,8 @@ void setAttributeState(const char *const attribute, bool state)
 
 void setVersionAttribute()
 {
-    char buf[400]; // Longer than a standard MqttMsg object as lots of details.
-    JsonDocument json;
+    ArenaScope scope(networkingArena);
+    JsonDocument json(&networkingArena);
     JsonObject version = json["version"].to<JsonObject>();
     version["date"] = __DATE__;
     version["time"] = __TIME__;
@@ -273,11 +473,10 @@ void setVersionAttribute()
     version["pio-framework"] = PIO_FRAMEWORK;
     version["connect-time"] = millis(); // So we can see if this reset itself recently.
     version["reset-reas"] = resetReasonName(esp_reset_reason());
-    serializeJson(json, buf, sizeof(buf));
     // Don't use a queue as that may be full if reconnecting after a long time being disconnected.
     xSemaphoreTake(mqttMutex, portMAX_DELAY);
     LOGD("RPC", "Sending version attribute.");
-    mqtt.publish(Topic::ATTRIBUTE_ME_UPLOAD, buf);
+    mqttPublishJson(Topic::ATTRIBUTE_ME_UPLOAD, json);
     xSemaphoreGive(mqttMutex);
 }
 
@@ -318,27 +517,37 @@ const char *resetReasonName(esp_reset_reason_t reason)
     reply["desc"] = DESC;           \
     reply["result"] = false;        \
     return false
-bool sendAirConditioner(JsonObject obj, JsonDocument &reply)
+bool parseAirConditioner(JsonObject obj, JsonDocument &reply, HvacSettings &settings)
 {
+    // Anything not given stays the same.
+    settings = airConditionerSettings;
+
+    // Air conditioner brand.
+    const char *protocolStr = obj["protocol"];
+    if (protocolStr && !HVAC::protocolFromName(protocolStr, settings.protocol))
+    {
+        AIR_CONDITIONER_ERROR("Invalid protocol");
+    }
+
     // Air conditioner mode.
     const char *modeStr = obj["mode"];
     if (modeStr)
     {
         if (STRINGS_MATCH(modeStr, "heat"))
         {
-            airConditionerMode = HVAC_HOT;
+            settings.mode = HVAC_HOT;
         }
         else if (STRINGS_MATCH(modeStr, "cool"))
         {
-            airConditionerMode = HVAC_COLD;
+            settings.mode = HVAC_COLD;
         }
         else if (STRINGS_MATCH(modeStr, "dry"))
         {
-            airConditionerMode = HVAC_DRY;
+            settings.mode = HVAC_DRY;
         }
         else if (STRINGS_MATCH(modeStr, "auto"))
         {
-            airConditionerMode = HVAC_AUTO;
+            settings.mode = HVAC_AUTO;
         }
         else
         {
@@ -352,27 +561,27 @@ bool sendAirConditioner(JsonObject obj, JsonDocument &reply)
     {
         if (STRINGS_MATCH(fanModeStr, "FS1"))
         {
-            airConditionerFanMode = FAN_SPEED_1;
+            settings.fanMode = FAN_SPEED_1;
         }
         else if (STRINGS_MATCH(fanModeStr, "FS2"))
         {
-            airConditionerFanMode = FAN_SPEED_2;
+            settings.fanMode = FAN_SPEED_2;
         }
         else if (STRINGS_MATCH(fanModeStr, "FS3"))
         {
-            airConditionerFanMode = FAN_SPEED_3;
+            settings.fanMode = FAN_SPEED_3;
         }
         else if (STRINGS_MATCH(fanModeStr, "FS4"))
         {
-            airConditionerFanMode = FAN_SPEED_4;
+            settings.fanMode = FAN_SPEED_4;
         }
         else if (STRINGS_MATCH(fanModeStr, "FS5"))
         {
-            airConditionerFanMode = FAN_SPEED_5;
+            settings.fanMode = FAN_SPEED_5;
         }
         else if (STRINGS_MATCH(fanModeStr, "auto"))
         {
-            airConditionerFanMode = FAN_SPEED_AUTO;
+            settings.fanMode = FAN_SPEED_AUTO;
         }
         else
         {
@@ -383,23 +592,24 @@ bool sendAirConditioner(JsonObject obj, JsonDocument &reply)
     // Get the temperature and whether the air conditioner should be on.
     if (obj["temperature"].is<int>())
     {
-        airConditionerTemp = obj["temperature"];
+        settings.temperature = obj["temperature"];
     }
     if (obj["on"].is<bool>())
     {
-        airConditionerOn = obj["on"];
+        settings.turnOff = !obj["on"].as<bool>();
     }
 
-    airConditioner.sendHvacToshiba(airConditionerMode, airConditionerTemp, airConditionerFanMode, !airConditionerOn);
     reply["result"] = true;
     reply["desc"] = "";
     return true;
 }
 
-void airConditionerReplySettings(JsonDocument &obj)
+void airConditionerReplySettings(const HvacSettings &settings, JsonDocument &obj)
 {
+    obj["protocol"] = HVAC::protocolName(settings.protocol);
+
     // Mode
-    switch (airConditionerMode)
+    switch (settings.mode)
     {
     case HVAC_HOT:
         obj["mode"] = "heat";
@@ -418,7 +628,7 @@ void airConditionerReplySettings(JsonDocument &obj)
     }
 
     // Fan mode
-    switch (airConditionerFanMode)
+    switch (settings.fanMode)
     {
     case FAN_SPEED_1:
         obj["fanmode"] = "FS1";
@@ -443,10 +653,10 @@ void airConditionerReplySettings(JsonDocument &obj)
     }
 
     // Temperature
-    obj["temperature"] = airConditionerTemp;
+    obj["temperature"] = settings.temperature;
 
     // On and off
-    obj["on"] = airConditionerOn;
+    obj["on"] = !settings.turnOff;
 }
 
 void setAirConditionerAttribute(const char *payload)
@@ -458,16 +668,15 @@ void setAirConditionerAttribute(const char *payload)
 
 void setAirConditionerAttributeInitial()
 {
-    JsonDocument result;
-    airConditionerReplySettings(result);
-    char payload[200];
-    char buf[200];
-    serializeJson(result, payload, sizeof(payload));
-    sprintf(buf, "{\"aircond\":%s}", payload); // Add inside a key to make this a bit neater.
+    ArenaScope scope(networkingArena);
+    JsonDocument result(&networkingArena);
+    airConditionerReplySettings(airConditionerSettings, result);
+    JsonDocument json(&networkingArena);
+    json["aircond"] = result; // Add inside a key to make this a bit neater.
     // Don't use a queue as that may be full if reconnecting after a long time being disconnected.
     xSemaphoreTake(mqttMutex, portMAX_DELAY);
     LOGD("RPC", "Sending air conditioner attributes.");
-    mqtt.publish(Topic::ATTRIBUTE_ME_UPLOAD, buf);
+    mqttPublishJson(Topic::ATTRIBUTE_ME_UPLOAD, json);
     xSemaphoreGive(mqttMutex);
 }
 #endif
\ No newline at end of file
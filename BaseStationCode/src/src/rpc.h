@@ -14,6 +14,33 @@
 #include "devices.h"
 #include "fields.h"
 #include "networking.h"
+#include "registry.h"
+#ifdef PIN_IR
+#include "hvacir.h"
+#endif
+
+/**
+ * @brief Slow RPC actions that are handed to the RPC task so that the
+ * networking task can keep servicing MQTT.
+ *
+ */
+enum RpcJobType : uint8_t {RPC_JOB_RESET, RPC_JOB_ALARM, RPC_JOB_DOORBELL, RPC_JOB_AIRCOND, RPC_JOB_IR_SEND};
+
+/**
+ * @brief An RPC action waiting for the RPC task. Only the members for the type
+ * are used.
+ *
+ */
+struct RpcJob
+{
+    RpcJobType type;
+    char id[MAX_ID_TEXT_LENGTH + 1]; // Request ID, reported back when done.
+    AlarmState alarm;
+#ifdef PIN_IR
+    HvacSettings hvac;
+    char irName[IR_NAME_LENGTH + 1];
+#endif
+};
 
 /**
  * @brief Function that is called when an mqtt message is received.
@@ -31,12 +58,13 @@ void mqttReceived(char *topic, byte *message, unsigned int length);
 void rpcMe(char *id, uint8_t *message, uint16_t length);
 
 /**
- * @brief Replies to an RPC message for this device.
- * 
+ * @brief Replies to an RPC message for this device, serialising the reply
+ * straight into the connection.
+ *
  * @param id char array of the request ID.
- * @param reply the payload to return.
+ * @param reply the document to return.
  */
-void replyMeRpc(char *id, char *reply);
+void replyMeRpc(char *id, JsonVariantConst reply);
 
 /**
  * @brief Handles an RPC message addressed to remote devices.
@@ -47,6 +75,26 @@ void replyMeRpc(char *id, char *reply);
  */
 void rpcGateway(uint8_t *message, uint16_t length);
 
+/**
+ * @brief Queues a slow action for the RPC task and fills in the result and
+ * desc of the reply to say whether it was accepted. Never blocks.
+ *
+ * @param id the request ID.
+ * @param job the action to run. The ID is copied into this.
+ * @param reply the reply to add the result to.
+ * @return true if queued.
+ * @return false if the queue is full.
+ */
+bool rpcDefer(const char *id, RpcJob &job, JsonDocument &reply);
+
+/**
+ * @brief Task that runs the actions queued by rpcDefer() and publishes an
+ * rpcDone attribute with the request ID and result after each one.
+ *
+ * @param pvParameters
+ */
+void rpcTask(void *pvParameters);
+
 /**
  * @brief Checks if one string starts with another (quicker than strstr?)
  *
@@ -81,20 +129,25 @@ const char *resetReasonName(esp_reset_reason_t reason);
 
 #ifdef PIN_IR
 /**
- * @brief Sends an infrared command to the air conditioner.
+ * @brief Works out the air conditioner settings for an RPC call, starting from
+ * the last settings sent. Nothing is changed until the caller has queued the
+ * settings for the RPC task to send.
  * 
  * @param obj JSON containing parameters to send.
+ * @param reply the reply to add an error to.
+ * @param settings set to the settings to send.
  * @return true on success.
  * @return false on parameter issues.
  */
-bool sendAirConditioner(JsonObject obj, JsonDocument &reply);
+bool parseAirConditioner(JsonObject obj, JsonDocument &reply, HvacSettings &settings);
 
 /**
- * @brief Saves the current air conditioner settings to a JSON object.
+ * @brief Saves air conditioner settings to a JSON object.
  * 
+ * @param settings the settings to save.
  * @param obj object to save to.
  */
-void airConditionerReplySettings(JsonDocument &obj);
+void airConditionerReplySettings(const HvacSettings &settings, JsonDocument &obj);
 
 /**
  * @brief Sets the air conditioner attributes. This is useful for some of the buttons.
@@ -0,0 +1,75 @@
+/**
+ * @file rxring.cpp
+ * @brief Fixed size ring of received packets between the radio task and the
+ * decoder task.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-05-10
+ */
+#include "rxring.h"
+
+bool RxRing::push(const RxPacket &packet)
+{
+    if (packet.length > sizeof(packet.payload))
+    {
+        dropped++;
+        return false;
+    }
+
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+    uint32_t tail = m_tail.load(std::memory_order_acquire);
+    if (head - tail >= RX_RING_SIZE)
+    {
+#ifdef RX_DROP_OLDEST
+        // Take the oldest packet away from the decoder. If the decoder got to
+        // it first, there is room now anyway.
+        if (m_tail.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel))
+        {
+            dropped++;
+        }
+#else
+        dropped++;
+        return false;
+#endif
+    }
+
+    // Add the packet.
+    m_slots[head % RX_RING_SIZE] = packet;
+    m_head.store(head + 1, std::memory_order_release);
+    queued++;
+    uint32_t waiting = head + 1 - m_tail.load(std::memory_order_relaxed);
+    if (waiting > peak)
+    {
+        peak = waiting;
+    }
+    return true;
+}
+
+bool RxRing::pop(RxPacket &packet)
+{
+    uint32_t tail = m_tail.load(std::memory_order_acquire);
+    while (tail != m_head.load(std::memory_order_acquire))
+    {
+        packet = m_slots[tail % RX_RING_SIZE];
+
+        // With RX_DROP_OLDEST, the radio task may have dropped this packet and
+        // started overwriting it while it was being copied. If so, tail is
+        // updated and the next one is tried.
+        if (m_tail.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RxRing::full() const
+{
+    return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire) >= RX_RING_SIZE;
+}
+
+bool RxRing::empty() const
+{
+    return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire);
+}
@@ -0,0 +1,102 @@
+/**
+ * @file rxring.h
+ * @brief Fixed size ring of received packets between the radio task and the
+ * decoder task, so that servicing the radio never waits for decoding or the
+ * network.
+ *
+ * When packets arrive faster than they can be decoded, the newest packet is
+ * dropped by default. Define RX_DROP_OLDEST to drop the oldest waiting packet
+ * instead. Either way, the drop is counted and published with the other
+ * receive statistics.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-05-10
+ */
+
+#pragma once
+#include "../defines.h"
+#include <atomic>
+
+static_assert((RX_RING_SIZE & (RX_RING_SIZE - 1)) == 0, "RX_RING_SIZE must be a power of 2.");
+
+/**
+ * @brief Where a received packet came from.
+ *
+ */
+enum RxSource : uint8_t
+{
+    RX_RADIO, // Recorded with PACKET_CAPTURE and checked for duplicates.
+    RX_SIMULATED, // Checked for duplicates only.
+    RX_REPLAYED // Neither. Replays can be faster than real time, so repeated readings would look like duplicates.
+};
+
+/**
+ * @brief A received packet waiting to be decoded.
+ *
+ */
+struct RxPacket
+{
+    uint8_t payload[PJON_PACKET_MAX_LENGTH];
+    uint16_t length;
+    PJON_Packet_Info info;
+    int rssi;
+    float snr;
+    RxSource source;
+    uint32_t received; // millis() when the radio task got the packet.
+#ifdef LATENCY_TRACING
+    uint32_t rxDone;
+#endif
+};
+
+/**
+ * @brief Single producer, single consumer ring of received packets. push()
+ * must only be called from the task receiving packets and pop() from the
+ * decoder task. The counters can be read from elsewhere.
+ *
+ */
+class RxRing
+{
+public:
+    /**
+     * @brief Copies a packet into the ring. Never blocks.
+     *
+     * @param packet the packet.
+     * @return true if the packet was added.
+     * @return false if the packet was dropped as the ring is full (or the
+     * payload is too long).
+     */
+    bool push(const RxPacket &packet);
+
+    /**
+     * @brief Takes the oldest packet out of the ring.
+     *
+     * @param packet where to copy the packet to.
+     * @return true if there was a packet.
+     */
+    bool pop(RxPacket &packet);
+
+    /**
+     * @brief Checks if the ring is full, so that a producer that can wait
+     * (such as a replay) can avoid dropping or displacing packets.
+     *
+     * @return true if the next push() would drop a packet.
+     */
+    bool full() const;
+
+    /**
+     * @brief Checks if every packet pushed has been taken by the decoder.
+     *
+     * @return true if nothing is waiting.
+     */
+    bool empty() const;
+
+    uint32_t queued = 0;
+    uint32_t dropped = 0;
+    uint32_t peak = 0; // Most packets waiting at once.
+
+private:
+    RxPacket m_slots[RX_RING_SIZE];
+    std::atomic<uint32_t> m_head{0}; // Only written by push().
+    std::atomic<uint32_t> m_tail{0}; // Written by pop() and by push() when dropping the oldest.
+};
@@ -0,0 +1,261 @@
+/**
+ * @file simulation.cpp
+ * @brief Virtual LoRa radio and load generator for finding how much traffic
+ * the gateway can handle.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-03-01
+ */
+#include "simulation.h"
+
+#ifdef SIMULATE_RADIO
+#include "devices.h"
+#include "networking.h"
+#include "arena.h"
+
+extern SemaphoreHandle_t serialMutex;
+extern DeviceManager deviceManager;
+extern QueueHandle_t mqttPublishQueue;
+
+PJON<SimulatedNodeRadio> simulatedNodes(1); // Builds the frames for every virtual node. Only used from the radio task.
+
+bool SimulatedLora::begin(uint8_t did)
+{
+    LOGI("SIM", "Simulating %d nodes sending every %dms on average.", SIM_NODE_COUNT, SIM_NODE_INTERVAL);
+    m_meanInterval = (float)SIM_NODE_INTERVAL / SIM_NODE_COUNT;
+    m_nextArrival = millis() + simulateNextInterval(m_meanInterval);
+    m_lastReport = millis();
+    m_busy = false;
+    m_ready = false;
+    return true;
+}
+
+bool SimulatedLora::can_start()
+{
+    // Like listening before talking on the real radio.
+    update(millis());
+    return !m_busy && (int32_t)(millis() - m_txEnd) >= 0;
+}
+
+uint16_t SimulatedLora::receive_frame(uint8_t *data, uint16_t max_length)
+{
+    update(millis());
+    if (!m_ready)
+    {
+        return PJON_FAIL;
+    }
+
+    // Hand the packet to PJON, which calls pjonReceive() if it is valid.
+    m_ready = false;
+    m_rssi = m_received.rssi;
+    m_snr = m_received.snr;
+    uint16_t length = min(m_received.length, max_length);
+    memcpy(data, m_received.frame, length);
+    m_stats.delivered++;
+    UBaseType_t waiting = uxQueueMessagesWaiting(mqttPublishQueue);
+    if (waiting > m_stats.queuePeak)
+    {
+        m_stats.queuePeak = waiting;
+    }
+    return length;
+}
+
+void SimulatedLora::send_response(uint8_t response)
+{
+    m_stats.acknowledged++;
+}
+
+void SimulatedLora::send_frame(uint8_t *data, uint16_t length)
+{
+    // Nothing can be received while transmitting.
+    m_stats.transmitted++;
+    m_txEnd = millis() + SIM_AIRTIME;
+    if (m_busy && !m_inFlight.collided)
+    {
+        m_inFlight.collided = true;
+        m_stats.collided++;
+    }
+}
+
+void SimulatedLora::update(uint32_t now)
+{
+    // Finish receiving the packet in the air.
+    if (m_busy && (int32_t)(now - m_inFlight.endTime) >= 0)
+    {
+        finish(now);
+    }
+
+    // Start new packets. May be several if we got behind.
+    while ((int32_t)(now - m_nextArrival) >= 0)
+    {
+        uint32_t arrival = m_nextArrival;
+        m_nextArrival += simulateNextInterval(m_meanInterval);
+        m_stats.generated++;
+
+        // Dropped for some other reason (out of range, interference).
+        if (esp_random() % 100 < SIM_LOSS_PERCENT)
+        {
+            m_stats.lost++;
+            continue;
+        }
+
+        // The packet in the air ended before this one started if we are
+        // catching up, so only overlapping packets collide.
+        if (m_busy && (int32_t)(arrival - m_inFlight.endTime) >= 0)
+        {
+            finish(now);
+        }
+        if (m_busy)
+        {
+            // Overlaps with the packet in the air, so both are lost.
+            if (!m_inFlight.collided)
+            {
+                m_inFlight.collided = true;
+                m_stats.collided++;
+            }
+            m_stats.collided++;
+            if (arrival + SIM_AIRTIME > m_inFlight.endTime)
+            {
+                m_inFlight.endTime = arrival + SIM_AIRTIME;
+            }
+            continue;
+        }
+
+        // Nothing else in the air. Lost if the gateway is transmitting.
+        if (simulateNodePacket(m_inFlight, esp_random() % SIM_NODE_COUNT))
+        {
+            m_inFlight.arrivalTime = arrival;
+            m_inFlight.endTime = arrival + SIM_AIRTIME;
+            m_inFlight.collided = (int32_t)(arrival - m_txEnd) < 0;
+            m_stats.collided += m_inFlight.collided;
+            m_busy = true;
+        }
+    }
+
+    // Report and ramp up if needed.
+    if (now - m_lastReport >= SIM_REPORT_INTERVAL)
+    {
+        simulationReport(m_stats, 60000.0 / m_meanInterval);
+        m_lastReport = now;
+#ifdef SIM_RAMP
+        m_meanInterval /= 2;
+        LOGI("SIM", "Increasing the rate to %.1f packets/min.", 60000.0 / m_meanInterval);
+#endif
+    }
+}
+
+void SimulatedLora::finish(uint32_t now)
+{
+    m_busy = false;
+    if (m_inFlight.collided)
+    {
+        return;
+    }
+
+    // A real radio would have had to be serviced within an airtime.
+    if (now - m_inFlight.endTime > SIM_AIRTIME)
+    {
+        m_stats.missed++;
+        return;
+    }
+
+    // The radio only holds one packet, so one PJON hasn't taken yet is lost.
+    if (m_ready)
+    {
+        m_stats.missed++;
+    }
+    m_received = m_inFlight;
+    m_ready = true;
+}
+
+void simulationBegin(DeviceManager &manager)
+{
+    // Each node acts like one of the known devices, but with its own id and
+    // name. Fields are shared between nodes acting like the same device, as
+    // in the lookup benchmark, so RPCs to the virtual nodes aren't meaningful.
+    Device **nodes = new Device *[SIM_NODE_COUNT];
+    for (uint16_t i = 0; i < SIM_NODE_COUNT; i++)
+    {
+        Device *schema = manager.items[i % manager.count];
+        char name[48];
+        snprintf(name, sizeof(name), "Sim %d %s", i + 1, schema->name);
+        nodes[i] = new Device(strdup(name), i + 1, schema->fields);
+    }
+    manager.setItems(nodes, SIM_NODE_COUNT);
+    LOGI("SIM", "Replaced the devices with %d virtual nodes.", SIM_NODE_COUNT);
+}
+
+bool simulateNodePacket(SimulatedPacket &packet, uint16_t node)
+{
+    // Random values for every field that fits.
+    Device *device = deviceManager.items[node];
+    uint8_t payload[SIM_PAYLOAD_MAX];
+    uint8_t length = 0;
+    for (uint8_t i = 0; i < device->fields.count; i++)
+    {
+        Field *field = device->fields.items[i];
+        if (length + field->encodedLength + 1 > SIM_PAYLOAD_MAX)
+        {
+            break;
+        }
+        payload[length++] = field->symbol;
+        for (uint8_t j = 0; j < field->encodedLength; j++)
+        {
+            payload[length++] = esp_random();
+        }
+    }
+    if (!length)
+    {
+        return false;
+    }
+
+    // Let PJON build the frame as the node would.
+    simulatedNodes.set_id(device->symbol);
+    simulatedNodes.set_acknowledge(esp_random() % 100 < SIM_ACK_PERCENT);
+    if (simulatedNodes.send_packet(PJON_DEVICE_ID, payload, length) != PJON_ACK)
+    {
+        return false;
+    }
+    packet.length = simulatedNodes.strategy.length;
+    memcpy(packet.frame, simulatedNodes.strategy.frame, packet.length);
+
+    // Each node has its own signal strength, with a bit of noise.
+    int baseRssi = SIM_RSSI_MIN + (node * 7919) % (SIM_RSSI_MAX - SIM_RSSI_MIN);
+    packet.rssi = baseRssi + (int)(esp_random() % 7) - 3;
+    packet.snr = (packet.rssi - SIM_RSSI_MIN) / 4.0 - 10 + (esp_random() % 20) / 10.0;
+    return true;
+}
+
+uint32_t simulateNextInterval(float meanInterval)
+{
+    // Exponentially distributed so the nodes act independently.
+    float uniform = (esp_random() + 1.0) / 4294967297.0;
+    return -meanInterval * logf(uniform);
+}
+
+void simulationReport(SimulationStats &stats, float rate)
+{
+    LocalArena<JSON_ARENA_SMALL_SIZE> arena;
+    JsonDocument json(&arena);
+    json["simRate"] = rate;
+    json["simSent"] = stats.generated;
+    json["simLost"] = stats.lost;
+    json["simCollided"] = stats.collided;
+    json["simDelivered"] = stats.delivered;
+    json["simMissed"] = stats.missed;
+    json["simAcked"] = stats.acknowledged;
+    json["simTransmitted"] = stats.transmitted;
+    json["simQueuePeak"] = stats.queuePeak;
+    MqttMsg msg{Topic::TELEMETRY_ME_UPLOAD, ""};
+    serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
+    LOGI("SIM", "%s", msg.payload);
+
+    // Don't wait if the queue is full, as that would skew the results.
+    if (!xQueueSend(mqttPublishQueue, (void *)&msg, 0))
+    {
+        LOGW("SIM", "Queue full, could not publish the report.");
+    }
+    stats = {0};
+}
+#endif
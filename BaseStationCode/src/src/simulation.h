@@ -0,0 +1,188 @@
+/**
+ * @file simulation.h
+ * @brief Virtual LoRa radio and load generator for finding how much traffic
+ * the gateway can handle.
+ *
+ * When SIMULATE_RADIO is defined, the PJON bus uses SimulatedLora as its
+ * strategy instead of ThroughLora, so pjonTask, bus.update(), bus.receive(),
+ * pjonReceive() and the radio request queue all run as normal. The virtual
+ * radio is serviced each time PJON asks it for a frame. It generates packets
+ * from many virtual nodes, each with its own PJON id and a device registered
+ * by simulationBegin(), so lookups, duplicate filtering and ThingsBoard
+ * connects see as many distinct senders as there are nodes. Frames are built
+ * by a second PJON instance acting as the nodes, so the gateway parses and
+ * checks them like real ones. SIM_ACK_PERCENT of packets ask for an
+ * acknowledgement, which the gateway sends back through the strategy.
+ *
+ * The virtual radio drops a percentage of packets, loses packets that overlap
+ * in time (collisions) or arrive while the gateway is transmitting, and gives
+ * each node its own RSSI and SNR. Packets that finished arriving more than an
+ * airtime before the PJON task asked for them are counted as missed, as the
+ * real radio would not have been serviced in time. The rate at which this
+ * starts happening (and the peak length of mqttPublishQueue) are published
+ * every SIM_REPORT_INTERVAL. With SIM_RAMP defined, the packet rate doubles
+ * after each report to find the saturation point.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-03-01
+ */
+
+#pragma once
+#include "../defines.h"
+
+#ifdef SIMULATE_RADIO
+static_assert(SIM_NODE_COUNT > 0 && SIM_NODE_COUNT < PJON_DEVICE_ID, "Each virtual node needs its own PJON id below the gateway's.");
+
+class DeviceManager;
+
+/**
+ * @brief A packet currently "in the air".
+ *
+ */
+struct SimulatedPacket
+{
+    uint8_t frame[PJON_PACKET_MAX_LENGTH];
+    uint16_t length;
+    int rssi;
+    float snr;
+    uint32_t arrivalTime;
+    uint32_t endTime;
+    bool collided;
+};
+
+/**
+ * @brief Counters for the virtual radio. Reset after each report.
+ *
+ */
+struct SimulationStats
+{
+    uint32_t generated;
+    uint32_t lost;
+    uint32_t collided;
+    uint32_t delivered;
+    uint32_t missed;
+    uint32_t acknowledged; // Acknowledgements sent by the gateway.
+    uint32_t transmitted; // Frames sent by the gateway.
+    UBaseType_t queuePeak;
+};
+
+/**
+ * @brief PJON strategy for the gateway's bus that talks to the virtual radio.
+ * Also provides the ThroughLora functions used to set up the radio, which do
+ * nothing here.
+ *
+ */
+class SimulatedLora
+{
+public:
+    // Setting up the (non-existent) radio.
+    void setPins(uint8_t cs, uint8_t reset, uint8_t dio) {}
+    bool setFrequency(uint32_t frequency) { return true; }
+    void setSpreadingFactor(uint8_t spreadingFactor) {}
+    bool isConnected() { return true; }
+    int packetRssi() { return m_rssi; }
+    float packetSnr() { return m_snr; }
+
+    // PJON strategy interface.
+    bool begin(uint8_t did = 0);
+    bool can_start();
+    static uint8_t get_max_attempts() { return 10; }
+    static uint16_t get_receive_time() { return 0; }
+    uint32_t back_off(uint8_t attempts) { return SIM_AIRTIME * 1000UL * attempts; }
+    void handle_collision() {}
+    uint16_t receive_frame(uint8_t *data, uint16_t max_length);
+    uint16_t receive_response() { return PJON_FAIL; } // The gateway doesn't ask for acknowledgements.
+    void send_response(uint8_t response);
+    void send_frame(uint8_t *data, uint16_t length);
+
+private:
+    /**
+     * @brief Generates packets up to now and finishes the one in the air if
+     * it is done. Also reports and ramps up the rate when it is time to.
+     *
+     * @param now the current time.
+     */
+    void update(uint32_t now);
+
+    /**
+     * @brief Makes a packet that has finished being received available to
+     * PJON, unless it collided or the radio wasn't serviced in time.
+     *
+     * @param now the current time.
+     */
+    void finish(uint32_t now);
+
+    SimulationStats m_stats = {0};
+    SimulatedPacket m_inFlight;
+    bool m_busy = false; // A packet is in the air.
+    SimulatedPacket m_received;
+    bool m_ready = false; // m_received is waiting for PJON.
+    uint32_t m_txEnd = 0; // When the gateway's last transmission finishes.
+    float m_meanInterval;
+    uint32_t m_nextArrival;
+    uint32_t m_lastReport;
+    int m_rssi = 0;
+    float m_snr = 0;
+};
+
+/**
+ * @brief PJON strategy for the virtual nodes. Only used to build frames, which
+ * are left in frame for the virtual radio to put in the air.
+ *
+ */
+class SimulatedNodeRadio
+{
+public:
+    bool begin(uint8_t did = 0) { return true; }
+    bool can_start() { return true; }
+    static uint8_t get_max_attempts() { return 1; }
+    static uint16_t get_receive_time() { return 0; }
+    uint32_t back_off(uint8_t attempts) { return 0; }
+    void handle_collision() {}
+    uint16_t receive_frame(uint8_t *data, uint16_t max_length) { return PJON_FAIL; }
+    uint16_t receive_response() { return PJON_ACK; } // Nodes don't wait. The gateway's reply is counted by SimulatedLora.
+    void send_response(uint8_t response) {}
+    void send_frame(uint8_t *data, uint16_t length)
+    {
+        this->length = min(length, (uint16_t)sizeof(frame));
+        memcpy(frame, data, this->length);
+    }
+
+    uint8_t frame[PJON_PACKET_MAX_LENGTH];
+    uint16_t length = 0;
+};
+
+/**
+ * @brief Replaces the devices in the manager with one device per virtual
+ * node, with ids 1 to SIM_NODE_COUNT. Each node uses the fields of one of the
+ * devices already in the manager. Must be called before the tasks start.
+ *
+ * @param manager the device manager.
+ */
+void simulationBegin(DeviceManager &manager);
+
+/**
+ * @brief Builds a frame with random readings from a virtual node.
+ *
+ * @param packet the packet to fill in.
+ * @param node the index of the node sending it.
+ * @return true if the packet could be created.
+ */
+bool simulateNodePacket(SimulatedPacket &packet, uint16_t node);
+
+/**
+ * @brief Returns a random time until the next packet from any node.
+ *
+ * @param meanInterval the average time between packets in ms.
+ */
+uint32_t simulateNextInterval(float meanInterval);
+
+/**
+ * @brief Publishes and resets the counters.
+ *
+ * @param stats the counters.
+ * @param rate the current rate in packets per minute.
+ */
+void simulationReport(SimulationStats &stats, float rate);
+#endif
@@ -0,0 +1,91 @@
+/**
+ * @file stats.cpp
+ * @brief Periodically publishes statistics about the gateway itself.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-02-08
+ */
+#include "stats.h"
+
+extern SemaphoreHandle_t serialMutex;
+extern QueueHandle_t mqttPublishQueue;
+extern StaticArena<JSON_ARENA_SIZE> pjonArena;
+extern StaticArena<JSON_ARENA_SIZE> networkingArena;
+#ifdef GENERATE_TIMESERIES
+extern StaticArena<JSON_ARENA_SMALL_SIZE> timeseriesArena;
+#endif
+extern DuplicateFilter duplicateFilter;
+extern TelemetryCounters telemetryCounters;
+extern RxRing rxRing;
+
+void memoryReport()
+{
+    JsonDocument json;
+    json["heapFree"] = ESP.getFreeHeap();
+    json["heapMin"] = ESP.getMinFreeHeap();
+    json["heapLargest"] = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT); // Shows fragmentation.
+
+    // Arena usage. Overflows mean the arena is too small and the heap was used.
+    uint32_t overflows = pjonArena.overflows + networkingArena.overflows;
+#ifdef GENERATE_TIMESERIES
+    overflows += timeseriesArena.overflows;
+#endif
+    overflows += localArenaOverflows;
+    json["arenaOverflows"] = overflows;
+    json["arenaPeakPjon"] = pjonArena.peak;
+    json["arenaPeakNet"] = networkingArena.peak;
+
+    MqttMsg msg{Topic::TELEMETRY_ME_UPLOAD, ""};
+    serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
+    LOGD("STATS", "%s", msg.payload);
+    xQueueSend(mqttPublishQueue, (void *)&msg, portMAX_DELAY);
+}
+
+void receiveReport()
+{
+    JsonDocument json;
+    json["rxChecked"] = duplicateFilter.checked;
+    json["rxDuplicates"] = duplicateFilter.hits;
+    json["rxQueued"] = rxRing.queued;
+    json["rxDropped"] = rxRing.dropped;
+    json["rxRingPeak"] = rxRing.peak;
+    json["txSplit"] = telemetryCounters.split;
+    json["txSplitParts"] = telemetryCounters.parts;
+    json["txTruncated"] = telemetryCounters.truncated;
+
+    MqttMsg msg{Topic::TELEMETRY_ME_UPLOAD, ""};
+    serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
+    LOGD("STATS", "%s", msg.payload);
+    xQueueSend(mqttPublishQueue, (void *)&msg, portMAX_DELAY);
+}
+
+void keyLengthReport()
+{
+    LocalArena<JSON_ARENA_SMALL_SIZE> arena;
+    JsonDocument json(&arena);
+    json["txReadings"] = telemetryCounters.readings;
+    json["txBytesFullKeys"] = telemetryCounters.bytesFullKeys;
+    json["txBytesCompactKeys"] = telemetryCounters.bytesCompactKeys;
+
+    MqttMsg msg{Topic::TELEMETRY_ME_UPLOAD, ""};
+    serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
+    LOGD("STATS", "%s", msg.payload);
+    xQueueSend(mqttPublishQueue, (void *)&msg, portMAX_DELAY);
+}
+
+void statsTask(void *pvParameters)
+{
+    LOGD("STATS", "Starting");
+    TickType_t lastWakeTime = xTaskGetTickCount();
+    while (true)
+    {
+        xTaskDelayUntil(&lastWakeTime, STATS_INTERVAL / portTICK_PERIOD_MS);
+        memoryReport();
+        receiveReport();
+        keyLengthReport();
+#ifdef LATENCY_TRACING
+        latencyReport();
+#endif
+    }
+}
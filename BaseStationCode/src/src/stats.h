@@ -0,0 +1,47 @@
+/**
+ * @file stats.h
+ * @brief Periodically publishes statistics about the gateway itself.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-02-08
+ */
+
+#pragma once
+#include "../defines.h"
+#include "latency.h"
+#include "networking.h"
+#include "arena.h"
+#include "dedup.h"
+#include "telemetry.h"
+#include "rxring.h"
+
+/**
+ * @brief Publishes heap and JSON arena statistics as telemetry. The largest
+ * free block shows how fragmented the heap is getting over time.
+ *
+ */
+void memoryReport();
+
+/**
+ * @brief Publishes counters from the receive path (packets checked, duplicates
+ * dropped and readings that had to be split or truncated) as telemetry. The
+ * counters are totals since boot.
+ *
+ */
+void receiveReport();
+
+/**
+ * @brief Publishes the number of readings decoded and their total length with
+ * field names and with compact keys as keys, measured from the real readings.
+ *
+ */
+void keyLengthReport();
+
+/**
+ * @brief Task that publishes gateway statistics as telemetry every
+ * STATS_INTERVAL.
+ *
+ * @param pvParameters
+ */
+void statsTask(void *pvParameters);
@@ -0,0 +1,109 @@
+/**
+ * @file telemetry.cpp
+ * @brief Queues device telemetry for publishing, splitting readings that are
+ * too long for a single MqttMsg.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-04-05
+ */
+#include "telemetry.h"
+
+extern SemaphoreHandle_t serialMutex;
+extern QueueHandle_t mqttPublishQueue;
+
+TelemetryCounters telemetryCounters = {0};
+
+void telemetryEnqueue(MqttMsg &msg, const char *deviceName, JsonDocument &json, ArduinoJson::Allocator *allocator)
+{
+    // Without the time, Thingsboard timestamps the reading when it arrives, so
+    // the decoded document can be sent as is if it fits.
+    uint64_t timestamp = telemetryTimestamp();
+    if (!timestamp && measureJson(json) < MAX_JSON_TEXT_LENGTH)
+    {
+        serializeJson(json, msg.payload, MAX_JSON_TEXT_LENGTH);
+        TRACE_POINT(msg.trace, enqueued);
+        xQueueSend(mqttPublishQueue, (void *)&msg, portMAX_DELAY);
+        return;
+    }
+
+    // Otherwise add as many values as fit to each part. Usually there is only
+    // one.
+    JsonObjectConst values = json[deviceName][0];
+    JsonDocument part(allocator);
+    JsonObject partValues = telemetryStartPart(part, deviceName, timestamp);
+    uint8_t partCount = 0;
+    uint8_t partsSent = 0;
+    for (JsonPairConst pair : values)
+    {
+        // Add the value and check it still fits.
+        partValues[pair.key()] = pair.value();
+        if (measureJson(part) < MAX_JSON_TEXT_LENGTH)
+        {
+            partCount++;
+            continue;
+        }
+        partValues.remove(pair.key());
+
+        // Send what fitted and try again in a new part.
+        if (partCount)
+        {
+            telemetryEnqueuePart(msg, part);
+            partsSent++;
+            partValues = telemetryStartPart(part, deviceName, timestamp);
+            partValues[pair.key()] = pair.value();
+            if (measureJson(part) < MAX_JSON_TEXT_LENGTH)
+            {
+                partCount = 1;
+                continue;
+            }
+            partValues.remove(pair.key());
+            partCount = 0;
+        }
+
+        // Doesn't fit by itself.
+        LOGW("TELEMETRY", "Value '%s' from '%s' is too long to send.", pair.key().c_str(), deviceName);
+        telemetryCounters.truncated++;
+    }
+    if (partCount)
+    {
+        telemetryEnqueuePart(msg, part);
+        partsSent++;
+    }
+    if (partsSent > 1)
+    {
+        LOGD("TELEMETRY", "Reading from '%s' was too long, split into %d parts.", deviceName, partsSent);
+        telemetryCounters.split++;
+        telemetryCounters.parts += partsSent;
+    }
+}
+
+JsonObject telemetryStartPart(JsonDocument &part, const char *deviceName, uint64_t timestamp)
+{
+    part.clear();
+    JsonObject reading = part[deviceName].to<JsonArray>().add<JsonObject>();
+    if (timestamp)
+    {
+        reading["ts"] = timestamp;
+    }
+    return reading["values"].to<JsonObject>();
+}
+
+void telemetryEnqueuePart(MqttMsg &msg, JsonDocument &part)
+{
+    serializeJson(part, msg.payload, MAX_JSON_TEXT_LENGTH);
+    TRACE_POINT(msg.trace, enqueued);
+    xQueueSend(mqttPublishQueue, (void *)&msg, portMAX_DELAY);
+}
+
+uint64_t telemetryTimestamp()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec < TIME_VALID_AFTER)
+    {
+        // Not set by NTP yet.
+        return 0;
+    }
+    return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file telemetry.h
+ * @brief Queues device telemetry for publishing, splitting readings that are
+ * too long for a single MqttMsg.
+ *
+ * Once NTP has set the time, every reading is sent with a timestamp taken when
+ * it is queued. A reading that doesn't fit in MAX_JSON_TEXT_LENGTH is split
+ * into several gateway telemetry messages, each holding some of the values and
+ * the same timestamp, so they end up as one reading in Thingsboard.
+ *
+ * Before the time is set, readings are sent without a timestamp and
+ * Thingsboard uses the time each message arrives. A split reading then can't
+ * share a timestamp and shows up as several readings a moment apart. A made up
+ * time would be worse, as it would put the reading decades in the past.
+ *
+ * A single value that is too long by itself is dropped and counted as
+ * truncated.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-04-05
+ */
+
+#pragma once
+#include "../defines.h"
+#include "networking.h"
+
+/**
+ * @brief Counters for telemetry that didn't fit and how long readings are with
+ * each type of key. Totals since boot. Only changed from the receiving task.
+ *
+ */
+struct TelemetryCounters
+{
+    uint32_t split; // Readings that were split.
+    uint32_t parts; // Messages sent for split readings.
+    uint32_t truncated; // Values dropped as they were too long by themselves.
+    uint32_t readings; // Readings decoded.
+    uint32_t bytesFullKeys; // Total length of the readings with field names as keys.
+    uint32_t bytesCompactKeys; // Total length of the readings with field symbols as keys.
+};
+
+/**
+ * @brief Serialises a device reading into msg and queues it, splitting it into
+ * several messages if needed. Should only be called from the receiving task.
+ *
+ * @param msg the message to queue. The topic and trace are used for all parts.
+ * @param deviceName the name of the device.
+ * @param json the document produced by Device::decodePacketFields().
+ * @param allocator the allocator for building any extra documents.
+ */
+void telemetryEnqueue(MqttMsg &msg, const char *deviceName, JsonDocument &json, ArduinoJson::Allocator *allocator);
+
+/**
+ * @brief Returns the current time in ms since the epoch, or 0 if the time has
+ * not been set yet.
+ *
+ */
+uint64_t telemetryTimestamp();
+
+/**
+ * @brief Clears a document and sets it up as the start of a part of a
+ * reading.
+ *
+ * @param part the document for the part.
+ * @param deviceName the name of the device.
+ * @param timestamp the time of the reading, or 0 to leave it out.
+ * @return JsonObject the object to add values to.
+ */
+JsonObject telemetryStartPart(JsonDocument &part, const char *deviceName, uint64_t timestamp);
+
+/**
+ * @brief Serialises a part of a reading and queues it.
+ *
+ * @param msg the message to queue.
+ * @param part the part to send.
+ */
+void telemetryEnqueuePart(MqttMsg &msg, JsonDocument &part);
@@ -15,6 +15,7 @@ extern QueueHandle_t mqttPublishQueue;
 #ifdef USE_BMP180
 Adafruit_BMP085 bmp;
 #endif
+StaticArena<JSON_ARENA_SMALL_SIZE> timeseriesArena;
 
 void timeseriesTask(void *pvParameters)
 {
@@ -29,7 +30,8 @@ void timeseriesTask(void *pvParameters)
     while (true)
     {
         // Take readings
-        JsonDocument json;
+        ArenaScope scope(timeseriesArena);
+        JsonDocument json(&timeseriesArena);
 #ifdef USE_BMP180
         json["temperature"] = bmp.readTemperature();
         json["pressure"] = bmp.readPressure();
@@ -12,6 +12,7 @@
 
 #ifdef GENERATE_TIMESERIES
 #include "topics.h"
+#include "arena.h"
 
 /**
  * @brief Task for taking measurements and sending timeseries data from this device.
@@ -15,10 +15,11 @@ namespace Topic
     const char* const DEVICE_CONNECT = "v1/gateway/connect";
     const char* const DEVICE_DISCONNECT = "v1/gateway/disconnect";   
     const char* const TELEMETRY_UPLOAD = "v1/gateway/telemetry";
+    const char* const ATTRIBUTE_GATEWAY_UPLOAD = "v1/gateway/attributes";
     const char* const RPC_GATEWAY = "v1/gateway/rpc";
     const char* const RPC_ME = "v1/devices/me/rpc/request/";
     const char* const RPC_ME_SUBSCRIBE = "v1/devices/me/rpc/request/+";
     const char* const RPC_ME_RESPOND = "v1/devices/me/rpc/response/";
-    const char* const ATTRIBUTE_ME_UPLOAD = "v1/devices/me/attributes";
+    const char* const ATTRIBUTE_ME_UPLOAD = "v1/devices/me/attributes"; // Also where shared attribute updates arrive.
     const char* const TELEMETRY_ME_UPLOAD = "v1/devices/me/telemetry";
 }
\ No newline at end of file
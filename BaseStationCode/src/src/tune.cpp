@@ -0,0 +1,226 @@
+/**
+ * @file tune.cpp
+ * @brief Plays tunes in the TunePlayer format on the speaker in the background.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-04-26
+ */
+#include "tune.h"
+
+#ifdef PIN_SPEAKER
+#include <atomic>
+extern SemaphoreHandle_t serialMutex;
+
+TuneSchedule tuneSchedule;
+esp_timer_handle_t tuneTimer;
+uint16_t tunePosition; // Only used by the timer callback while playing.
+std::atomic<bool> tunePlaying(false);
+std::atomic<bool> tuneInCallback(false);
+bool tuneAttached = false;
+
+/**
+ * @brief Starts the next step and sets the timer for the one after.
+ *
+ */
+static void tuneTimerCallback(void *arg)
+{
+    tuneInCallback = true;
+    if (tunePlaying)
+    {
+        if (tunePosition < tuneSchedule.length)
+        {
+            const TuneStep &step = tuneSchedule.steps[tunePosition++];
+            ledcWriteTone(PIN_SPEAKER, step.frequency);
+            esp_timer_start_once(tuneTimer, step.duration * 1000ULL);
+        }
+        else
+        {
+            // Finished.
+            ledcWriteTone(PIN_SPEAKER, 0);
+            tunePlaying = false;
+        }
+    }
+    tuneInCallback = false;
+}
+
+void tuneBegin()
+{
+    esp_timer_create_args_t args = {
+        .callback = tuneTimerCallback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "tune",
+        .skip_unhandled_events = true};
+    if (esp_timer_create(&args, &tuneTimer) != ESP_OK)
+    {
+        LOGE("TUNE", "Could not create the timer.");
+    }
+}
+
+/**
+ * @brief Adds a step to the schedule.
+ *
+ * @return true if there was room.
+ */
+static bool tuneAddStep(uint16_t frequency, uint16_t duration)
+{
+    if (duration == 0)
+    {
+        return true;
+    }
+    if (tuneSchedule.length == TUNE_MAX_STEPS)
+    {
+        return false;
+    }
+    tuneSchedule.steps[tuneSchedule.length++] = {frequency, duration};
+    return true;
+}
+
+/**
+ * @brief A repeat that is being played.
+ *
+ */
+struct TuneRepeat
+{
+    uint16_t index; // Word of the repeat.
+    uint8_t left; // Times left to go back.
+};
+
+/**
+ * @brief Decodes a tune into tuneSchedule.
+ *
+ * @return NULL if successful, otherwise a description of the error.
+ */
+static const char *tuneDecode(const uint16_t *tune)
+{
+    uint16_t bpm = TUNE_DEFAULT_BPM;
+    TuneRepeat repeats[TUNE_MAX_REPEAT_DEPTH];
+    uint8_t depth = 0;
+    uint16_t flagged = 0;
+    uint16_t i = 0;
+    for (uint16_t words = 0; words < TUNE_MAX_WORDS; words++)
+    {
+        uint16_t word = tune[i];
+        switch (word >> 12)
+        {
+        case TUNE_END:
+            if (flagged)
+            {
+                LOGI("TUNE", "Ignored the flags on %d notes.", flagged);
+            }
+            return NULL;
+
+        case TUNE_TEMPO:
+            bpm = max(word & 0x0fff, 1);
+            i++;
+            break;
+
+        case TUNE_REPEAT:
+        {
+            // Start a new repeat or continue the innermost one. Any repeats
+            // inside this one have finished by the time it is reached.
+            uint16_t back = word & 0x3ff;
+            if (back == 0 || back > i)
+            {
+                return "Repeat goes outside the tune";
+            }
+            if (depth == 0 || repeats[depth - 1].index != i)
+            {
+                if (depth == TUNE_MAX_REPEAT_DEPTH)
+                {
+                    return "Repeats nested too deeply";
+                }
+                repeats[depth++] = {i, (uint8_t)(((word >> 10) & 0x3) + 1)};
+            }
+            TuneRepeat &repeat = repeats[depth - 1];
+            if (repeat.left)
+            {
+                repeat.left--;
+                i -= back;
+            }
+            else
+            {
+                depth--;
+                i++;
+            }
+            break;
+        }
+
+        default:
+        {
+            // A note or rest.
+            uint8_t note = word >> 12;
+            uint8_t octave = (word >> 9) & 0x7;
+            uint16_t length = ((word >> 3) & 0x3f) + 1;
+            uint16_t duration = length * 60000UL / (bpm * 16UL); // 16 64th notes in a quarter note.
+            uint16_t frequency = 0;
+            if (note != TUNE_REST)
+            {
+                int midi = 12 * (octave + 1) + note;
+                frequency = 440.0 * powf(2, (midi - 69) / 12.0);
+            }
+            if (word & 0x7)
+            {
+                flagged++;
+            }
+
+            // Leave a short gap so that repeated notes can be heard separately.
+            uint16_t gap = min<uint16_t>(duration / 4, TUNE_NOTE_GAP);
+            if (!tuneAddStep(frequency, duration - gap) || !tuneAddStep(0, gap))
+            {
+                return "Too long";
+            }
+            i++;
+        }
+        }
+    }
+    return "No end";
+}
+
+bool tuneLoad(const uint16_t *tune)
+{
+    tuneStop();
+    tuneSchedule.length = 0;
+    const char *error = tuneDecode(tune);
+    if (error)
+    {
+        LOGW("TUNE", "Could not load the tune (%s).", error);
+        tuneSchedule.length = 0;
+        return false;
+    }
+    return true;
+}
+
+void tunePlay()
+{
+    tuneStop();
+    tuneAttached = ledcAttach(PIN_SPEAKER, 1000, TUNE_LEDC_RESOLUTION);
+    if (!tuneAttached)
+    {
+        LOGE("TUNE", "Could not use LEDC on the speaker pin.");
+        return;
+    }
+    tunePosition = 0;
+    tunePlaying = true;
+    esp_timer_start_once(tuneTimer, 1); // Start the first step from the callback as well.
+}
+
+void tuneStop()
+{
+    // Wait for a callback that may have started before playing was cleared so
+    // it can't restart the timer afterwards.
+    tunePlaying = false;
+    while (tuneInCallback)
+    {
+        vTaskDelay(1);
+    }
+    esp_timer_stop(tuneTimer);
+    if (tuneAttached)
+    {
+        ledcWriteTone(PIN_SPEAKER, 0);
+        ledcDetach(PIN_SPEAKER);
+        tuneAttached = false;
+    }
+}
+#endif
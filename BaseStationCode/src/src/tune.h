@@ -0,0 +1,83 @@
+/**
+ * @file tune.h
+ * @brief Plays tunes in the TunePlayer format on the speaker in the background.
+ *
+ * Tunes are decoded into a schedule of frequencies and durations when loaded.
+ * Each step is then started from an esp_timer callback using LEDC to make the
+ * tone, so nothing needs to poll while a tune is playing.
+ *
+ * Each 16 bit word of a tune (as written by the TunePlayer MuseScore plugin) is
+ * one of:
+ * - A note: bits 15-12 are the note (0 = C to 11 = B, 12 is a rest), bits 11-9
+ *   the octave and bits 8-3 the length in 64th notes minus 1. Bits 2-0 are
+ *   flags set by some versions of the MuseScore plugin (such as 0xb77c in the
+ *   alarm). These aren't decoded, so the note is played plainly and the number
+ *   of notes with flags is logged.
+ * - 0xD: a repeat. Bits 9-0 are how many words to go back and bits 11-10 the
+ *   number of times to repeat minus 1. Repeats may be inside other repeats (up
+ *   to TUNE_MAX_REPEAT_DEPTH deep), in which case the inner one is played in
+ *   full each time the outer one goes around.
+ * - 0xE: a tempo change. Bits 11-0 are the new tempo in quarter notes per
+ *   minute.
+ * - 0xF: the end of the tune.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-04-26
+ */
+#pragma once
+#include "../defines.h"
+
+#ifdef PIN_SPEAKER
+#define TUNE_REST 0xC
+#define TUNE_REPEAT 0xD
+#define TUNE_TEMPO 0xE
+#define TUNE_END 0xF
+
+/**
+ * @brief A tone (or silence if frequency is 0) for some time.
+ *
+ */
+struct TuneStep
+{
+    uint16_t frequency;
+    uint16_t duration; // In ms.
+};
+
+/**
+ * @brief A tune decoded into steps.
+ *
+ */
+struct TuneSchedule
+{
+    uint16_t length;
+    TuneStep steps[TUNE_MAX_STEPS];
+};
+
+/**
+ * @brief Creates the timer used for playing tunes.
+ *
+ */
+void tuneBegin();
+
+/**
+ * @brief Decodes a tune into tuneSchedule. Stops anything already playing.
+ *
+ * @param tune the tune in the TunePlayer format.
+ * @return true if the whole tune fitted and was valid. Otherwise the schedule
+ * is left empty.
+ */
+bool tuneLoad(const uint16_t *tune);
+
+/**
+ * @brief Starts playing tuneSchedule from the beginning. Returns straight away.
+ *
+ */
+void tunePlay();
+
+/**
+ * @brief Stops playing and releases the speaker pin.
+ *
+ */
+void tuneStop();
+#endif
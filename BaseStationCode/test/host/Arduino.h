@@ -0,0 +1,142 @@
+/**
+ * @file Arduino.h
+ * @brief Just enough of Arduino, FreeRTOS and ESP-IDF for the parts of the
+ * gateway between the radio and MQTT to build and run on a computer (see
+ * test/test_replay). Only used by the native environment.
+ *
+ * Time only moves when hostAdvance() is called, so replays are repeatable.
+ * Tasks are never run, so waiting on a full queue fails straight away instead
+ * of blocking.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-05-31
+ */
+#pragma once
+#include <stdint.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+using std::max;
+using std::min;
+typedef uint8_t byte;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Time
+extern uint64_t hostMicros;
+inline uint32_t micros() { return hostMicros; }
+inline uint32_t millis() { return hostMicros / 1000; }
+inline void hostAdvance(uint32_t ms) { hostMicros += (uint64_t)ms * 1000; }
+
+// The wall clock starts unset, like on the ESP32 before NTP. Setting hostEpoch
+// (in s) acts as if NTP set it when hostMicros was 0.
+extern uint32_t hostEpoch;
+inline int hostGettimeofday(struct timeval *tv, void *tz)
+{
+    tv->tv_sec = hostEpoch + hostMicros / 1000000;
+    tv->tv_usec = hostMicros % 1000000;
+    return 0;
+}
+#define gettimeofday hostGettimeofday
+
+// Logging. Set HOST_LOG to see what the gateway logs.
+#ifdef HOST_LOG
+#define HOST_LOG_PRINT(level, format, ...) printf(level " " format "\n", ##__VA_ARGS__)
+#else
+#define HOST_LOG_PRINT(level, format, ...) do {} while (0)
+#endif
+#define log_v(format, ...) HOST_LOG_PRINT("V", format, ##__VA_ARGS__)
+#define log_d(format, ...) HOST_LOG_PRINT("D", format, ##__VA_ARGS__)
+#define log_i(format, ...) HOST_LOG_PRINT("I", format, ##__VA_ARGS__)
+#define log_w(format, ...) HOST_LOG_PRINT("W", format, ##__VA_ARGS__)
+#define log_e(format, ...) HOST_LOG_PRINT("E", format, ##__VA_ARGS__)
+
+/**
+ * @brief Output that ArduinoJson can serialise to.
+ *
+ */
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t written = 0;
+        while (written < size && write(buffer[written]))
+        {
+            written++;
+        }
+        return written;
+    }
+    virtual void flush() {}
+};
+
+// FreeRTOS
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+struct StaticTask_t {};
+struct StaticQueue_t {};
+struct StaticSemaphore_t {};
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY UINT32_MAX
+#define portTICK_PERIOD_MS 1
+
+/**
+ * @brief A queue that copies items in and out like a FreeRTOS queue.
+ *
+ */
+struct HostQueue
+{
+    size_t itemSize;
+    size_t length;
+    std::deque<std::vector<uint8_t>> items;
+};
+typedef HostQueue *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(size_t length, size_t itemSize) { return new HostQueue{itemSize, length, {}}; }
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    if (queue->items.size() >= queue->length)
+    {
+        return pdFALSE;
+    }
+    queue->items.emplace_back((const uint8_t *)item, (const uint8_t *)item + queue->itemSize);
+    return pdTRUE;
+}
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    if (queue->items.empty())
+    {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    return pdTRUE;
+}
+inline size_t uxQueueMessagesWaiting(QueueHandle_t queue) { return queue->items.size(); }
+
+// Nothing else runs at the same time.
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t wait) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) { return pdTRUE; }
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) { return pdTRUE; }
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) do {} while (0)
+#define portEXIT_CRITICAL(mux) do {} while (0)
+
+// ESP-IDF and networking types used in declarations.
+typedef int esp_reset_reason_t;
+typedef int arduino_event_id_t;
+struct arduino_event_info_t {};
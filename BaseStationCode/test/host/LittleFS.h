@@ -0,0 +1,2 @@
+// Nothing needed from this on a computer (see Arduino.h).
+#pragma once
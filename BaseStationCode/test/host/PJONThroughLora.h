@@ -0,0 +1,22 @@
+// The parts of PJON used by the receive path on a computer (see Arduino.h).
+#pragma once
+#include <stdint.h>
+
+#define PJON_PACKET_MAX_LENGTH 50
+#define PJON_MAX_PACKETS 5
+
+struct PJON_Endpoint
+{
+    uint8_t id;
+};
+
+struct PJON_Packet_Info
+{
+    PJON_Endpoint tx;
+    PJON_Endpoint rx;
+};
+
+// Only named by lora.h. The bus isn't used on a computer.
+class PJONThroughLora
+{
+};
@@ -0,0 +1,35 @@
+// Numbers kept in memory in place of NVS, for the key map hash with
+// COMPACT_TELEMETRY_KEYS (see Arduino.h).
+#pragma once
+#include <map>
+#include <string>
+
+class Preferences
+{
+public:
+    bool begin(const char *name, bool readOnly = false)
+    {
+        m_prefix = std::string(name) + "/";
+        return true;
+    }
+    void end() {}
+    uint32_t getUInt(const char *key, uint32_t defaultValue = 0)
+    {
+        auto found = values().find(m_prefix + key);
+        return found == values().end() ? defaultValue : found->second;
+    }
+    size_t putUInt(const char *key, uint32_t value)
+    {
+        values()[m_prefix + key] = value;
+        return sizeof(value);
+    }
+
+private:
+    static std::map<std::string, uint32_t> &values()
+    {
+        static std::map<std::string, uint32_t> stored;
+        return stored;
+    }
+
+    std::string m_prefix;
+};
@@ -0,0 +1,6 @@
+// Only referenced by declarations on a computer (see Arduino.h).
+#pragma once
+
+class PubSubClient
+{
+};
@@ -0,0 +1,146 @@
+/**
+ * @file test_ircodec.cpp
+ * @brief Tests compressing and expanding learnt IR codes. Run on a computer
+ * with `pio test -e native`.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-05-24
+ */
+#include <unity.h>
+#include <string.h>
+#include "ircodec.h"
+
+#define TEST_KHZ 38
+
+IrFrame original;
+IrFrame decoded;
+uint8_t code[IR_CODE_MAX_SIZE];
+
+/**
+ * @brief Adds up to +-jitter us to a time, as a receiver would. Repeatable so
+ * that failures can be reproduced.
+ *
+ */
+static uint16_t jittered(uint16_t time, uint16_t jitter)
+{
+    static uint32_t seed = 12345;
+    seed = seed * 1103515245 + 12345;
+    return time + (int32_t)((seed >> 16) % (2 * jitter + 1)) - jitter;
+}
+
+/**
+ * @brief Fills original with a Toshiba style code with jittered times, keeping
+ * the exact times in nominal.
+ *
+ */
+static void buildJitteredFrame(uint16_t *nominal)
+{
+    const uint8_t data[] = {0xf2, 0x0d, 0x03, 0xfc, 0x01, 0x50, 0x00, 0x00, 0x51};
+    original.clear();
+    uint16_t length = 0;
+    nominal[length++] = HVAC_TOSHIBA_HDR_MARK;
+    nominal[length++] = HVAC_TOSHIBA_HDR_SPACE;
+    for (uint8_t i = 0; i < sizeof(data); i++)
+    {
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            nominal[length++] = HVAC_TOSHIBA_BIT_MARK;
+            nominal[length++] = data[i] & (0x80 >> bit) ? HVAC_TOSHIBA_ONE_SPACE : HVAC_TOSHIBA_ZERO_SPACE;
+        }
+    }
+    nominal[length++] = HVAC_TOSHIBA_RPT_MARK;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        bool fits = i & 1 ? original.space(jittered(nominal[i], 60)) : original.mark(jittered(nominal[i], 60));
+        TEST_ASSERT_TRUE(fits);
+    }
+    TEST_ASSERT_EQUAL_UINT16(length, original.length);
+}
+
+void setUp()
+{
+    memset(code, 0, sizeof(code));
+}
+
+void tearDown() {}
+
+/**
+ * @brief Every time should come back within the grouping tolerance of the
+ * nominal time it was measured from.
+ *
+ */
+void test_jittered_round_trip()
+{
+    uint16_t nominal[IR_FRAME_MAX];
+    buildJitteredFrame(nominal);
+
+    size_t size = irCodeEncode(original, TEST_KHZ, code, sizeof(code));
+    TEST_ASSERT_NOT_EQUAL(0, size);
+    TEST_ASSERT_LESS_OR_EQUAL(IR_CODE_MAX_SIZE, size);
+
+    uint8_t khz = 0;
+    TEST_ASSERT_TRUE(irCodeDecode(code, size, decoded, khz));
+    TEST_ASSERT_EQUAL_UINT8(TEST_KHZ, khz);
+    TEST_ASSERT_EQUAL_UINT16(original.length, decoded.length);
+    for (uint16_t i = 0; i < decoded.length; i++)
+    {
+        uint16_t tolerance = nominal[i] * IR_CODE_TOLERANCE_PERCENT / 100;
+        if (tolerance < IR_CODE_MIN_TOLERANCE)
+        {
+            tolerance = IR_CODE_MIN_TOLERANCE;
+        }
+        TEST_ASSERT_UINT16_WITHIN(tolerance, nominal[i], decoded.durations[i]);
+    }
+}
+
+/**
+ * @brief A code with more different times than the table can hold is refused.
+ *
+ */
+void test_too_many_times()
+{
+    // Each time is 30% longer than the last, so none can be grouped.
+    original.clear();
+    uint32_t time = 600;
+    for (uint8_t i = 0; i < IR_CODE_MAX_TIMES + 1; i++)
+    {
+        TEST_ASSERT_TRUE(i & 1 ? original.space(time) : original.mark(time));
+        time = time * 13 / 10;
+    }
+    TEST_ASSERT_EQUAL(0, irCodeEncode(original, TEST_KHZ, code, sizeof(code)));
+
+    // One fewer is fine.
+    original.length--;
+    TEST_ASSERT_NOT_EQUAL(0, irCodeEncode(original, TEST_KHZ, code, sizeof(code)));
+}
+
+/**
+ * @brief Codes cut short (such as a partly written file) are rejected rather
+ * than read past the end.
+ *
+ */
+void test_truncated_code()
+{
+    uint16_t nominal[IR_FRAME_MAX];
+    buildJitteredFrame(nominal);
+    size_t size = irCodeEncode(original, TEST_KHZ, code, sizeof(code));
+    TEST_ASSERT_NOT_EQUAL(0, size);
+
+    uint8_t khz;
+    TEST_ASSERT_FALSE(irCodeDecode(code, size - 1, decoded, khz));
+    TEST_ASSERT_FALSE(irCodeDecode(code, sizeof(IrCodeHeader) - 1, decoded, khz));
+    TEST_ASSERT_FALSE(irCodeDecode(code, 0, decoded, khz));
+
+    // Not enough room to encode into either.
+    TEST_ASSERT_EQUAL(0, irCodeEncode(original, TEST_KHZ, code, size - 1));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_jittered_round_trip);
+    RUN_TEST(test_too_many_times);
+    RUN_TEST(test_truncated_code);
+    return UNITY_END();
+}
@@ -0,0 +1,103 @@
+/**
+ * @file test_irframe.cpp
+ * @brief Tests building IR frames from protocol timings. Run on a computer
+ * with `pio test -e native`.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-05-24
+ */
+#include <unity.h>
+#include "irframe.h"
+
+#define TOSHIBA_LENGTH 9
+#define TOSHIBA_FRAME_LENGTH (2 + TOSHIBA_LENGTH * 16 + 2) // Header, a mark and space per bit, end mark and gap.
+
+IrFrame frame;
+const uint8_t toshibaData[TOSHIBA_LENGTH] = {0xf2, 0x0d, 0x03, 0xfc, 0x01, 0x50, 0x00, 0x00, 0x51};
+
+void setUp()
+{
+    frame.clear();
+}
+
+void tearDown() {}
+
+/**
+ * @brief Checks one copy of a Toshiba frame starting at offset.
+ *
+ */
+static void checkToshibaFrame(uint16_t offset)
+{
+    const uint16_t *durations = frame.durations + offset;
+    TEST_ASSERT_EQUAL_UINT16(HVAC_TOSHIBA_HDR_MARK, durations[0]);
+    TEST_ASSERT_EQUAL_UINT16(HVAC_TOSHIBA_HDR_SPACE, durations[1]);
+    for (uint8_t i = 0; i < TOSHIBA_LENGTH; i++)
+    {
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            // Most significant bit first.
+            bool one = toshibaData[i] & (0x80 >> bit);
+            uint16_t index = 2 + (i * 8 + bit) * 2;
+            TEST_ASSERT_EQUAL_UINT16(HVAC_TOSHIBA_BIT_MARK, durations[index]);
+            TEST_ASSERT_EQUAL_UINT16(one ? HVAC_TOSHIBA_ONE_SPACE : HVAC_TOSHIBA_ZERO_SPACE, durations[index + 1]);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT16(HVAC_TOSHIBA_RPT_MARK, durations[TOSHIBA_FRAME_LENGTH - 2]);
+    TEST_ASSERT_EQUAL_UINT16(HVAC_TOSHIBA_RPT_SPACE, durations[TOSHIBA_FRAME_LENGTH - 1]);
+}
+
+/**
+ * @brief Toshiba sends the frame twice, each with a header, the bits MSB first
+ * and the repeat gap.
+ *
+ */
+void test_toshiba_sequence()
+{
+    TEST_ASSERT_TRUE(frame.bytes(toshibaTimings, toshibaData, TOSHIBA_LENGTH));
+    TEST_ASSERT_TRUE(frame.bytes(toshibaTimings, toshibaData, TOSHIBA_LENGTH));
+    TEST_ASSERT_EQUAL_UINT16(2 * TOSHIBA_FRAME_LENGTH, frame.length);
+    checkToshibaFrame(0);
+    checkToshibaFrame(TOSHIBA_FRAME_LENGTH);
+}
+
+/**
+ * @brief Marks or spaces next to each other are joined and spaces before the
+ * first mark are dropped.
+ *
+ */
+void test_joins_and_leading_space()
+{
+    TEST_ASSERT_TRUE(frame.space(1000));
+    TEST_ASSERT_EQUAL_UINT16(0, frame.length);
+    TEST_ASSERT_TRUE(frame.mark(500));
+    TEST_ASSERT_TRUE(frame.mark(200));
+    TEST_ASSERT_TRUE(frame.space(300));
+    TEST_ASSERT_EQUAL_UINT16(2, frame.length);
+    TEST_ASSERT_EQUAL_UINT16(700, frame.durations[0]);
+    TEST_ASSERT_EQUAL_UINT16(300, frame.durations[1]);
+    TEST_ASSERT_EQUAL_UINT32(1000, frame.duration());
+}
+
+/**
+ * @brief Adding to a full frame fails rather than overflowing.
+ *
+ */
+void test_full_frame()
+{
+    for (uint16_t i = 0; i < IR_FRAME_MAX; i++)
+    {
+        TEST_ASSERT_TRUE(i & 1 ? frame.space(100) : frame.mark(100));
+    }
+    TEST_ASSERT_FALSE(frame.mark(100));
+    TEST_ASSERT_EQUAL_UINT16(IR_FRAME_MAX, frame.length);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_toshiba_sequence);
+    RUN_TEST(test_joins_and_leading_space);
+    RUN_TEST(test_full_frame);
+    return UNITY_END();
+}
@@ -0,0 +1,38 @@
+/**
+ * @file host_gateway.cpp
+ * @brief Builds the parts of the gateway that decode packets and queue them
+ * for MQTT on a computer, along with the globals they use from the rest of the
+ * gateway. Arduino, FreeRTOS and ESP-IDF are replaced by test/host.
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-05-31
+ */
+#include "../../src/src/arena.cpp"
+#include "../../src/src/conversions.cpp"
+#include "../../src/src/fields.cpp"
+#include "../../src/src/devices.cpp"
+#include "../../src/src/telemetry.cpp"
+#include "../../src/src/dedup.cpp"
+#include "../../src/device_list.h"
+
+uint64_t hostMicros = 0;
+uint32_t hostEpoch = 0;
+
+// From main.cpp.
+SemaphoreHandle_t serialMutex;
+SemaphoreHandle_t mqttMutex;
+PubSubClient mqtt;
+TaskHandle_t ledTaskHandle = NULL;
+TaskHandle_t loraTxTaskHandle = NULL;
+QueueHandle_t mqttPublishQueue = xQueueCreate(MQTT_PUBLISH_QUEUE_LENGTH, sizeof(MqttMsg));
+
+// From lora.cpp and networking.cpp.
+StaticArena<JSON_ARENA_SIZE> pjonArena;
+StaticArena<JSON_ARENA_SIZE> networkingArena;
+
+bool mqttPublishJson(const char *topic, JsonVariantConst json)
+{
+    // Only used when registering devices, which replays don't do.
+    return false;
+}
@@ -0,0 +1,369 @@
+/**
+ * @file test_replay.cpp
+ * @brief Replays captured packets through the decoder and telemetry queue on a
+ * computer, at the original speed or faster. Run with `pio test -e native`.
+ *
+ * A capture downloaded from the base station (joined with
+ * `capture_tool.py assemble`) can be replayed as a regression corpus and
+ * throughput benchmark by setting CAPTURE_FILE to its path and optionally
+ * CAPTURE_SPEED (0, the default, is as fast as possible).
+ *
+ * @author Jotham Gates
+ * @version 0.1
+ * @date 2025-05-31
+ */
+#include <unity.h>
+#include <chrono>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include "capturerecord.h"
+#include "../../src/src/devices.h"
+#include "../../src/src/telemetry.h"
+#include "../../src/src/dedup.h"
+
+#define RING_SLOTS 8
+#define RING_NEXT 3 // Where the ring wraps around, so the oldest record isn't in slot 0.
+#define PUMP_ID 0x5A
+#define FENCE_MONITOR_ID 168
+#define WATER_ID 167
+#define UNKNOWN_ID 42
+
+extern DeviceManager deviceManager;
+extern QueueHandle_t mqttPublishQueue;
+extern StaticArena<JSON_ARENA_SIZE> pjonArena;
+extern TelemetryCounters telemetryCounters;
+
+/**
+ * @brief A message that would have been published.
+ *
+ */
+struct Published
+{
+    uint32_t time; // ms since the start of the replay.
+    std::string payload;
+};
+
+/**
+ * @brief Counts from a replay.
+ *
+ */
+struct ReplayResult
+{
+    uint32_t records;
+    uint32_t unknown; // Records from devices that aren't in device_list.h.
+    uint32_t failed; // Records that couldn't be completely decoded.
+};
+
+CaptureHeader header;
+CaptureRecord ring[RING_SLOTS];
+std::vector<Published> published;
+
+/**
+ * @brief Decodes and queues a record in the same way that rxDecode() does for
+ * a packet from the radio.
+ *
+ */
+static void decodeRecord(CaptureRecord &record, ReplayResult &result)
+{
+    Device *device = deviceManager.getWithSymbol((char)record.tx);
+    if (!device)
+    {
+        result.unknown++;
+        return;
+    }
+
+    ArenaScope scope(pjonArena);
+    JsonDocument json(&pjonArena);
+    if (device->decodePacketFields(record.payload, record.length, json, record.rssi, record.snr / 4.0) != DECODE_SUCCESS)
+    {
+        result.failed++;
+    }
+    size_t fullLength, compactLength;
+    device->measureKeys(json, fullLength, compactLength);
+    telemetryCounters.readings++;
+    telemetryCounters.bytesFullKeys += fullLength;
+    telemetryCounters.bytesCompactKeys += compactLength;
+    MqttMsg msg{Topic::TELEMETRY_UPLOAD, ""};
+    telemetryEnqueue(msg, device->name, json, &pjonArena);
+}
+
+/**
+ * @brief Replays a capture in the same order and with the same timing as
+ * captureReplayPoll(), collecting what would be published in published.
+ *
+ * @param records the slots of the capture.
+ * @param speed the speed multiplier, or 0 for as fast as possible.
+ */
+static ReplayResult replay(const CaptureHeader &header, CaptureRecord *records, float speed)
+{
+    ReplayResult result = {};
+    CaptureReplayClock clock;
+    uint32_t start = millis();
+    clock.start(start, speed);
+    for (uint32_t i = 0; i < header.count; i++)
+    {
+        CaptureRecord &record = records[captureSlot(header, i)];
+        int32_t wait = clock.next(record.time) - millis();
+        if (wait > 0)
+        {
+            hostAdvance(wait);
+        }
+        decodeRecord(record, result);
+        result.records++;
+
+        // Take everything queued, as the networking task would.
+        MqttMsg msg;
+        while (xQueueReceive(mqttPublishQueue, (void *)&msg, 0))
+        {
+            published.push_back({millis() - start, msg.payload});
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Makes a record from a packet.
+ *
+ */
+static CaptureRecord makeRecord(uint32_t time, uint8_t tx, int16_t rssi, int8_t snr, std::initializer_list<uint8_t> payload)
+{
+    CaptureRecord record = {};
+    record.time = time;
+    record.tx = tx;
+    record.rx = PJON_DEVICE_ID;
+    record.rssi = rssi;
+    record.snr = snr;
+    record.length = payload.size();
+    std::copy(payload.begin(), payload.end(), record.payload);
+    return record;
+}
+
+void setUp()
+{
+    // A full ring that has wrapped around, with the base station restarting
+    // part way through (the times go back to near 0).
+    const CaptureRecord records[RING_SLOTS] = {
+        makeRecord(1000, PUMP_ID, -90, 29, {'T', 0xeb, 0x00, 'H', 55}),
+        makeRecord(3000, FENCE_MONITOR_ID, -110, -10, {'V', 0x7e, 0x00, 'k', 85}),
+        makeRecord(3500, UNKNOWN_ID, -100, 0, {'T', 0x00, 0x00}),
+        makeRecord(10000, WATER_ID, -80, 20, {'w', 0x10, 0x27}),
+        makeRecord(200, PUMP_ID, -91, 28, {'P', 0x14, 0x00, 'c', 0x03, 0x00}),
+        makeRecord(1200, FENCE_MONITOR_ID, -109, -8, {'T', 0x0a, 0xff}),
+        makeRecord(1300, WATER_ID, -81, 21, {'w', 0x11, 0x27, 'V'}),
+        makeRecord(5300, PUMP_ID, -92, 27, {'H', 60}),
+    };
+    header = {CAPTURE_MAGIC, sizeof(CaptureRecord), RING_SLOTS, RING_NEXT, RING_SLOTS, true};
+    for (uint8_t i = 0; i < RING_SLOTS; i++)
+    {
+        ring[(RING_NEXT + i) % RING_SLOTS] = records[i];
+    }
+    published.clear();
+}
+
+void tearDown()
+{
+    hostEpoch = 0;
+}
+
+/**
+ * @brief Checks the published messages were sent at the given times.
+ *
+ */
+static void checkTimes(std::initializer_list<uint32_t> times)
+{
+    TEST_ASSERT_EQUAL(times.size(), published.size());
+    uint8_t i = 0;
+    for (uint32_t time : times)
+    {
+        TEST_ASSERT_EQUAL_UINT32(time, published[i++].time);
+    }
+}
+
+/**
+ * @brief At the original speed, readings come out in the order they were
+ * received, with the original gaps and the same payloads as on the gateway.
+ *
+ */
+void test_original_speed()
+{
+    ReplayResult result = replay(header, ring, 1);
+    TEST_ASSERT_EQUAL_UINT32(RING_SLOTS, result.records);
+    TEST_ASSERT_EQUAL_UINT32(1, result.unknown);
+    TEST_ASSERT_EQUAL_UINT32(1, result.failed); // The last water reading is cut short.
+
+    // The restart replays straight after the record before it.
+    checkTimes({0, 2000, 9000, 9000, 10000, 10100, 14100});
+    TEST_ASSERT_EQUAL_STRING("{\"Main Pressure Pump\":[{\"Temperature\":23.5,\"Humidity\":55,\"SNR\":7.25,\"RSSI\":-90}]}", published[0].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"Electric fence monitor\":[{\"Battery Voltage\":12.6,\"Fence Voltage\":8.5,\"SNR\":-2.5,\"RSSI\":-110}]}", published[1].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"Irrigation Water Detector\":[{\"Water capacitive reading\":10000,\"SNR\":5,\"RSSI\":-80}]}", published[2].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"Main Pressure Pump\":[{\"Pump on time\":10.0,\"Count of pump starts in block\":3,\"SNR\":7,\"RSSI\":-91}]}", published[3].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"Electric fence monitor\":[{\"Temperature\":-24.6,\"SNR\":-2,\"RSSI\":-109}]}", published[4].payload.c_str());
+}
+
+/**
+ * @brief Faster replays scale the gaps and give the same readings.
+ *
+ */
+void test_accelerated()
+{
+    replay(header, ring, 1);
+    std::vector<Published> original = published;
+    published.clear();
+
+    replay(header, ring, 10);
+    checkTimes({0, 200, 900, 900, 1000, 1010, 1410});
+    for (uint8_t i = 0; i < published.size(); i++)
+    {
+        TEST_ASSERT_EQUAL_STRING(original[i].payload.c_str(), published[i].payload.c_str());
+    }
+}
+
+/**
+ * @brief A speed of 0 replays everything straight away.
+ *
+ */
+void test_as_fast_as_possible()
+{
+    replay(header, ring, 0);
+    checkTimes({0, 0, 0, 0, 0, 0, 0});
+}
+
+/**
+ * @brief Once the time is set, readings are sent with it, and every part of a
+ * reading that is too long for one message has the same timestamp.
+ *
+ */
+void test_timestamps()
+{
+    hostEpoch = 1750000000;
+    char start[80];
+    snprintf(start, sizeof(start), "{\"Main Pressure Pump\":[{\"ts\":%" PRIu64 ",\"values\":{", (uint64_t)hostEpoch * 1000 + millis());
+
+    // Fits in one message.
+    header.count = 1;
+    ring[0] = makeRecord(0, PUMP_ID, -90, 29, {'T', 0xeb, 0x00, 'H', 55});
+    replay(header, ring, 0);
+    TEST_ASSERT_EQUAL(1, published.size());
+    std::string expected = std::string(start) + "\"Temperature\":23.5,\"Humidity\":55,\"SNR\":7.25,\"RSSI\":-90}}]}";
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), published[0].payload.c_str());
+
+    // Every pump field at once is too long.
+    published.clear();
+    ring[0] = makeRecord(0, PUMP_ID, -90, 29, {'T', 0xeb, 0x00, 'H', 55, 'P', 0x14, 0x00, 'a', 0x14, 0x00, 'm', 0x14, 0x00, 'n', 0x14, 0x00, 'c', 0x03, 0x00, 'X', 0});
+    replay(header, ring, 0);
+    TEST_ASSERT_TRUE(published.size() > 1);
+    for (const Published &message : published)
+    {
+        TEST_ASSERT_EQUAL_STRING(start, message.payload.substr(0, strlen(start)).c_str());
+    }
+    TEST_ASSERT_TRUE(published.back().payload.find("\"RSSI\":-90") != std::string::npos);
+}
+
+/**
+ * @brief The key length counters match the readings actually published, with
+ * each field name replaced by its symbol for compact keys.
+ *
+ */
+void test_key_lengths()
+{
+    telemetryCounters = {0};
+    header.count = 1;
+    ring[0] = makeRecord(0, PUMP_ID, -90, 29, {'T', 0xeb, 0x00, 'H', 55});
+    replay(header, ring, 0);
+    TEST_ASSERT_EQUAL(1, published.size());
+    size_t length = published[0].payload.size();
+    size_t saved = strlen("Temperature") + strlen("Humidity") - 2;
+    TEST_ASSERT_EQUAL_UINT32(1, telemetryCounters.readings);
+#ifdef COMPACT_TELEMETRY_KEYS
+    TEST_ASSERT_EQUAL_UINT32(length + saved, telemetryCounters.bytesFullKeys);
+    TEST_ASSERT_EQUAL_UINT32(length, telemetryCounters.bytesCompactKeys);
+#else
+    TEST_ASSERT_EQUAL_UINT32(length, telemetryCounters.bytesFullKeys);
+    TEST_ASSERT_EQUAL_UINT32(length - saved, telemetryCounters.bytesCompactKeys);
+#endif
+}
+
+/**
+ * @brief Due times stay exact after a long uptime, where a float can't hold
+ * every ms.
+ *
+ */
+void test_clock_after_long_uptime()
+{
+    const uint32_t start = 100000000; // About 28 hours.
+    CaptureReplayClock clock;
+    clock.start(start, 2);
+    TEST_ASSERT_EQUAL_UINT32(start, clock.next(5000));
+    TEST_ASSERT_EQUAL_UINT32(start + 1, clock.next(5003));
+    TEST_ASSERT_EQUAL_UINT32(start + 501, clock.next(6003));
+}
+
+/**
+ * @brief Duplicates are judged by when packets were received, so packets
+ * decoded late after a backlog are treated the same as ones decoded straight
+ * away.
+ *
+ */
+void test_duplicate_window()
+{
+    DuplicateFilter filter;
+    const uint8_t payload[] = {'T', 0x01, 0x02};
+    TEST_ASSERT_FALSE(filter.isDuplicate(2, payload, sizeof(payload), 1000));
+    TEST_ASSERT_TRUE(filter.isDuplicate(2, payload, sizeof(payload), 1000 + DEDUP_WINDOW - 1));
+    TEST_ASSERT_FALSE(filter.isDuplicate(3, payload, sizeof(payload), 1000 + DEDUP_WINDOW - 1));
+    TEST_ASSERT_FALSE(filter.isDuplicate(2, payload, sizeof(payload), 1000 + DEDUP_WINDOW));
+    TEST_ASSERT_EQUAL_UINT32(4, filter.checked);
+    TEST_ASSERT_EQUAL_UINT32(1, filter.hits);
+}
+
+/**
+ * @brief Replays a capture downloaded from the base station if CAPTURE_FILE is
+ * set, reporting how quickly it decodes.
+ *
+ */
+void test_capture_file()
+{
+    const char *path = getenv("CAPTURE_FILE");
+    if (!path)
+    {
+        TEST_IGNORE_MESSAGE("Set CAPTURE_FILE to replay a capture joined with capture_tool.py.");
+    }
+    FILE *file = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL_MESSAGE(file, "Could not open CAPTURE_FILE.");
+    std::vector<CaptureRecord> records;
+    CaptureRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        records.push_back(record);
+    }
+    fclose(file);
+    TEST_ASSERT_NOT_EQUAL(0, records.size());
+
+    // The file holds the records oldest first, without the header.
+    CaptureHeader fileHeader = {CAPTURE_MAGIC, sizeof(CaptureRecord), (uint16_t)records.size(), 0, (uint32_t)records.size(), false};
+    const char *speed = getenv("CAPTURE_SPEED");
+    auto start = std::chrono::steady_clock::now();
+    ReplayResult result = replay(fileHeader, records.data(), speed ? atof(speed) : 0);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    char summary[160];
+    snprintf(summary, sizeof(summary), "%u records (%u unknown, %u not fully decoded), %u messages in %.3fs (%.0f records/s).",
+             result.records, result.unknown, result.failed, (unsigned)published.size(), seconds, result.records / seconds);
+    TEST_MESSAGE(summary);
+    TEST_ASSERT_EQUAL_UINT32(records.size(), result.records);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_original_speed);
+    RUN_TEST(test_accelerated);
+    RUN_TEST(test_as_fast_as_possible);
+    RUN_TEST(test_timestamps);
+    RUN_TEST(test_key_lengths);
+    RUN_TEST(test_clock_after_long_uptime);
+    RUN_TEST(test_duplicate_window);
+    RUN_TEST(test_capture_file);
+    return UNITY_END();
+}